@@ -361,11 +361,11 @@ static int loaderror(lua_State *L, const char *name) {
 static int Ltryload(lua_State *L) {
     PHYSFS_File *f = (PHYSFS_File*)lua_touserdata(L, 1);
     const char *name = lua_tostring(L, 2);
-    if (read_chars(L, f, ~(size_t)0)) {
-        size_t len;
-        const char *s = lua_tolstring(L, -1, &len);
+    PHYSFS_uint64 len; /* no copy if f is stored uncompressed in memory */
+    const char *s = (const char*)PHYSFS_mapFile(f, &len);
+    if (s != NULL) {
         lua_pushfstring(L, "@%s", name);
-        if (luaL_loadbuffer(L, s, len, lua_tostring(L, -1)) != LUA_OK)
+        if (luaL_loadbuffer(L, s, (size_t)len, lua_tostring(L, -1)) != LUA_OK)
             return loaderror(L, name);
         lua_pushvalue(L, 2);
         return 2;
@@ -408,9 +408,13 @@ static void open_loader(lua_State *L) {
 /* physfs routines */
 
 static int push_list(lua_State *L, char **list, const char *fn);
+static int push_files(lua_State *L, const char *dir);
 
-static int Lfiles(lua_State *L)
-{ return push_list(L, PHYSFS_enumerateFiles(luaL_checkstring(L, 1)), "files"); }
+static int Lfiles(lua_State *L) {
+    const char *dir = luaL_checkstring(L, 1);
+    if (lua_toboolean(L, 3)) return push_files(L, dir);
+    return push_list(L, PHYSFS_enumerateFiles(dir), "files");
+}
 
 static int LcdRomDirs(lua_State *L)
 { return push_list(L, PHYSFS_getCdRomDirs(), "cdRomDirs"); }
@@ -551,6 +555,87 @@ static int LuseSymlink(lua_State *L) {
     return 0;
 }
 
+static int LuseIndex(lua_State *L) {
+    if (lua_gettop(L) == 0) {
+        lua_pushboolean(L, PHYSFS_getSearchPathIndex());
+        return 1;
+    }
+    api("useIndex", setSearchPathIndex(lua_toboolean(L, 1)));
+    return_self(L);
+}
+
+static int LuseMmap(lua_State *L) {
+    if (lua_gettop(L) == 0) {
+        lua_pushboolean(L, PHYSFS_getArchiveMapping());
+        return 1;
+    }
+    api("useMmap", setArchiveMapping(lua_toboolean(L, 1)));
+    return_self(L);
+}
+
+static int LmissCache(lua_State *L) {
+    lua_Integer entries;
+    if (lua_gettop(L) == 0) {
+        lua_pushinteger(L, (lua_Integer)PHYSFS_getMissCacheSize());
+        return 1;
+    }
+    entries = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, entries >= 0 && entries <= 0xFFFFFFFF, 1,
+            "cache size out of range");
+    api("missCache", setMissCacheSize((PHYSFS_uint32)entries));
+    return_self(L);
+}
+
+static int LbuffSize(lua_State *L) {
+    lua_Integer size;
+    if (lua_gettop(L) == 0) {
+        lua_pushinteger(L, (lua_Integer)PHYSFS_getDefaultBuffer());
+        lua_pushboolean(L, PHYSFS_getAdaptiveBuffer());
+        return 2;
+    }
+    size = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, size >= 0, 1, "buffer size out of range");
+    api("buffSize", setAdaptiveBuffer(lua_toboolean(L, 2)));
+    api("buffSize", setDefaultBuffer((PHYSFS_uint64)size));
+    return_self(L);
+}
+
+static int LseekCheckpoints(lua_State *L) {
+    lua_Integer interval;
+    if (lua_gettop(L) == 0) {
+        lua_pushinteger(L, (lua_Integer)PHYSFS_getSeekCheckpoints());
+        return 1;
+    }
+    interval = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, interval >= 0, 1, "checkpoint interval out of range");
+    api("seekCheckpoints", setSeekCheckpoints((PHYSFS_uint64)interval));
+    return_self(L);
+}
+
+static int LinflaterPool(lua_State *L) {
+    lua_Integer count;
+    if (lua_gettop(L) == 0) {
+        lua_pushinteger(L, (lua_Integer)PHYSFS_getInflaterPool());
+        return 1;
+    }
+    count = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, count >= 0 && count <= 0xFFFFFFFF, 1,
+            "pool size out of range");
+    api("inflaterPool", setInflaterPool((PHYSFS_uint32)count));
+    return_self(L);
+}
+
+static int LindexCache(lua_State *L) {
+    const char *dir;
+    if (lua_gettop(L) == 0) {
+        lua_pushstring(L, PHYSFS_getIndexCacheDir());
+        return 1;
+    }
+    dir = lua_toboolean(L, 1) ? luaL_checkstring(L, 1) : NULL;
+    api("indexCache", setIndexCacheDir(dir));
+    return_self(L);
+}
+
 static int LlastError(lua_State *L) {
     if (lua_gettop(L) == 0) {
         PHYSFS_ErrorCode code = PHYSFS_getLastErrorCode();
@@ -577,34 +662,272 @@ static int LlastError(lua_State *L) {
     }
 }
 
-static int Lstat(lua_State *L) {
-    const char *s = luaL_checkstring(L, 1);
+static void set_stat(lua_State *L, int idx, const PHYSFS_Stat *buf) {
     const char *type = "Unknown";
-    PHYSFS_Stat buf;
-    api("stat", stat(s, &buf));
-    if (!lua_istable(L, 2)) {
-        lua_settop(L, 1);
-        lua_createtable(L, 0, 6);
-    }
-    switch (buf.filetype) {
+    switch (buf->filetype) {
     default: break;
     case PHYSFS_FILETYPE_REGULAR:   type = "file";    break;
     case PHYSFS_FILETYPE_DIRECTORY: type = "dir";     break;
     case PHYSFS_FILETYPE_SYMLINK:   type = "symlink"; break;
     case PHYSFS_FILETYPE_OTHER:     type = "other";   break;
     }
-#define setf(t, v, f) lua_push##t(L, v), lua_setfield(L, 2, f)
+#define setf(t, v, f) lua_push##t(L, v), lua_setfield(L, idx, f)
     setf(string,  type, "type");
-    setf(boolean, buf.readonly, "readonly");
-    setf(integer, (lua_Integer)buf.filesize,   "size");
-    setf(integer, (lua_Integer)buf.modtime,    "mtime");
-    setf(integer, (lua_Integer)buf.createtime, "ctime");
-    setf(integer, (lua_Integer)buf.accesstime, "atime");
+    setf(boolean, buf->readonly, "readonly");
+    setf(integer, (lua_Integer)buf->filesize,   "size");
+    setf(integer, (lua_Integer)buf->modtime,    "mtime");
+    setf(integer, (lua_Integer)buf->createtime, "ctime");
+    setf(integer, (lua_Integer)buf->accesstime, "atime");
 #undef  setf
+}
+
+static int Lstat(lua_State *L) {
+    const char *s = luaL_checkstring(L, 1);
+    PHYSFS_Stat buf;
+    api("stat", stat(s, &buf));
+    if (!lua_istable(L, 2)) {
+        lua_settop(L, 1);
+        lua_createtable(L, 0, 6);
+    }
+    set_stat(L, 2, &buf);
     lua_settop(L, 2);
     return 1;
 }
 
+/* physfs.files(dir, table, true): names plus their stats, in one pass.
+ * the callback runs with physfs locks held, so it must not raise Lua
+ * errors; entries are collected here and pushed afterwards. */
+
+typedef struct FileStat {
+    const char *name;
+    size_t      offset; /* into names, until the enumeration is done */
+    size_t      seq;    /* search path order, the first one wins */
+    PHYSFS_Stat stat;
+} FileStat;
+
+typedef struct FileStatList {
+    FileStat *items;
+    size_t    count, capacity;
+    char     *names;
+    size_t    namelen, namecap;
+} FileStatList;
+
+static int files_add(FileStatList *list, const char *name,
+        const PHYSFS_Stat *stat) {
+    size_t len = strlen(name) + 1;
+    if (list->count == list->capacity) {
+        size_t newcap = list->capacity ? list->capacity * 2 : 64;
+        void *p = realloc(list->items, newcap * sizeof(FileStat));
+        if (p == NULL) return 0;
+        list->items = (FileStat*)p, list->capacity = newcap;
+    }
+    if (list->namecap - list->namelen < len) {
+        size_t newcap = list->namecap ? list->namecap * 2 : 1024;
+        void *p;
+        while (newcap - list->namelen < len) newcap *= 2;
+        if ((p = realloc(list->names, newcap)) == NULL) return 0;
+        list->names = (char*)p, list->namecap = newcap;
+    }
+    memcpy(list->names + list->namelen, name, len);
+    list->items[list->count].offset = list->namelen;
+    list->items[list->count].seq    = list->count;
+    list->items[list->count].stat   = *stat;
+    list->namelen += len, ++list->count;
+    return 1;
+}
+
+static PHYSFS_EnumerateCallbackResult files_callback(void *data,
+        const char *origdir, const char *fname, const PHYSFS_Stat *stat) {
+    (void)origdir;
+    return files_add((FileStatList*)data, fname, stat) ?
+        PHYSFS_ENUM_OK : PHYSFS_ENUM_ERROR;
+}
+
+static int files_cmp(const void *lhs, const void *rhs) {
+    const FileStat *l = (const FileStat*)lhs, *r = (const FileStat*)rhs;
+    int cmp = strcmp(l->name, r->name);
+    if (cmp != 0) return cmp;
+    return l->seq < r->seq ? -1 : l->seq > r->seq;
+}
+
+static int push_files_helper(lua_State *L) {
+    FileStatList *list = lua_touserdata(L, 1);
+    int len = 0, count = 0;
+    size_t i;
+    if (lua_istable(L, 2))
+        len = lua_rawlen(L, 2);
+    else {
+        lua_settop(L, 1);
+        lua_createtable(L, (int)list->count, (int)list->count);
+    }
+    for (i = 0; i < list->count; ++i) {
+        const FileStat *fs = &list->items[i];
+        if (i > 0 && strcmp(fs[-1].name, fs->name) == 0)
+            continue;
+        lua_pushstring(L, fs->name);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, 2, ++count + len);
+        lua_createtable(L, 0, 6);
+        set_stat(L, 4, &fs->stat);
+        lua_rawset(L, 2);
+    }
+    return 1;
+}
+
+static int push_files(lua_State *L, const char *dir) {
+    FileStatList list;
+    size_t i;
+    int r;
+    memset(&list, 0, sizeof(list));
+    if (!PHYSFS_enumerateWithStat(dir, files_callback, &list)) {
+        PHYSFS_ErrorCode code = PHYSFS_getLastErrorCode();
+        free(list.items), free(list.names);
+        PHYSFS_setErrorCode(code == PHYSFS_ERR_APP_CALLBACK ?
+                PHYSFS_ERR_OUT_OF_MEMORY : code);
+        return push_error(L, "files");
+    }
+    for (i = 0; i < list.count; ++i)
+        list.items[i].name = list.names + list.items[i].offset;
+    if (list.count > 0)
+        qsort(list.items, list.count, sizeof(FileStat), files_cmp);
+    lua_settop(L, 2);
+    lua_pushcfunction(L, push_files_helper);
+    lua_pushlightuserdata(L, &list);
+    lua_pushvalue(L, 2);
+    r = lua_pcall(L, 2, 1, 0);
+    free(list.items), free(list.names);
+    if (r == LUA_OK) return 1;
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return 2;
+}
+
+/* physfs.walk(dir[, order]): the whole walk is done up front, into a list
+ * the iterator owns, for the same reason as physfs.files above. */
+
+#define LFS_WALK "physfs.Walk"
+
+typedef struct LfsWalk {
+    FileStatList list;
+    size_t       next;
+} LfsWalk;
+
+static PHYSFS_EnumerateCallbackResult walk_callback(void *data,
+        const char *path, const PHYSFS_Stat *stat) {
+    return files_add((FileStatList*)data, path, stat) ?
+        PHYSFS_ENUM_OK : PHYSFS_ENUM_ERROR;
+}
+
+static int Lwalk_gc(lua_State *L) {
+    LfsWalk *w = (LfsWalk*)luaL_checkudata(L, 1, LFS_WALK);
+    free(w->list.items), free(w->list.names);
+    memset(w, 0, sizeof(LfsWalk));
+    return 0;
+}
+
+static int Lwalk_iter(lua_State *L) {
+    LfsWalk *w = (LfsWalk*)lua_touserdata(L, lua_upvalueindex(1));
+    const FileStat *fs;
+    if (w->next >= w->list.count) return 0;
+    fs = &w->list.items[w->next++];
+    lua_pushstring(L, w->list.names + fs->offset);
+    lua_createtable(L, 0, 6);
+    set_stat(L, lua_gettop(L), &fs->stat);
+    return 2;
+}
+
+static int Lwalk(lua_State *L) {
+    static const char *opts[] = { "depth", "breadth", NULL };
+    const char *dir = luaL_checkstring(L, 1);
+    int breadth = luaL_checkoption(L, 2, "depth", opts);
+    LfsWalk *w = (LfsWalk*)lua_newuserdata(L, sizeof(LfsWalk));
+    memset(w, 0, sizeof(LfsWalk));
+    luaL_setmetatable(L, LFS_WALK);
+    if (!PHYSFS_walk(dir, walk_callback, &w->list, breadth ?
+                PHYSFS_WALK_BREADTH_FIRST : PHYSFS_WALK_DEPTH_FIRST)) {
+        PHYSFS_ErrorCode code = PHYSFS_getLastErrorCode();
+        PHYSFS_setErrorCode(code == PHYSFS_ERR_APP_CALLBACK ?
+                PHYSFS_ERR_OUT_OF_MEMORY : code);
+        return push_error(L, "walk");
+    }
+    lua_pushcclosure(L, Lwalk_iter, 1);
+    return 1;
+}
+
+static void open_walk(lua_State *L) {
+    if (luaL_newmetatable(L, LFS_WALK)) {
+        lua_pushcfunction(L, Lwalk_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+}
+
+#define LFS_BULK "physfs.BulkLoad"
+
+static int Lbulk_gc(lua_State *L) {
+    const PHYSFS_Allocator *a = PHYSFS_getAllocator();
+    PHYSFS_BulkLoad *files = (PHYSFS_BulkLoad*)luaL_checkudata(L, 1, LFS_BULK);
+    size_t i, n = lua_rawlen(L, 1) / sizeof(PHYSFS_BulkLoad);
+    for (i = 0; i < n; ++i) {
+        if (files[i].buffer) a->Free(files[i].buffer);
+        files[i].buffer = NULL;
+    }
+    return 0;
+}
+
+static void open_bulk(lua_State *L) {
+    if (luaL_newmetatable(L, LFS_BULK)) {
+        lua_pushcfunction(L, Lbulk_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+}
+
+static int LloadFiles(lua_State *L) {
+    const PHYSFS_Allocator *a = PHYSFS_getAllocator();
+    PHYSFS_BulkLoad *files;
+    lua_Integer threads;
+    size_t i, n;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    threads = luaL_optinteger(L, 2, 1);
+    luaL_argcheck(L, threads >= 0 && threads <= 0xFFFFFFFF, 2,
+            "thread count out of range");
+    n = lua_rawlen(L, 1);
+    luaL_argcheck(L, n <= 0xFFFFFFFF, 1, "too many files");
+    /* the buffers are freed by __gc if pushing them raises an error */
+    files = (PHYSFS_BulkLoad*)lua_newuserdata(L, sizeof(PHYSFS_BulkLoad)*n);
+    memset(files, 0, sizeof(PHYSFS_BulkLoad)*n);
+    luaL_setmetatable(L, LFS_BULK);
+    for (i = 0; i < n; ++i) {
+        lua_rawgeti(L, 1, (int)i + 1);
+        if (lua_type(L, -1) != LUA_TSTRING)
+            return luaL_error(L, "bad file name #%d (string expected, got %s)",
+                    (int)i + 1, luaL_typename(L, -1));
+        files[i].fname = lua_tostring(L, -1);
+        lua_pop(L, 1); /* still referenced by the table */
+    }
+    if (!PHYSFS_loadFiles(files, (PHYSFS_uint32)n, (PHYSFS_uint32)threads)) {
+        const char *fname = NULL;
+        PHYSFS_ErrorCode code = PHYSFS_ERR_OK;
+        for (i = 0; i < n && fname == NULL; ++i)
+            if (files[i].error != PHYSFS_ERR_OK)
+                fname = files[i].fname, code = files[i].error;
+        lua_pushnil(L);
+        lua_pushfstring(L, "loadFiles: %s: %s", fname ? fname : "?",
+                PHYSFS_getErrorByCode(code));
+        return 2;
+    }
+    lua_createtable(L, (int)n, 0);
+    for (i = 0; i < n; ++i) {
+        lua_pushlstring(L, (const char*)files[i].buffer,
+                (size_t)files[i].size);
+        a->Free(files[i].buffer);
+        files[i].buffer = NULL;
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+    return 1;
+}
+
 static int Lmount(lua_State *L) {
     const char *dir = luaL_checkstring(L, 1);
     const char *point = luaL_optstring(L, 2, NULL);
@@ -697,6 +1020,13 @@ LUALIB_API int luaopen_physfs(lua_State *L) {
         ENTRY(cdRomDirs),
         ENTRY(searchPath),
         ENTRY(useSymlink),
+        ENTRY(useIndex),
+        ENTRY(useMmap),
+        ENTRY(missCache),
+        ENTRY(indexCache),
+        ENTRY(buffSize),
+        ENTRY(seekCheckpoints),
+        ENTRY(inflaterPool),
         ENTRY(lastError),
         ENTRY(mkdir),
         ENTRY(delete),
@@ -704,6 +1034,8 @@ LUALIB_API int luaopen_physfs(lua_State *L) {
         ENTRY(realDir),
         ENTRY(stat),
         ENTRY(files),
+        ENTRY(walk),
+        ENTRY(loadFiles),
         ENTRY(openRead),
         ENTRY(openWrite),
         ENTRY(openAppend),
@@ -719,6 +1051,8 @@ LUALIB_API int luaopen_physfs(lua_State *L) {
     if (!PHYSFS_isInit() && !PHYSFS_init(getarg0(L)))
         luaL_error(L, "can not init physfs library");
     open_file(L);
+    open_walk(L);
+    open_bulk(L);
     open_loader(L);
     luaL_newlib(L, libs);
     lua_createtable(L, 0, 1);
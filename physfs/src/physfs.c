@@ -11,6 +11,8 @@
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_internal.h"
 
+#include <time.h>
+
 #if defined(_MSC_VER)
 /* this code came from https://stackoverflow.com/a/8712996 */
 int __PHYSFS_msvc_vsnprintf(char *outBuf, size_t size, const char *format, va_list ap)
@@ -47,6 +49,10 @@ typedef struct __PHYSFS_DIRHANDLE__
     char *root;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     size_t rootlen;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     const PHYSFS_Archiver *funcs;  /* Ptr to archiver info for this handle. */
+    int indexed;  /* non-zero if this archive's paths are in pathIndex. */
+    int retired;  /* non-zero if unmounted but still in use. refLock! */
+    void *lock;  /* serializes calls into this archive instance. */
+    size_t refcount;  /* search path, snapshots and open files. refLock! */
     struct __PHYSFS_DIRHANDLE__ *next;  /* linked list stuff. */
 } DirHandle;
 
@@ -55,26 +61,44 @@ typedef struct __PHYSFS_FILEHANDLE__
 {
     PHYSFS_Io *io;  /* Instance data unique to the archiver for this file. */
     PHYSFS_uint8 forReading; /* Non-zero if reading, zero if write/append */
-    const DirHandle *dirHandle;  /* Archiver instance that created this */
+    DirHandle *dirHandle;  /* Archiver instance that created this */
     PHYSFS_uint8 *buffer;  /* Buffer, if set (NULL otherwise). Don't touch! */
     size_t bufsize;  /* Bufsize, if set (0 otherwise). Don't touch! */
     size_t buffill;  /* Buffer fill size. Don't touch! */
     size_t bufpos;  /* Buffer position. Don't touch! */
+    size_t bufwindow;  /* How much a refill reads; <= bufsize. Don't touch! */
+    PHYSFS_uint8 adaptive;  /* Non-zero to resize bufwindow as we go. */
+    PHYSFS_uint8 seeked;  /* Non-zero if we left the buffer since a refill. */
+    const PHYSFS_uint8 *mapped;  /* PHYSFS_mapFile() result, or NULL. */
+    PHYSFS_uint64 maplen;  /* length of (mapped). */
+    PHYSFS_uint8 *mapbuf;  /* (mapped), if we had to read a copy of it. */
     struct __PHYSFS_FILEHANDLE__ *next;  /* linked list stuff. */
 } FileHandle;
 
+/* adaptive buffers never read less than this per refill, unless smaller. */
+#define ADAPTIVE_BUFFER_MIN 512
+
 
 typedef struct __PHYSFS_ERRSTATETYPE__
 {
+#ifdef PHYSFS_THREAD_LOCAL
+    PHYSFS_uint32 generation;  /* stale if not errorStateGeneration. */
+#else
     void *tid;
-    PHYSFS_ErrorCode code;
     struct __PHYSFS_ERRSTATETYPE__ *next;
+#endif
+    PHYSFS_ErrorCode code;
 } ErrState;
 
 
 /* General PhysicsFS state ... */
 static int initialized = 0;
+#ifdef PHYSFS_THREAD_LOCAL
+static PHYSFS_THREAD_LOCAL ErrState errorState;
+static PHYSFS_uint32 errorStateGeneration = 1;
+#else
 static ErrState *errorStates = NULL;
+#endif
 static DirHandle *searchPath = NULL;
 static DirHandle *writeDir = NULL;
 static FileHandle *openWriteList = NULL;
@@ -87,10 +111,23 @@ static PHYSFS_Archiver **archivers = NULL;
 static PHYSFS_ArchiveInfo **archiveInfo = NULL;
 static volatile size_t numArchivers = 0;
 static size_t longest_root = 0;
+static __PHYSFS_DirTree *pathIndex = NULL;
+static struct MissCacheSlot *missCache = NULL;
+static size_t missCacheSlots = 0;
+static char *indexCacheDir = NULL;
+static int mapArchives = 0;
+static size_t defaultBufferSize = 0;  /* set with refLock held. */
+static int adaptiveBuffers = 0;  /* set with refLock held. */
+static PHYSFS_uint64 seekCheckpoints = 0;  /* set with stateLock held. */
+static PHYSFS_uint32 inflaterPool = 0;  /* set with stateLock held. */
+static PHYSFS_uint32 searchPathGeneration = 1;
+static struct SearchPathSnapshot *searchPathSnapshot = NULL;
+static DirHandle *retiredDirHandles = NULL;
 
 /* mutexes ... */
 static void *errorLock = NULL;     /* protects error message list.        */
 static void *stateLock = NULL;     /* protects other PhysFS static state. */
+static void *refLock = NULL;       /* protects open file lists, refcounts. */
 
 /* allocator ... */
 static int externalAllocator = 0;
@@ -123,18 +160,59 @@ int __PHYSFS_ATOMIC_DECR(int *ptrval)
 
 /* PHYSFS_Io implementation for i/o to physical filesystem... */
 
+/*
+ * Read-only Ios keep their own position and read at it, so duplicates can
+ *  share the original's handle instead of opening the file again: opening
+ *  files in an archive doesn't cost an open() and a file descriptor each.
+ *  Like the memory Io, duplicates hold a reference to the original, which
+ *  closes the handle when the last one is destroyed.
+ *
+ * Archives opened with PHYSFS_setArchiveMapping() enabled are mapped into
+ *  memory instead: reads are a memcpy, and the owner unmaps the file along
+ *  with closing the handle.
+ */
+#ifdef PHYSFS_NO_PLATFORM_READAT
+#define nativeIoShared(info) ((info)->map != NULL)
+#else
+#define nativeIoShared(info) ((info)->mode == 'r')
+#endif
+
 /* !!! FIXME: maybe refcount the paths in a string pool? */
 typedef struct __PHYSFS_NativeIoInfo
 {
     void *handle;
     const char *path;
     int mode;   /* 'r', 'w', or 'a' */
+    PHYSFS_uint64 pos;  /* if nativeIoShared(). */
+    PHYSFS_Io *parent;  /* owner of (handle), if we're a duplicate. */
+    int refcount;  /* duplicates using our (handle), plus one for us. */
+    const PHYSFS_uint8 *map;  /* whole file, if mapped. Owned like (handle). */
+    PHYSFS_uint64 maplen;
 } NativeIoInfo;
 
 static PHYSFS_sint64 nativeIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformRead(info->handle, buf, len);
+    PHYSFS_sint64 rc;
+
+    if (info->map != NULL)
+    {
+        if (info->pos >= info->maplen)
+            return 0;  /* we're at EOF; nothing to do. */
+        if (len > info->maplen - info->pos)
+            len = info->maplen - info->pos;
+        memcpy(buf, info->map + info->pos, (size_t) len);
+        info->pos += len;
+        return (PHYSFS_sint64) len;
+    } /* if */
+
+    if (!nativeIoShared(info))
+        return __PHYSFS_platformRead(info->handle, buf, len);
+
+    rc = __PHYSFS_platformReadAt(info->handle, buf, len, info->pos);
+    if (rc > 0)
+        info->pos += (PHYSFS_uint64) rc;
+    return rc;
 } /* nativeIo_read */
 
 static PHYSFS_sint64 nativeIo_write(PHYSFS_Io *io, const void *buffer,
@@ -147,25 +225,63 @@ static PHYSFS_sint64 nativeIo_write(PHYSFS_Io *io, const void *buffer,
 static int nativeIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformSeek(info->handle, offset);
+    if (!nativeIoShared(info))
+        return __PHYSFS_platformSeek(info->handle, offset);
+    info->pos = offset;
+    return 1;
 } /* nativeIo_seek */
 
 static PHYSFS_sint64 nativeIo_tell(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformTell(info->handle);
+    if (!nativeIoShared(info))
+        return __PHYSFS_platformTell(info->handle);
+    return (PHYSFS_sint64) info->pos;
 } /* nativeIo_tell */
 
 static PHYSFS_sint64 nativeIo_length(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    if (info->map != NULL)
+        return (PHYSFS_sint64) info->maplen;
     return __PHYSFS_platformFileLength(info->handle);
 } /* nativeIo_length */
 
 static PHYSFS_Io *nativeIo_duplicate(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_createNativeIo(info->path, info->mode);
+    NativeIoInfo *newinfo = NULL;
+    PHYSFS_Io *retval = NULL;
+
+    if (!nativeIoShared(info))
+        return __PHYSFS_createNativeIo(info->path, info->mode);
+    else if (info->parent != NULL)  /* dup the owner, avoid deep chains. */
+        return info->parent->duplicate(info->parent);
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    newinfo = (NativeIoInfo *) allocator.Malloc(sizeof (NativeIoInfo));
+    if (!newinfo)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    (void) __PHYSFS_ATOMIC_INCR(&info->refcount);
+
+    memset(newinfo, '\0', sizeof (*newinfo));
+    newinfo->handle = info->handle;
+    newinfo->path = info->path;
+    newinfo->mode = info->mode;
+    newinfo->pos = 0;
+    newinfo->parent = io;
+    newinfo->refcount = 0;
+    newinfo->map = info->map;
+    newinfo->maplen = info->maplen;
+
+    memcpy(retval, io, sizeof (*retval));
+    retval->opaque = newinfo;
+    return retval;
 } /* nativeIo_duplicate */
 
 static int nativeIo_flush(PHYSFS_Io *io)
@@ -177,10 +293,30 @@ static int nativeIo_flush(PHYSFS_Io *io)
 static void nativeIo_destroy(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    __PHYSFS_platformClose(info->handle);
-    allocator.Free((void *) info->path);
-    allocator.Free(info);
-    allocator.Free(io);
+    PHYSFS_Io *parent = info->parent;
+
+    if (parent != NULL)
+    {
+        assert(info->handle == ((NativeIoInfo *) parent->opaque)->handle);
+        assert(info->refcount == 0);
+        allocator.Free(info);
+        allocator.Free(io);
+        parent->destroy(parent);  /* decrements refcount. */
+        return;
+    } /* if */
+
+    /* we own the handle. */
+    assert(info->refcount > 0);  /* even in a race, we hold a reference. */
+
+    if (__PHYSFS_ATOMIC_DECR(&info->refcount) == 0)
+    {
+        if (info->map != NULL)
+            __PHYSFS_platformUnmap((void *) info->map, info->maplen);
+        __PHYSFS_platformClose(info->handle);
+        allocator.Free((void *) info->path);
+        allocator.Free(info);
+        allocator.Free(io);
+    } /* if */
 } /* nativeIo_destroy */
 
 static const PHYSFS_Io __PHYSFS_nativeIoInterface =
@@ -222,9 +358,13 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
     GOTO_IF_ERRPASS(!handle, createNativeIo_failed);
 
     strcpy(pathdup, path);
+    memset(info, '\0', sizeof (*info));
     info->handle = handle;
     info->path = pathdup;
     info->mode = mode;
+    info->pos = 0;
+    info->parent = NULL;
+    info->refcount = 1;
     memcpy(io, &__PHYSFS_nativeIoInterface, sizeof (*io));
     io->opaque = info;
     return io;
@@ -248,6 +388,7 @@ typedef struct __PHYSFS_MemoryIoInfo
     PHYSFS_Io *parent;
     int refcount;
     void (*destruct)(void *);
+    void *owner;  /* what to pass to (destruct). */
 } MemoryIoInfo;
 
 static PHYSFS_sint64 memoryIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
@@ -358,12 +499,12 @@ static void memoryIo_destroy(PHYSFS_Io *io)
     if (__PHYSFS_ATOMIC_DECR(&info->refcount) == 0)
     {
         void (*destruct)(void *) = info->destruct;
-        void *buf = (void *) info->buf;
+        void *owner = info->owner;
         io->opaque = NULL;  /* kill this here in case of race. */
         allocator.Free(info);
         allocator.Free(io);
         if (destruct != NULL)
-            destruct(buf);
+            destruct(owner);
     } /* if */
 } /* memoryIo_destroy */
 
@@ -383,6 +524,14 @@ static const PHYSFS_Io __PHYSFS_memoryIoInterface =
 
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
                                    void (*destruct)(void *))
+{
+    return __PHYSFS_createOwnedMemoryIo(buf, len, destruct, (void *) buf);
+} /* __PHYSFS_createMemoryIo */
+
+
+PHYSFS_Io *__PHYSFS_createOwnedMemoryIo(const void *buf, PHYSFS_uint64 len,
+                                        void (*destruct)(void *),
+                                        void *owner)
 {
     PHYSFS_Io *io = NULL;
     MemoryIoInfo *info = NULL;
@@ -399,6 +548,7 @@ PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
     info->parent = NULL;
     info->refcount = 1;
     info->destruct = destruct;
+    info->owner = owner;
 
     memcpy(io, &__PHYSFS_memoryIoInterface, sizeof (*io));
     io->opaque = info;
@@ -408,7 +558,8 @@ createMemoryIo_failed:
     if (info != NULL) allocator.Free(info);
     if (io != NULL) allocator.Free(io);
     return NULL;
-} /* __PHYSFS_createMemoryIo */
+} /* __PHYSFS_createOwnedMemoryIo */
+
 
 
 /* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
@@ -471,7 +622,9 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
     newfh->forReading = origfh->forReading;
     newfh->dirHandle = origfh->dirHandle;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    /* we're probably inside an archiver here, so no stateLock; see refLock. */
+    __PHYSFS_platformGrabMutex(refLock);
+    newfh->dirHandle->refcount++;
     if (newfh->forReading)
     {
         newfh->next = openReadList;
@@ -482,7 +635,7 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
         newfh->next = openWriteList;
         openWriteList = newfh;
     } /* else */
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseMutex(refLock);
 
     memcpy(retval, io, sizeof (PHYSFS_Io));
     retval->opaque = newfh;
@@ -534,6 +687,44 @@ static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
 } /* __PHYSFS_createHandleIo */
 
 
+const PHYSFS_uint8 *__PHYSFS_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    const PHYSFS_uint8 *retval = NULL;
+
+    if (io->read == memoryIo_read)
+    {
+        const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+        *len = info->len;
+        return info->buf;
+    } /* if */
+
+    else if (io->read == nativeIo_read)
+    {
+        const NativeIoInfo *info = (const NativeIoInfo *) io->opaque;
+        *len = info->maplen;
+        return info->map;
+    } /* else if */
+
+    else if (io->read == handleIo_read)
+    {
+        const FileHandle *fh = (const FileHandle *) io->opaque;
+        return __PHYSFS_ioMemory(fh->io, len);
+    } /* else if */
+
+    /* a file in an archive might be a stored slice of the archive's Io. */
+    retval = UNPK_ioMemory(io, len);
+#if PHYSFS_SUPPORTS_ZIP
+    if (retval == NULL)
+        retval = ZIP_ioMemory(io, len);
+#endif
+#if PHYSFS_SUPPORTS_7Z
+    if (retval == NULL)
+        retval = SZIP_ioMemory(io, len);
+#endif
+    return retval;
+} /* __PHYSFS_ioMemory */
+
+
 /* functions ... */
 
 typedef struct
@@ -663,6 +854,19 @@ void __PHYSFS_sort(void *entries, size_t max,
 } /* __PHYSFS_sort */
 
 
+#ifdef PHYSFS_THREAD_LOCAL
+static ErrState *findErrorForCurrentThread(void)
+{
+    /* a thread's state from before the last PHYSFS_deinit() is forgotten. */
+    if (errorState.generation != errorStateGeneration)
+    {
+        errorState.generation = errorStateGeneration;
+        errorState.code = PHYSFS_ERR_OK;
+    } /* if */
+
+    return &errorState;
+} /* findErrorForCurrentThread */
+#else
 static ErrState *findErrorForCurrentThread(void)
 {
     ErrState *i;
@@ -691,6 +895,7 @@ static ErrState *findErrorForCurrentThread(void)
 
     return NULL;   /* no error available. */
 } /* findErrorForCurrentThread */
+#endif
 
 
 /* this doesn't reset the error state. */
@@ -759,6 +964,7 @@ void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
         return;
 
     err = findErrorForCurrentThread();
+#ifndef PHYSFS_THREAD_LOCAL
     if (err == NULL)
     {
         err = (ErrState *) allocator.Malloc(sizeof (ErrState));
@@ -777,6 +983,7 @@ void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
         if (errorLock != NULL)
             __PHYSFS_platformReleaseMutex(errorLock);
     } /* if */
+#endif
 
     err->code = errcode;
 } /* PHYSFS_setErrorCode */
@@ -792,6 +999,11 @@ const char *PHYSFS_getLastError(void)
 /* MAKE SURE that errorLock is held before calling this! */
 static void freeErrorStates(void)
 {
+#ifdef PHYSFS_THREAD_LOCAL
+    /* we can't reach other threads' storage; just make it all stale. */
+    if (++errorStateGeneration == 0)
+        errorStateGeneration = 1;
+#else
     ErrState *i;
     ErrState *next;
 
@@ -802,6 +1014,7 @@ static void freeErrorStates(void)
     } /* for */
 
     errorStates = NULL;
+#endif
 } /* freeErrorStates */
 
 
@@ -867,6 +1080,39 @@ static DirHandle *tryOpenDir(PHYSFS_Io *io, const PHYSFS_Archiver *funcs,
 } /* tryOpenDir */
 
 
+/*
+ * Map a freshly-opened read-only native Io into memory. This is best-effort:
+ *  if the platform says no, the Io keeps reading through its handle and the
+ *  error state is left as it was.
+ */
+static void nativeIoMap(PHYSFS_Io *io)
+{
+#ifndef PHYSFS_NO_PLATFORM_MMAP
+    NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    const PHYSFS_ErrorCode errcode = currentErrorCode();
+    PHYSFS_sint64 len;
+    void *map;
+
+    assert(io->read == nativeIo_read);
+    assert((info->mode == 'r') && (info->parent == NULL));
+    assert((info->map == NULL) && (info->refcount == 1));
+
+    /* can't map an empty file, but there's nothing to gain there anyhow. */
+    len = __PHYSFS_platformFileLength(info->handle);
+    map = (len > 0) ? __PHYSFS_platformMap(info->handle, len) : NULL;
+    if (map == NULL)
+    {
+        PHYSFS_getLastErrorCode();  /* clear whatever we set... */
+        PHYSFS_setErrorCode(errcode);  /* ...and put the old one back. */
+        return;
+    } /* if */
+
+    info->map = (const PHYSFS_uint8 *) map;
+    info->maplen = (PHYSFS_uint64) len;
+#endif
+} /* nativeIoMap */
+
+
 static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
 {
     DirHandle *retval = NULL;
@@ -895,6 +1141,8 @@ static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
         io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
         BAIL_IF_ERRPASS(!io, NULL);
         created_io = 1;
+        if ((!forWriting) && (mapArchives))
+            nativeIoMap(io);
     } /* if */
 
     ext = find_filename_extension(d);
@@ -1051,6 +1299,10 @@ static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
     dirHandle = openDirectory(io, newDir, forWriting);
     GOTO_IF_ERRPASS(!dirHandle, badDirHandle);
 
+    dirHandle->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF(!dirHandle->lock, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
+    dirHandle->refcount = 1;  /* the caller's reference. */
+
     dirHandle->dirName = (char *) allocator.Malloc(strlen(newDir) + 1);
     GOTO_IF(!dirHandle->dirName, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
     strcpy(dirHandle->dirName, newDir);
@@ -1071,6 +1323,8 @@ badDirHandle:
     if (dirHandle != NULL)
     {
         dirHandle->funcs->closeArchive(dirHandle->opaque);
+        if (dirHandle->lock)
+            __PHYSFS_platformDestroyMutex(dirHandle->lock);
         allocator.Free(dirHandle->dirName);
         allocator.Free(dirHandle->mountPoint);
         allocator.Free(dirHandle);
@@ -1081,156 +1335,733 @@ badDirHandle:
 } /* createDirHandle */
 
 
-/* MAKE SURE you've got the stateLock held before calling this! */
-static int freeDirHandle(DirHandle *dh, FileHandle *openList)
+/*
+ * DirHandles are reference counted, under the refLock: the search path (or
+ *  writeDir) holds one reference, each search path snapshot holds one, and
+ *  so does each open file. The archive is closed when the last one goes
+ *  away, which, if a lookup was still using it when it was unmounted, can
+ *  be after PHYSFS_unmount() returns. Until then it sits on
+ *  retiredDirHandles, so we don't deregister its archiver out from under it.
+ *
+ * Don't hold the refLock, or (dh)'s lock, when calling this.
+ */
+static void releaseDirHandle(DirHandle *dh)
 {
-    FileHandle *i;
+    int destroy;
 
-    if (dh == NULL)
-        return 1;
+    __PHYSFS_platformGrabMutex(refLock);
+    assert(dh->refcount > 0);
+    destroy = (--dh->refcount == 0);
+    if ((destroy) && (dh->retired))
+    {
+        DirHandle **i;
+        for (i = &retiredDirHandles; *i != dh; i = &(*i)->next)
+            assert(*i != NULL);
+        *i = dh->next;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(refLock);
 
-    for (i = openList; i != NULL; i = i->next)
-        BAIL_IF(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, 0);
+    if (!destroy)
+        return;
 
     dh->funcs->closeArchive(dh->opaque);
 
+    __PHYSFS_platformDestroyMutex(dh->lock);
     if (dh->root) allocator.Free(dh->root);
     allocator.Free(dh->dirName);
     allocator.Free(dh->mountPoint);
     allocator.Free(dh);
-    return 1;
-} /* freeDirHandle */
+} /* releaseDirHandle */
 
 
-static char *calculateBaseDir(const char *argv0)
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int freeDirHandle(DirHandle *dh, FileHandle **openList)
 {
-    const char dirsep = __PHYSFS_platformDirSeparator;
-    char *retval = NULL;
-    char *ptr = NULL;
+    FileHandle *i;
 
-    /* Give the platform layer first shot at this. */
-    retval = __PHYSFS_platformCalcBaseDir(argv0);
-    if (retval != NULL)
-        return retval;
+    if (dh == NULL)
+        return 1;
 
-    /* We need argv0 to go on. */
-    BAIL_IF(argv0 == NULL, PHYSFS_ERR_ARGV0_IS_NULL, NULL);
+    __PHYSFS_platformGrabMutex(refLock);
+    for (i = *openList; i != NULL; i = i->next)
+        BAIL_IF_MUTEX(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, refLock, 0);
 
-    ptr = strrchr(argv0, dirsep);
-    if (ptr != NULL)
+    if (dh->refcount > 1)  /* a lookup is still using it; retire it. */
     {
-        const size_t size = ((size_t) (ptr - argv0)) + 1;
-        retval = (char *) allocator.Malloc(size + 1);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-        memcpy(retval, argv0, size);
-        retval[size] = '\0';
-        return retval;
+        dh->retired = 1;
+        dh->next = retiredDirHandles;
+        retiredDirHandles = dh;
     } /* if */
+    __PHYSFS_platformReleaseMutex(refLock);
 
-    /* argv0 wasn't helpful. */
-    BAIL(PHYSFS_ERR_INVALID_ARGUMENT, NULL);
-} /* calculateBaseDir */
+    releaseDirHandle(dh);
+    return 1;
+} /* freeDirHandle */
 
 
-static int initializeMutexes(void)
+/*
+ * Search path snapshots.
+ *
+ * Lookups (PHYSFS_openRead(), PHYSFS_stat(), PHYSFS_exists(),
+ *  PHYSFS_getRealDir()) only hold the stateLock long enough to check the
+ *  caches and grab a reference to an immutable copy of the search path.
+ *  Then they let go of it and lock each archive in turn as they ask it for
+ *  the file, so lookups in different threads only wait on each other when
+ *  they want the same archive at the same moment, and mounting or
+ *  unmounting never waits on an archive to finish a lookup.
+ *
+ * The snapshot is built lazily by the first lookup after the search path
+ *  changes, and freed when the last lookup using it is done.
+ */
+
+typedef struct SearchPathSnapshotItem
 {
-    errorLock = __PHYSFS_platformCreateMutex();
-    if (errorLock == NULL)
-        goto initializeMutexes_failed;
+    DirHandle *handle;
+    int indexed;  /* handle->indexed when the snapshot was made. */
+} SearchPathSnapshotItem;
 
-    stateLock = __PHYSFS_platformCreateMutex();
-    if (stateLock == NULL)
-        goto initializeMutexes_failed;
+typedef struct SearchPathSnapshot
+{
+    size_t refcount;  /* protected by the refLock. */
+    size_t count;
+    SearchPathSnapshotItem *items;  /* in search path order. */
+} SearchPathSnapshot;
 
-    return 1;  /* success. */
 
-initializeMutexes_failed:
-    if (errorLock != NULL)
-        __PHYSFS_platformDestroyMutex(errorLock);
+/* Don't hold the refLock, or any DirHandle's lock, when calling this. */
+static void releaseSearchPathSnapshot(SearchPathSnapshot *snapshot)
+{
+    size_t i;
+    int destroy;
 
-    if (stateLock != NULL)
-        __PHYSFS_platformDestroyMutex(stateLock);
+    __PHYSFS_platformGrabMutex(refLock);
+    assert(snapshot->refcount > 0);
+    destroy = (--snapshot->refcount == 0);
+    __PHYSFS_platformReleaseMutex(refLock);
 
-    errorLock = stateLock = NULL;
-    return 0;  /* failed. */
-} /* initializeMutexes */
+    if (!destroy)
+        return;
 
+    for (i = 0; i < snapshot->count; i++)
+        releaseDirHandle(snapshot->items[i].handle);
+    allocator.Free(snapshot);
+} /* releaseSearchPathSnapshot */
 
-static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
 
-static int initStaticArchivers(void)
+/* MAKE SURE you hold the stateLock before calling this! */
+static SearchPathSnapshot *acquireSearchPathSnapshot(void)
 {
-    #define REGISTER_STATIC_ARCHIVER(arc) { \
-        if (!doRegisterArchiver(&__PHYSFS_Archiver_##arc)) { \
-            return 0; \
-        } \
-    }
+    SearchPathSnapshot *snapshot = searchPathSnapshot;
 
-    #if PHYSFS_SUPPORTS_ZIP
-        REGISTER_STATIC_ARCHIVER(ZIP);
-    #endif
-    #if PHYSFS_SUPPORTS_7Z
-        SZIP_global_init();
-        REGISTER_STATIC_ARCHIVER(7Z);
-    #endif
-    #if PHYSFS_SUPPORTS_GRP
-        REGISTER_STATIC_ARCHIVER(GRP);
-    #endif
-    #if PHYSFS_SUPPORTS_QPAK
-        REGISTER_STATIC_ARCHIVER(QPAK);
-    #endif
-    #if PHYSFS_SUPPORTS_HOG
-        REGISTER_STATIC_ARCHIVER(HOG);
-    #endif
-    #if PHYSFS_SUPPORTS_MVL
-        REGISTER_STATIC_ARCHIVER(MVL);
-    #endif
-    #if PHYSFS_SUPPORTS_WAD
-        REGISTER_STATIC_ARCHIVER(WAD);
-    #endif
-    #if PHYSFS_SUPPORTS_CSM
-        REGISTER_STATIC_ARCHIVER(CSM);
-    #endif
-    #if PHYSFS_SUPPORTS_SLB
-        REGISTER_STATIC_ARCHIVER(SLB);
-    #endif
-    #if PHYSFS_SUPPORTS_ISO9660
-        REGISTER_STATIC_ARCHIVER(ISO9660);
-    #endif
-    #if PHYSFS_SUPPORTS_VDF
-        REGISTER_STATIC_ARCHIVER(VDF)
-    #endif
+    if (snapshot == NULL)
+    {
+        size_t count = 0;
+        size_t len;
+        DirHandle *i;
 
-    #undef REGISTER_STATIC_ARCHIVER
+        for (i = searchPath; i != NULL; i = i->next)
+            count++;
+
+        len = sizeof (SearchPathSnapshot);
+        len += count * sizeof (SearchPathSnapshotItem);
+        snapshot = (SearchPathSnapshot *) allocator.Malloc(len);
+        BAIL_IF(!snapshot, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        snapshot->refcount = 1;  /* searchPathSnapshot's reference. */
+        snapshot->count = count;
+        snapshot->items = (SearchPathSnapshotItem *) (snapshot + 1);
+
+        __PHYSFS_platformGrabMutex(refLock);
+        for (i = searchPath, count = 0; i != NULL; i = i->next, count++)
+        {
+            i->refcount++;
+            snapshot->items[count].handle = i;
+            snapshot->items[count].indexed = i->indexed;
+        } /* for */
+        __PHYSFS_platformReleaseMutex(refLock);
 
-    return 1;
-} /* initStaticArchivers */
+        searchPathSnapshot = snapshot;
+    } /* if */
 
+    __PHYSFS_platformGrabMutex(refLock);
+    snapshot->refcount++;
+    __PHYSFS_platformReleaseMutex(refLock);
+    return snapshot;
+} /* acquireSearchPathSnapshot */
 
-static void setDefaultAllocator(void);
-static int doDeinit(void);
 
-int PHYSFS_init(const char *argv0)
+/*
+ * Call this when searchPath's list changes; the next lookup will make a
+ *  fresh snapshot.
+ *
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static void dropSearchPathSnapshot(void)
 {
-    BAIL_IF(initialized, PHYSFS_ERR_IS_INITIALIZED, 0);
+    if (searchPathSnapshot != NULL)
+    {
+        releaseSearchPathSnapshot(searchPathSnapshot);
+        searchPathSnapshot = NULL;
+    } /* if */
+} /* dropSearchPathSnapshot */
 
-    if (!externalAllocator)
-        setDefaultAllocator();
 
-    if ((allocator.Init != NULL) && (!allocator.Init())) return 0;
+/*
+ * The search path index.
+ *
+ * This is an optional, merged view of every path in the search path's
+ *  archives, mapping each one to the first archive in the search path that
+ *  has it. With it, a lookup only has to ask that archive (and any
+ *  unindexed ones, like physical directories, that come before it) instead
+ *  of all of them.
+ *
+ * Only archives built on __PHYSFS_DirTree with case-sensitive lookups are
+ *  indexed, since we can walk their contents directly and they can't change
+ *  behind our back. Everything else is searched the old way.
+ */
 
-    if (!__PHYSFS_platformInit())
+typedef struct PathIndexEntry
+{
+    __PHYSFS_DirTreeEntry tree;  /* manages directory tree. */
+    DirHandle *dirHandle;  /* first indexed archive with this path, or NULL. */
+} PathIndexEntry;
+
+typedef struct PathIndexBuffer
+{
+    char *ptr;
+    size_t len;
+} PathIndexBuffer;
+
+
+static int pathIndexReserve(PathIndexBuffer *buf, const size_t len)
+{
+    if (len > buf->len)
     {
-        if (allocator.Deinit != NULL) allocator.Deinit();
-        return 0;
+        size_t newlen = buf->len ? buf->len : 128;
+        void *ptr;
+        while (newlen < len)
+            newlen *= 2;
+        ptr = allocator.Realloc(buf->ptr, newlen);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        buf->ptr = (char *) ptr;
+        buf->len = newlen;
     } /* if */
 
-    /* everything below here can be cleaned up safely by doDeinit(). */
+    return 1;
+} /* pathIndexReserve */
 
-    if (!initializeMutexes()) goto initFailed;
 
-    baseDir = calculateBaseDir(argv0);
-    if (!baseDir) goto initFailed;
+static int dirHandleIndexable(const DirHandle *h)
+{
+    /* every __PHYSFS_DirTree archiver keeps the tree at the start of its
+       opaque data, since __PHYSFS_DirTreeEnumerate relies on that, too.
+       Trees that load dirs as they're used don't have everything yet. */
+    return (h->funcs->enumerate == __PHYSFS_DirTreeEnumerate) &&
+           (((const __PHYSFS_DirTree *) h->opaque)->case_sensitive) &&
+           (((const __PHYSFS_DirTree *) h->opaque)->load == NULL);
+} /* dirHandleIndexable */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int pathIndexAddPath(DirHandle *h, char *path, const int prepend)
+{
+    PathIndexEntry *entry;
+    /* everything is a "dir" here, so a file in one archive doesn't stop a
+       dir of the same name in another one from adding children. */
+    entry = (PathIndexEntry *) __PHYSFS_DirTreeAdd(pathIndex, path, 1);
+    BAIL_IF_ERRPASS(!entry, 0);
+    if ((prepend) || (entry->dirHandle == NULL))
+        entry->dirHandle = h;
+    return 1;
+} /* pathIndexAddPath */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int pathIndexAddChildren(DirHandle *h, const __PHYSFS_DirTreeEntry *dir,
+                                PathIndexBuffer *buf, const size_t len,
+                                const int prepend)
+{
+    const __PHYSFS_DirTreeEntry *entry;
+
+    for (entry = dir->children; entry != NULL; entry = entry->sibling)
+    {
+        const size_t namelen = strlen(entry->name);
+        const size_t newlen = len + (len ? 1 : 0) + namelen;
+        BAIL_IF_ERRPASS(!pathIndexReserve(buf, newlen + 1), 0);
+        if (len)
+            buf->ptr[len] = '/';
+        memcpy(buf->ptr + (newlen - namelen), entry->name, namelen + 1);
+        BAIL_IF_ERRPASS(!pathIndexAddPath(h, buf->ptr, prepend), 0);
+
+        if (entry->children != NULL)
+        {
+            if (!pathIndexAddChildren(h, entry, buf, newlen, prepend))
+                return 0;
+        } /* if */
+    } /* for */
+
+    return 1;
+} /* pathIndexAddChildren */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int pathIndexAddDirHandle(DirHandle *h, const int prepend)
+{
+    __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) h->opaque;
+    const __PHYSFS_DirTreeEntry *start;
+    PathIndexBuffer buf = { NULL, 0 };
+    size_t len = 0;
+    int retval = 0;
+
+    if (!dirHandleIndexable(h))
+        return 1;  /* we'll just search this one the slow way. */
+
+    __PHYSFS_platformGrabMutex(h->lock);
+
+    start = (const __PHYSFS_DirTreeEntry *)
+                __PHYSFS_DirTreeFind(tree, h->root ? h->root : "");
+
+    if (h->mountPoint != NULL)
+    {
+        char *ptr;
+        len = strlen(h->mountPoint) - 1;  /* chop the trailing '/'. */
+        GOTO_IF_ERRPASS(!pathIndexReserve(&buf, len + 1), pathIndexAddFailed);
+        memcpy(buf.ptr, h->mountPoint, len);
+        buf.ptr[len] = '\0';
+
+        /* the mountpoint's parents exist in the interpolated tree, whether
+           or not the archive itself has anything in it. */
+        for (ptr = strchr(buf.ptr, '/'); ptr; ptr = strchr(ptr + 1, '/'))
+        {
+            *ptr = '\0';
+            GOTO_IF_ERRPASS(!pathIndexAddPath(h, buf.ptr, prepend), pathIndexAddFailed);
+            *ptr = '/';
+        } /* for */
+
+        if (start != NULL)
+            GOTO_IF_ERRPASS(!pathIndexAddPath(h, buf.ptr, prepend), pathIndexAddFailed);
+    } /* if */
+
+    if (start != NULL)
+        GOTO_IF_ERRPASS(!pathIndexAddChildren(h, start, &buf, len, prepend), pathIndexAddFailed);
+
+    h->indexed = 1;
+    retval = 1;
+
+pathIndexAddFailed:
+    __PHYSFS_platformReleaseMutex(h->lock);
+    allocator.Free(buf.ptr);
+    return retval;
+} /* pathIndexAddDirHandle */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void pathIndexFree(void)
+{
+    DirHandle *i;
+
+    dropSearchPathSnapshot();  /* it has a copy of the indexed flags. */
+
+    for (i = searchPath; i != NULL; i = i->next)
+        i->indexed = 0;
+
+    if (pathIndex != NULL)
+    {
+        __PHYSFS_DirTreeDeinit(pathIndex);
+        allocator.Free(pathIndex);
+        pathIndex = NULL;
+    } /* if */
+} /* pathIndexFree */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int pathIndexBuild(void)
+{
+    PHYSFS_uint64 count = 0;
+    DirHandle *i;
+
+    pathIndexFree();
+
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (dirHandleIndexable(i))
+            count += ((const __PHYSFS_DirTree *) i->opaque)->entryCount;
+    } /* for */
+
+    pathIndex = (__PHYSFS_DirTree *) allocator.Malloc(sizeof (__PHYSFS_DirTree));
+    BAIL_IF(!pathIndex, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (!__PHYSFS_DirTreeInit(pathIndex, sizeof (PathIndexEntry), 1, 0, count))
+    {
+        __PHYSFS_DirTreeDeinit(pathIndex);
+        allocator.Free(pathIndex);
+        pathIndex = NULL;
+        return 0;
+    } /* if */
+
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (!pathIndexAddDirHandle(i, 0))
+        {
+            pathIndexFree();
+            return 0;
+        } /* if */
+    } /* for */
+
+    return 1;
+} /* pathIndexBuild */
+
+
+/*
+ * Does indexed archive (h) have (path)? (buf) needs room for (path) plus
+ *  (h)'s root and a separator.
+ */
+static int pathIndexDirHandleHas(DirHandle *h, char *path, char *buf)
+{
+    const char *arcpath = path;
+
+    if (partOfMountPoint(h, path))
+        return 1;
+
+    if (h->mountPoint != NULL)
+    {
+        const size_t mntpntlen = strlen(h->mountPoint) - 1;
+        if (strncmp(path, h->mountPoint, mntpntlen) != 0)
+            return 0;
+        else if (path[mntpntlen] == '/')
+            arcpath = path + mntpntlen + 1;
+        else if (path[mntpntlen] == '\0')
+            arcpath = path + mntpntlen;
+        else
+            return 0;
+    } /* if */
+
+    if (h->root != NULL)
+    {
+        strcpy(buf, h->root);
+        if (*arcpath != '\0')
+        {
+            buf[h->rootlen] = '/';
+            strcpy(buf + h->rootlen + 1, arcpath);
+        } /* if */
+        arcpath = buf;
+    } /* if */
+
+    return (__PHYSFS_DirTreeFind((__PHYSFS_DirTree *) h->opaque, arcpath) != NULL);
+} /* pathIndexDirHandleHas */
+
+
+/*
+ * Hand everything indexed archive (h) was providing to the next archive
+ *  that has it. (h) must already be out of the search path.
+ *
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static int pathIndexRemoveDirHandle(DirHandle *h)
+{
+    PathIndexBuffer path = { NULL, 0 };
+    PathIndexBuffer rooted = { NULL, 0 };
+    int retval = 1;
+    size_t bucket;
+
+    for (bucket = 0; (retval) && (bucket < pathIndex->hashBuckets); bucket++)
+    {
+        __PHYSFS_DirTreeEntry *item;
+        for (item = pathIndex->hash[bucket]; item; item = item->hashnext)
+        {
+            PathIndexEntry *entry = (PathIndexEntry *) item;
+            const __PHYSFS_DirTreeEntry *p;
+            DirHandle *i;
+            size_t len = 0;
+
+            if (entry->dirHandle != h)
+                continue;
+
+            entry->dirHandle = NULL;
+
+            /* rebuild the full path from the entry's parents. */
+            for (p = item; p != pathIndex->root; p = p->parent)
+                len += strlen(p->name) + 1;
+            retval = pathIndexReserve(&path, len) &&
+                     pathIndexReserve(&rooted, len + longest_root + 1);
+            if (!retval)
+                break;
+
+            path.ptr[--len] = '\0';
+            for (p = item; p != pathIndex->root; p = p->parent)
+            {
+                const size_t namelen = strlen(p->name);
+                len -= namelen;
+                memcpy(path.ptr + len, p->name, namelen);
+                if (len > 0)
+                    path.ptr[--len] = '/';
+            } /* for */
+
+            for (i = searchPath; i != NULL; i = i->next)
+            {
+                if ((i->indexed) && (pathIndexDirHandleHas(i, path.ptr, rooted.ptr)))
+                {
+                    entry->dirHandle = i;
+                    break;
+                } /* if */
+            } /* for */
+        } /* for */
+    } /* for */
+
+    allocator.Free(path.ptr);
+    allocator.Free(rooted.ptr);
+    return retval;
+} /* pathIndexRemoveDirHandle */
+
+
+/*
+ * If the search path index can answer for (fname), return non-zero and set
+ *  (*dh) to the first indexed archive that has it, or NULL if none do.
+ *  Callers can then skip every other indexed archive until they reach (*dh).
+ *
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static int pathIndexFind(const char *fname, DirHandle **dh)
+{
+    const PathIndexEntry *entry;
+
+    *dh = NULL;
+    if ((pathIndex == NULL) || (*fname == '\0'))
+        return 0;
+
+    entry = (const PathIndexEntry *) __PHYSFS_DirTreeFind(pathIndex, fname);
+    if (entry != NULL)
+        *dh = entry->dirHandle;
+
+    return 1;
+} /* pathIndexFind */
+
+
+/*
+ * The miss cache.
+ *
+ * This optionally remembers paths that weren't found anywhere in the search
+ *  path, so probing for them again (a script loader looking through a list
+ *  of candidate names, for example) is a single hash lookup. It's a small
+ *  direct-mapped table; a new miss just replaces whatever was in its slot.
+ *
+ * Slots are tagged with searchPathGeneration, which is bumped whenever
+ *  something we know about could make a missing path appear: mounting,
+ *  unmounting, changing roots or symlink rules, or writing through the
+ *  write dir. Bumping it throws out the whole cache at once.
+ */
+
+typedef struct MissCacheSlot
+{
+    PHYSFS_uint32 generation;  /* matches searchPathGeneration if valid. */
+    PHYSFS_uint32 hashval;
+    size_t pathlen;  /* bytes allocated for (path). */
+    char *path;
+} MissCacheSlot;
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void searchPathChanged(void)
+{
+    if (++searchPathGeneration == 0)  /* wrapped? Start over. */
+    {
+        size_t i;
+        for (i = 0; i < missCacheSlots; i++)
+            missCache[i].generation = 0;
+        searchPathGeneration = 1;
+    } /* if */
+} /* searchPathChanged */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void missCacheFree(void)
+{
+    size_t i;
+    for (i = 0; i < missCacheSlots; i++)
+        allocator.Free(missCache[i].path);
+    allocator.Free(missCache);
+    missCache = NULL;
+    missCacheSlots = 0;
+} /* missCacheFree */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int missCacheHas(const char *fname)
+{
+    PHYSFS_uint32 hashval;
+    const MissCacheSlot *slot;
+
+    if ((missCache == NULL) || (*fname == '\0'))
+        return 0;
+
+    hashval = __PHYSFS_hashString(fname);
+    slot = &missCache[hashval % missCacheSlots];
+    return ( (slot->generation == searchPathGeneration) &&
+             (slot->hashval == hashval) && (strcmp(slot->path, fname) == 0) );
+} /* missCacheHas */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void missCacheAdd(const char *fname)
+{
+    const size_t len = strlen(fname) + 1;
+    PHYSFS_uint32 hashval;
+    MissCacheSlot *slot;
+
+    if ((missCache == NULL) || (*fname == '\0'))
+        return;
+
+    hashval = __PHYSFS_hashString(fname);
+    slot = &missCache[hashval % missCacheSlots];
+    if (slot->pathlen < len)
+    {
+        void *ptr = allocator.Realloc(slot->path, len);
+        if (!ptr)
+            return;  /* oh well, it's just a cache. */
+        slot->path = (char *) ptr;
+        slot->pathlen = len;
+    } /* if */
+
+    memcpy(slot->path, fname, len);
+    slot->hashval = hashval;
+    slot->generation = searchPathGeneration;
+} /* missCacheAdd */
+
+
+static char *calculateBaseDir(const char *argv0)
+{
+    const char dirsep = __PHYSFS_platformDirSeparator;
+    char *retval = NULL;
+    char *ptr = NULL;
+
+    /* Give the platform layer first shot at this. */
+    retval = __PHYSFS_platformCalcBaseDir(argv0);
+    if (retval != NULL)
+        return retval;
+
+    /* We need argv0 to go on. */
+    BAIL_IF(argv0 == NULL, PHYSFS_ERR_ARGV0_IS_NULL, NULL);
+
+    ptr = strrchr(argv0, dirsep);
+    if (ptr != NULL)
+    {
+        const size_t size = ((size_t) (ptr - argv0)) + 1;
+        retval = (char *) allocator.Malloc(size + 1);
+        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memcpy(retval, argv0, size);
+        retval[size] = '\0';
+        return retval;
+    } /* if */
+
+    /* argv0 wasn't helpful. */
+    BAIL(PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+} /* calculateBaseDir */
+
+
+static int initializeMutexes(void)
+{
+    errorLock = __PHYSFS_platformCreateMutex();
+    if (errorLock == NULL)
+        goto initializeMutexes_failed;
+
+    stateLock = __PHYSFS_platformCreateMutex();
+    if (stateLock == NULL)
+        goto initializeMutexes_failed;
+
+    refLock = __PHYSFS_platformCreateMutex();
+    if (refLock == NULL)
+        goto initializeMutexes_failed;
+
+    return 1;  /* success. */
+
+initializeMutexes_failed:
+    if (errorLock != NULL)
+        __PHYSFS_platformDestroyMutex(errorLock);
+
+    if (stateLock != NULL)
+        __PHYSFS_platformDestroyMutex(stateLock);
+
+    if (refLock != NULL)
+        __PHYSFS_platformDestroyMutex(refLock);
+
+    errorLock = stateLock = refLock = NULL;
+    return 0;  /* failed. */
+} /* initializeMutexes */
+
+
+static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
+
+static int initStaticArchivers(void)
+{
+    #define REGISTER_STATIC_ARCHIVER(arc) { \
+        if (!doRegisterArchiver(&__PHYSFS_Archiver_##arc)) { \
+            return 0; \
+        } \
+    }
+
+    #if PHYSFS_SUPPORTS_ZIP
+        REGISTER_STATIC_ARCHIVER(ZIP);
+    #endif
+    #if PHYSFS_SUPPORTS_7Z
+        SZIP_global_init();
+        REGISTER_STATIC_ARCHIVER(7Z);
+    #endif
+    #if PHYSFS_SUPPORTS_GRP
+        REGISTER_STATIC_ARCHIVER(GRP);
+    #endif
+    #if PHYSFS_SUPPORTS_QPAK
+        REGISTER_STATIC_ARCHIVER(QPAK);
+    #endif
+    #if PHYSFS_SUPPORTS_HOG
+        REGISTER_STATIC_ARCHIVER(HOG);
+    #endif
+    #if PHYSFS_SUPPORTS_MVL
+        REGISTER_STATIC_ARCHIVER(MVL);
+    #endif
+    #if PHYSFS_SUPPORTS_WAD
+        REGISTER_STATIC_ARCHIVER(WAD);
+    #endif
+    #if PHYSFS_SUPPORTS_CSM
+        REGISTER_STATIC_ARCHIVER(CSM);
+    #endif
+    #if PHYSFS_SUPPORTS_SLB
+        REGISTER_STATIC_ARCHIVER(SLB);
+    #endif
+    #if PHYSFS_SUPPORTS_ISO9660
+        REGISTER_STATIC_ARCHIVER(ISO9660);
+    #endif
+    #if PHYSFS_SUPPORTS_VDF
+        REGISTER_STATIC_ARCHIVER(VDF)
+    #endif
+
+    #undef REGISTER_STATIC_ARCHIVER
+
+    return 1;
+} /* initStaticArchivers */
+
+
+static void setDefaultAllocator(void);
+static int doDeinit(void);
+
+int PHYSFS_init(const char *argv0)
+{
+    BAIL_IF(initialized, PHYSFS_ERR_IS_INITIALIZED, 0);
+
+    if (!externalAllocator)
+        setDefaultAllocator();
+
+    if ((allocator.Init != NULL) && (!allocator.Init())) return 0;
+
+    if (!__PHYSFS_platformInit())
+    {
+        if (allocator.Deinit != NULL) allocator.Deinit();
+        return 0;
+    } /* if */
+
+    /* everything below here can be cleaned up safely by doDeinit(). */
+
+    if (!initializeMutexes()) goto initFailed;
+
+    baseDir = calculateBaseDir(argv0);
+    if (!baseDir) goto initFailed;
 
     userDir = __PHYSFS_platformCalcUserDir();
     if (!userDir) goto initFailed;
@@ -1274,6 +2105,9 @@ static int closeFileHandleList(FileHandle **list)
         } /* if */
 
         io->destroy(io);
+        if (i->buffer != NULL)
+            allocator.Free(i->buffer);
+        releaseDirHandle(i->dirHandle);
         allocator.Free(i);
     } /* for */
 
@@ -1289,13 +2123,14 @@ static void freeSearchPath(void)
     DirHandle *next = NULL;
 
     closeFileHandleList(&openReadList);
+    dropSearchPathSnapshot();
 
     if (searchPath != NULL)
     {
         for (i = searchPath; i != NULL; i = next)
         {
             next = i->next;
-            freeDirHandle(i, openReadList);
+            freeDirHandle(i, &openReadList);
         } /* for */
         searchPath = NULL;
     } /* if */
@@ -1327,6 +2162,11 @@ static int doDeregisterArchiver(const size_t idx)
     if (archiverInUse(arc, searchPath) || archiverInUse(arc, writeDir))
         BAIL(PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
+    __PHYSFS_platformGrabMutex(refLock);
+    if (archiverInUse(arc, retiredDirHandles))
+        BAIL_MUTEX(PHYSFS_ERR_FILES_STILL_OPEN, refLock, 0);
+    __PHYSFS_platformReleaseMutex(refLock);
+
     allocator.Free((void *) info->extension);
     allocator.Free((void *) info->description);
     allocator.Free((void *) info->author);
@@ -1364,7 +2204,22 @@ static int doDeinit(void)
     closeFileHandleList(&openWriteList);
     BAIL_IF(!PHYSFS_setWriteDir(NULL), PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
+    pathIndexFree();
+    missCacheFree();
     freeSearchPath();
+
+    if (indexCacheDir != NULL)
+    {
+        allocator.Free(indexCacheDir);
+        indexCacheDir = NULL;
+    } /* if */
+
+    mapArchives = 0;
+    defaultBufferSize = 0;
+    adaptiveBuffers = 0;
+    seekCheckpoints = 0;
+    inflaterPool = 0;
+
     freeArchivers();
     freeErrorStates();
 
@@ -1404,11 +2259,12 @@ static int doDeinit(void)
 
     if (errorLock) __PHYSFS_platformDestroyMutex(errorLock);
     if (stateLock) __PHYSFS_platformDestroyMutex(stateLock);
+    if (refLock) __PHYSFS_platformDestroyMutex(refLock);
 
     if (allocator.Deinit != NULL)
         allocator.Deinit();
 
-    errorLock = stateLock = NULL;
+    errorLock = stateLock = refLock = NULL;
 
     __PHYSFS_platformDeinit();
 
@@ -1733,7 +2589,7 @@ int PHYSFS_setWriteDir(const char *newDir)
 
     if (writeDir != NULL)
     {
-        BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(writeDir, openWriteList),
+        BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(writeDir, &openWriteList),
                             stateLock, 0);
         writeDir = NULL;
     } /* if */
@@ -1744,6 +2600,8 @@ int PHYSFS_setWriteDir(const char *newDir)
         retval = (writeDir != NULL);
     } /* if */
 
+    searchPathChanged();
+
     __PHYSFS_platformReleaseMutex(stateLock);
 
     return retval;
@@ -1762,32 +2620,35 @@ int PHYSFS_setRoot(const char *archive, const char *subdir)
     {
         if ((i->dirName != NULL) && (strcmp(archive, i->dirName) == 0))
         {
-            if (!subdir || (strcmp(subdir, "/") == 0))
-            {
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = NULL;
-                i->rootlen = 0;
-            } /* if */
-            else
+            char *ptr = NULL;
+
+            if (subdir && (strcmp(subdir, "/") != 0))
             {
                 const size_t len = strlen(subdir) + 1;
-                char *ptr = (char *) allocator.Malloc(len);
+                ptr = (char *) allocator.Malloc(len);
                 BAIL_IF_MUTEX(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
                 if (!sanitizePlatformIndependentPath(subdir, ptr))
                 {
                     allocator.Free(ptr);
                     BAIL_MUTEX_ERRPASS(stateLock, 0);
                 } /* if */
+            } /* if */
 
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = ptr;
-                i->rootlen = strlen(i->root);  /* in case sanitizePlatformIndependentPath changed subdir */
+            /* lookups read the root with only the archive's lock held. */
+            __PHYSFS_platformGrabMutex(i->lock);
+            if (i->root)
+                allocator.Free(i->root);
+            i->root = ptr;
+            i->rootlen = ptr ? strlen(ptr) : 0;  /* in case sanitizePlatformIndependentPath changed subdir */
+            if (longest_root < i->rootlen)
+                longest_root = i->rootlen;
+            __PHYSFS_platformReleaseMutex(i->lock);
 
-                if (longest_root < i->rootlen)
-                    longest_root = i->rootlen;
-            } /* else */
+            /* paths shifted around, so the index has to start over. */
+            if (pathIndex != NULL)
+                pathIndexBuild();
+
+            searchPathChanged();
 
             break;
         } /* if */
@@ -1836,6 +2697,13 @@ static int doMount(PHYSFS_Io *io, const char *fname,
         searchPath = dh;
     } /* else */
 
+    /* if the index can't keep up, drop it and search the slow way. */
+    if ((pathIndex != NULL) && (!pathIndexAddDirHandle(dh, !appendToPath)))
+        pathIndexFree();
+
+    dropSearchPathSnapshot();
+    searchPathChanged();
+
     __PHYSFS_platformReleaseMutex(stateLock);
     return 1;
 } /* doMount */
@@ -1932,14 +2800,32 @@ int PHYSFS_unmount(const char *oldDir)
         if (strcmp(i->dirName, oldDir) == 0)
         {
             next = i->next;
-            BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(i, openReadList),
-                                stateLock, 0);
 
             if (prev == NULL)
                 searchPath = next;
             else
                 prev->next = next;
 
+            if ((i->indexed) && (!pathIndexRemoveDirHandle(i)))
+                pathIndexFree();
+
+            if (!freeDirHandle(i, &openReadList))
+            {
+                /* still in use; put it back the way it was. */
+                if (prev == NULL)
+                    searchPath = i;
+                else
+                    prev->next = i;
+
+                if (pathIndex != NULL)
+                    pathIndexBuild();
+
+                BAIL_MUTEX(PHYSFS_ERR_FILES_STILL_OPEN, stateLock, 0);
+            } /* if */
+
+            dropSearchPathSnapshot();
+            searchPathChanged();
+
             BAIL_MUTEX_ERRPASS(stateLock, 1);
         } /* if */
         prev = i;
@@ -2091,6 +2977,12 @@ int PHYSFS_setSaneConfig(const char *organization, const char *appName,
 void PHYSFS_permitSymbolicLinks(int allow)
 {
     allowSymLinks = allow;
+    if (initialized)
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        searchPathChanged();  /* symlinked paths might exist now. */
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* if */
 } /* PHYSFS_permitSymbolicLinks */
 
 
@@ -2100,6 +2992,414 @@ int PHYSFS_symbolicLinksPermitted(void)
 } /* PHYSFS_symbolicLinksPermitted */
 
 
+int PHYSFS_setSearchPathIndex(int enable)
+{
+    int retval = 1;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    if (!enable)
+        pathIndexFree();
+    else if (pathIndex == NULL)
+        retval = pathIndexBuild();
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return retval;
+} /* PHYSFS_setSearchPathIndex */
+
+
+int PHYSFS_getSearchPathIndex(void)
+{
+    return (pathIndex != NULL);
+} /* PHYSFS_getSearchPathIndex */
+
+
+int PHYSFS_setMissCacheSize(PHYSFS_uint32 entries)
+{
+    MissCacheSlot *slots = NULL;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    if (entries > 0)
+    {
+        const size_t len = ((size_t) entries) * sizeof (MissCacheSlot);
+        BAIL_IF((len / sizeof (MissCacheSlot)) != entries,
+                PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        slots = (MissCacheSlot *) allocator.Malloc(len);
+        BAIL_IF(!slots, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        memset(slots, '\0', len);
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    missCacheFree();
+    missCache = slots;
+    missCacheSlots = (size_t) entries;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setMissCacheSize */
+
+
+PHYSFS_uint32 PHYSFS_getMissCacheSize(void)
+{
+    return (PHYSFS_uint32) missCacheSlots;
+} /* PHYSFS_getMissCacheSize */
+
+
+int PHYSFS_setIndexCacheDir(const char *dir)
+{
+    char *dircopy = NULL;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    if (dir != NULL)
+    {
+        PHYSFS_Stat statbuf;
+        BAIL_IF_ERRPASS(!__PHYSFS_platformStat(dir, &statbuf, 1), 0);
+        BAIL_IF(statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY,
+                PHYSFS_ERR_NOT_A_FILE, 0);
+        dircopy = (char *) allocator.Malloc(strlen(dir) + 1);
+        BAIL_IF(!dircopy, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        strcpy(dircopy, dir);
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    if (indexCacheDir != NULL)
+        allocator.Free(indexCacheDir);
+    indexCacheDir = dircopy;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setIndexCacheDir */
+
+
+const char *PHYSFS_getIndexCacheDir(void)
+{
+    const char *retval;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    retval = indexCacheDir;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return retval;
+} /* PHYSFS_getIndexCacheDir */
+
+
+int PHYSFS_setArchiveMapping(int enable)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+#ifdef PHYSFS_NO_PLATFORM_MMAP
+    BAIL_IF(enable, PHYSFS_ERR_UNSUPPORTED, 0);
+#endif
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    mapArchives = enable ? 1 : 0;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setArchiveMapping */
+
+
+int PHYSFS_getArchiveMapping(void)
+{
+    int retval;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    retval = mapArchives;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return retval;
+} /* PHYSFS_getArchiveMapping */
+
+
+const void *PHYSFS_mapFile(PHYSFS_File *handle, PHYSFS_uint64 *len)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    const PHYSFS_uint8 *mem;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_Io *io = NULL;
+    PHYSFS_sint64 filelen;
+    PHYSFS_uint64 memlen;
+    int rc;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!len, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, NULL);
+
+    if (fh->mapped != NULL)  /* already mapped? Hand out the same thing. */
+    {
+        *len = fh->maplen;
+        return fh->mapped;
+    } /* if */
+
+    mem = __PHYSFS_ioMemory(fh->io, &memlen);
+    if (mem == NULL)  /* not in memory already; read a copy. */
+    {
+        filelen = fh->io->length(fh->io);
+        BAIL_IF_ERRPASS(filelen == -1, NULL);
+        BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(filelen),
+                PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) filelen + 1);
+        BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+        /* read through a duplicate, so our file position doesn't move. */
+        __PHYSFS_platformGrabMutex(fh->dirHandle->lock);
+        io = fh->io->duplicate(fh->io);
+        __PHYSFS_platformReleaseMutex(fh->dirHandle->lock);
+        if (!io)
+        {
+            allocator.Free(buf);
+            return NULL;
+        } /* if */
+
+        rc = __PHYSFS_readAll(io, buf, (size_t) filelen);
+        __PHYSFS_platformGrabMutex(fh->dirHandle->lock);
+        io->destroy(io);
+        __PHYSFS_platformReleaseMutex(fh->dirHandle->lock);
+        if (!rc)
+        {
+            allocator.Free(buf);
+            return NULL;
+        } /* if */
+
+        mem = buf;
+        memlen = (PHYSFS_uint64) filelen;
+    } /* if */
+
+    fh->mapped = mem;
+    fh->maplen = memlen;
+    fh->mapbuf = buf;
+    *len = memlen;
+    return mem;
+} /* PHYSFS_mapFile */
+
+
+int PHYSFS_unmapFile(PHYSFS_File *handle)
+{
+    FileHandle *fh = (FileHandle *) handle;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(fh->mapped == NULL, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (fh->mapbuf != NULL)
+        allocator.Free(fh->mapbuf);
+
+    fh->mapped = NULL;
+    fh->maplen = 0;
+    fh->mapbuf = NULL;
+    return 1;
+} /* PHYSFS_unmapFile */
+
+
+int PHYSFS_setDefaultBuffer(PHYSFS_uint64 bufsize)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(bufsize),
+            PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    __PHYSFS_platformGrabMutex(refLock);
+    defaultBufferSize = (size_t) bufsize;
+    __PHYSFS_platformReleaseMutex(refLock);
+
+    return 1;
+} /* PHYSFS_setDefaultBuffer */
+
+
+PHYSFS_uint64 PHYSFS_getDefaultBuffer(void)
+{
+    return (PHYSFS_uint64) defaultBufferSize;
+} /* PHYSFS_getDefaultBuffer */
+
+
+int PHYSFS_setAdaptiveBuffer(int enable)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(refLock);
+    adaptiveBuffers = enable ? 1 : 0;
+    __PHYSFS_platformReleaseMutex(refLock);
+
+    return 1;
+} /* PHYSFS_setAdaptiveBuffer */
+
+
+int PHYSFS_getAdaptiveBuffer(void)
+{
+    return adaptiveBuffers;
+} /* PHYSFS_getAdaptiveBuffer */
+
+
+int PHYSFS_setSeekCheckpoints(PHYSFS_uint64 interval)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    seekCheckpoints = interval;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setSeekCheckpoints */
+
+
+PHYSFS_uint64 PHYSFS_getSeekCheckpoints(void)
+{
+    return seekCheckpoints;
+} /* PHYSFS_getSeekCheckpoints */
+
+
+int PHYSFS_setInflaterPool(PHYSFS_uint32 count)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    inflaterPool = count;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setInflaterPool */
+
+
+PHYSFS_uint32 PHYSFS_getInflaterPool(void)
+{
+    return inflaterPool;
+} /* PHYSFS_getInflaterPool */
+
+
+/* most threads PHYSFS_loadFiles() reads on, the calling thread included. */
+#define BULK_LOAD_MAX_THREADS 16
+
+typedef struct
+{
+    PHYSFS_BulkLoad *files;
+    PHYSFS_uint32 count;
+    PHYSFS_uint32 next;  /* next file to hand out, guarded by (lock). */
+    void *lock;
+} BulkLoader;
+
+
+/* the error a worker thread just hit; a failure is never PHYSFS_ERR_OK. */
+static PHYSFS_ErrorCode bulkLoadError(void)
+{
+    const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+    return (err == PHYSFS_ERR_OK) ? PHYSFS_ERR_OTHER_ERROR : err;
+} /* bulkLoadError */
+
+
+static void bulkLoadFile(PHYSFS_BulkLoad *file)
+{
+    PHYSFS_File *fh;
+    PHYSFS_sint64 len;
+    PHYSFS_sint64 br;
+    void *buf = NULL;
+
+    file->buffer = NULL;
+    file->size = 0;
+    file->error = PHYSFS_ERR_OK;
+
+    fh = PHYSFS_openRead(file->fname);
+    if (!fh)
+    {
+        file->error = bulkLoadError();
+        return;
+    } /* if */
+
+    len = PHYSFS_fileLength(fh);
+    if (len < 0)
+        file->error = bulkLoadError();
+    else if ((buf = allocator.Malloc(len ? len : 1)) == NULL)
+        file->error = PHYSFS_ERR_OUT_OF_MEMORY;
+    else if ((br = PHYSFS_readBytes(fh, buf, len)) < 0)
+        file->error = bulkLoadError();
+    else if (br != len)
+        file->error = PHYSFS_ERR_IO;  /* file changed under us? */
+
+    PHYSFS_close(fh);
+
+    if (file->error == PHYSFS_ERR_OK)
+    {
+        file->buffer = buf;
+        file->size = (PHYSFS_uint64) len;
+    } /* if */
+    else if (buf)
+    {
+        allocator.Free(buf);
+    } /* else if */
+} /* bulkLoadFile */
+
+
+static void bulkLoadWorker(void *data)
+{
+    BulkLoader *loader = (BulkLoader *) data;
+    PHYSFS_uint32 i;
+
+    while (1)
+    {
+        __PHYSFS_platformGrabMutex(loader->lock);
+        i = loader->next;
+        if (i < loader->count)
+            loader->next++;
+        __PHYSFS_platformReleaseMutex(loader->lock);
+
+        if (i >= loader->count)
+            break;
+
+        bulkLoadFile(&loader->files[i]);
+    } /* while */
+} /* bulkLoadWorker */
+
+
+int PHYSFS_loadFiles(PHYSFS_BulkLoad *files, PHYSFS_uint32 count,
+                     PHYSFS_uint32 threads)
+{
+    BulkLoader loader;
+    void **workers = NULL;
+    PHYSFS_uint32 started = 0;
+    PHYSFS_uint32 i;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!files && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    loader.files = files;
+    loader.count = count;
+    loader.next = 0;
+    loader.lock = __PHYSFS_platformCreateMutex();
+    BAIL_IF_ERRPASS(!loader.lock, 0);
+
+    /* the calling thread is a worker too, so start one less than asked. */
+    if (threads > BULK_LOAD_MAX_THREADS)
+        threads = BULK_LOAD_MAX_THREADS;
+    if (threads > count)
+        threads = count;
+    if (threads > 1)
+        workers = (void **) allocator.Malloc(sizeof (void *) * (threads - 1));
+
+    if (workers)  /* if we can't start threads, just do it all ourselves. */
+    {
+        for (started = 0; started < threads - 1; started++)
+        {
+            workers[started] = __PHYSFS_platformCreateThread(bulkLoadWorker,
+                                                             &loader);
+            if (!workers[started])
+                break;
+        } /* for */
+    } /* if */
+
+    bulkLoadWorker(&loader);
+
+    for (i = 0; i < started; i++)
+        __PHYSFS_platformJoinThread(workers[i]);
+    if (workers)
+        allocator.Free(workers);
+    __PHYSFS_platformDestroyMutex(loader.lock);
+
+    for (i = 0; i < count; i++)
+        BAIL_IF(files[i].error != PHYSFS_ERR_OK, files[i].error, 0);
+
+    return 1;
+} /* PHYSFS_loadFiles */
+
+
 /*
  * Verify that (fname) (in platform-independent notation), in relation
  *  to (h) is secure. That means that each element of fname is checked
@@ -2276,6 +3576,7 @@ int PHYSFS_mkdir(const char *_dname)
     dname = (char *) __PHYSFS_smallAlloc(len);
     BAIL_IF_MUTEX(!dname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
     retval = doMkdir(_dname, dname);
+    searchPathChanged();  /* even a failure might have made some dirs. */
     __PHYSFS_platformReleaseMutex(stateLock);
     __PHYSFS_smallFree(dname);
     return retval;
@@ -2310,46 +3611,152 @@ int PHYSFS_delete(const char *_fname)
 } /* PHYSFS_delete */
 
 
-static DirHandle *getRealDirHandle(const char *_fname)
+/*
+ * Ask each archive in the search path about (_fname), in order, until
+ *  (visit) says to stop. This is the shared part of PHYSFS_openRead(),
+ *  PHYSFS_stat() and PHYSFS_getRealDir(); see "Search path snapshots".
+ *
+ * (visit) is called with the archive's lock held (and not the stateLock),
+ *  with (fname) sanitized but not yet run through verifyPath(). It returns
+ *  1 if it found what it wanted, -1 to give up, or 0 to move on to the next
+ *  archive, with the error state saying why. If every archive says
+ *  PHYSFS_ERR_NOT_FOUND, the path goes into the miss cache.
+ *
+ * Returns the archive (visit) was happy with, or NULL.
+ */
+typedef int (*SearchPathVisitor)(DirHandle *h, char *fname, void *data);
+
+static DirHandle *searchPathLookup(const char *_fname,
+                                   SearchPathVisitor visit, void *data)
 {
+    SearchPathSnapshot *snapshot = NULL;
     DirHandle *retval = NULL;
-    char *allocated_fname = NULL;
-    char *fname = NULL;
-    size_t len;
-
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    DirHandle *indexed = NULL;
+    PHYSFS_uint32 generation = 0;
+    int skipindexed = 0;
+    int missing = 1;
+    size_t pathlen = strlen(_fname) + 1;
+    size_t rootspace;
+    char *allocated_fname;
+    char *fname;
+    char *pristine;
+    size_t i;
 
     __PHYSFS_platformGrabMutex(stateLock);
-    len = strlen(_fname) + longest_root + 2;
-    allocated_fname = __PHYSFS_smallAlloc(len);
+
+    /* room for a root, then fname for verifyPath() to scribble on, then a
+       clean copy of fname, since a root can clobber the mountpoint part. */
+    rootspace = longest_root + 1;
+    allocated_fname = (char *) __PHYSFS_smallAlloc(rootspace + pathlen * 2);
     BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, NULL);
-    fname = allocated_fname + longest_root + 1;
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    fname = allocated_fname + rootspace;
+    pristine = fname + pathlen;
+
+    if (!sanitizePlatformIndependentPath(_fname, pristine))
+        snapshot = NULL;
+    else if (missCacheHas(pristine))
+        PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+    else
     {
-        DirHandle *i;
-        for (i = searchPath; i != NULL; i = i->next)
+        skipindexed = pathIndexFind(pristine, &indexed);
+        snapshot = acquireSearchPathSnapshot();
+        generation = searchPathGeneration;
+    } /* else */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    if (snapshot == NULL)
+    {
+        __PHYSFS_smallFree(allocated_fname);
+        return NULL;
+    } /* if */
+
+    pathlen = strlen(pristine) + 1;  /* sanitizing may have shortened it. */
+    memcpy(fname, pristine, pathlen);
+
+    for (i = 0; i < snapshot->count; i++)
+    {
+        DirHandle *h = snapshot->items[i].handle;
+        int mountdir;
+        int rc;
+
+        if (h == indexed)
+            skipindexed = 0;
+        else if ((skipindexed) && (snapshot->items[i].indexed))
+            continue;
+
+        __PHYSFS_platformGrabMutex(h->lock);
+
+        if (h->rootlen >= rootspace)  /* PHYSFS_setRoot() since we started? */
         {
-            char *arcfname = fname;
-            if (partOfMountPoint(i, arcfname))
+            char *ptr;
+            rootspace = h->rootlen + 1;
+            ptr = (char *) __PHYSFS_smallAlloc(rootspace + pathlen * 2);
+            if (!ptr)
             {
-                retval = i;
+                __PHYSFS_platformReleaseMutex(h->lock);
+                PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+                missing = 0;
                 break;
             } /* if */
-            else if (verifyPath(i, &arcfname, 0))
-            {
-                PHYSFS_Stat statbuf;
-                if (i->funcs->stat(i->opaque, arcfname, &statbuf))
-                {
-                    retval = i;
-                    break;
-                } /* if */
-            } /* if */
-        } /* for */
+            memcpy(ptr + rootspace + pathlen, pristine, pathlen);
+            __PHYSFS_smallFree(allocated_fname);
+            allocated_fname = ptr;
+            fname = allocated_fname + rootspace;
+            pristine = fname + pathlen;
+            memcpy(fname, pristine, pathlen);
+        } /* if */
+
+        mountdir = partOfMountPoint(h, fname);
+        rc = visit(h, fname, data);
+        if ((rc == 0) && ((mountdir) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND)))
+            missing = 0;
+
+        if (h->root != NULL)  /* verifyPath() might have clobbered it. */
+            memcpy(fname, pristine, pathlen);
+
+        __PHYSFS_platformReleaseMutex(h->lock);
+
+        if (rc != 0)
+        {
+            retval = (rc > 0) ? h : NULL;
+            missing = 0;
+            break;
+        } /* if */
+    } /* for */
+
+    if (missing)
+    {
+        /* in case nothing was asked at all (empty path, index, etc). */
+        PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+        __PHYSFS_platformGrabMutex(stateLock);
+        if (generation == searchPathGeneration)  /* nothing changed since? */
+            missCacheAdd(pristine);
+        __PHYSFS_platformReleaseMutex(stateLock);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPathSnapshot(snapshot);
     __PHYSFS_smallFree(allocated_fname);
     return retval;
+} /* searchPathLookup */
+
+
+static int realDirVisitor(DirHandle *h, char *fname, void *data)
+{
+    PHYSFS_Stat statbuf;
+
+    if (partOfMountPoint(h, fname))
+        return 1;
+    else if (!verifyPath(h, &fname, 0))
+        return 0;
+    return h->funcs->stat(h->opaque, fname, &statbuf) ? 1 : 0;
+} /* realDirVisitor */
+
+
+static DirHandle *getRealDirHandle(const char *_fname)
+{
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    return searchPathLookup(_fname, realDirVisitor, NULL);
 } /* getRealDirHandle */
 
 const char *PHYSFS_getRealDir(const char *fname)
@@ -2359,88 +3766,170 @@ const char *PHYSFS_getRealDir(const char *fname)
 } /* PHYSFS_getRealDir */
 
 
-static int locateInStringList(const char *str,
-                              char **list,
-                              PHYSFS_uint32 *pos)
+/*
+ * PHYSFS_enumerateFiles() collects names from every archive in the search
+ *  path, so it has to drop duplicates and sort the result. Names go into
+ *  an unsorted array that grows geometrically, an open-addressed hash table
+ *  of indices into that array weeds out duplicates, and the array is sorted
+ *  once at the end. This keeps big directories from going quadratic.
+ *  PHYSFS_walk() uses the same thing, with a PHYSFS_Stat kept for each name.
+ */
+typedef struct
 {
-    PHYSFS_uint32 len = *pos;
-    PHYSFS_uint32 half_len;
-    PHYSFS_uint32 lo = 0;
-    PHYSFS_uint32 middle;
-    int cmp;
+    char **list;
+    PHYSFS_Stat *stats;  /* parallel to list, or NULL if not wanted. */
+    PHYSFS_uint32 size;
+    PHYSFS_uint32 capacity;
+    PHYSFS_uint32 *table;  /* index+1 into list, 0 for an empty slot. */
+    PHYSFS_uint32 tablesize;  /* always a power of two. */
+    PHYSFS_ErrorCode errcode;
+} EnumFilesCallbackData;
 
-    while (len > 0)
-    {
-        half_len = len >> 1;
-        middle = lo + half_len;
-        cmp = strcmp(list[middle], str);
 
-        if (cmp == 0)  /* it's in the list already. */
-            return 1;
-        else if (cmp > 0)
-            len = half_len;
-        else
-        {
-            lo = middle + 1;
-            len -= half_len + 1;
-        } /* else */
+static PHYSFS_uint32 *locateInFileTable(EnumFilesCallbackData *pecd,
+                                        const char *str, PHYSFS_uint32 hash)
+{
+    const PHYSFS_uint32 mask = pecd->tablesize - 1;
+    PHYSFS_uint32 *slot = &pecd->table[hash & mask];
+
+    while (*slot != 0)
+    {
+        if (strcmp(pecd->list[*slot - 1], str) == 0)
+            break;
+        hash++;
+        slot = &pecd->table[hash & mask];
     } /* while */
 
-    *pos = lo;
-    return 0;
-} /* locateInStringList */
+    return slot;
+} /* locateInFileTable */
 
 
-static PHYSFS_EnumerateCallbackResult enumFilesCallback(void *data,
-                                        const char *origdir, const char *str)
+static int growFileTable(EnumFilesCallbackData *pecd)
 {
-    PHYSFS_uint32 pos;
-    void *ptr;
+    const PHYSFS_uint32 newsize = pecd->tablesize ? pecd->tablesize * 2 : 64;
+    const size_t len = sizeof (PHYSFS_uint32) * ((size_t) newsize);
+    PHYSFS_uint32 *oldtable = pecd->table;
+    PHYSFS_uint32 i;
+
+    BAIL_IF(newsize < pecd->tablesize, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    pecd->table = (PHYSFS_uint32 *) allocator.Malloc(len);
+    if (pecd->table == NULL)
+    {
+        pecd->table = oldtable;
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+
+    memset(pecd->table, '\0', len);
+    pecd->tablesize = newsize;
+    for (i = 0; i < pecd->size; i++)
+    {
+        const char *str = pecd->list[i];
+        *locateInFileTable(pecd, str, __PHYSFS_hashString(str)) = i + 1;
+    } /* for */
+
+    allocator.Free(oldtable);
+    return 1;
+} /* growFileTable */
+
+
+static PHYSFS_EnumerateCallbackResult enumFilesAdd(EnumFilesCallbackData *pecd,
+                                                   const char *str,
+                                                   const PHYSFS_Stat *stat)
+{
+    const PHYSFS_uint32 hash = __PHYSFS_hashString(str);
+    PHYSFS_uint32 *slot;
     char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
 
-    /*
-     * See if file is in the list already, and if not, insert it in there
-     *  alphabetically...
-     */
-    pos = pecd->size;
-    if (locateInStringList(str, pecd->list, &pos))
+    /* keep the table at most half full, so probes stay short. */
+    if (((pecd->size + 1) * 2) > pecd->tablesize)
+    {
+        if (!growFileTable(pecd))
+        {
+            pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+            return PHYSFS_ENUM_ERROR;
+        } /* if */
+    } /* if */
+
+    slot = locateInFileTable(pecd, str, hash);
+    if (*slot != 0)
         return PHYSFS_ENUM_OK;  /* already in the list, but keep going. */
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
+    /* always leave room for the NULL terminator. */
+    if ((pecd->size + 2) > pecd->capacity)
+    {
+        const PHYSFS_uint32 newcap = pecd->capacity * 2;
+        void *ptr = NULL;
+        if ((newcap > pecd->capacity) && (pecd->stats != NULL))
+        {
+            const size_t len = sizeof (PHYSFS_Stat) * ((size_t) newcap);
+            ptr = allocator.Realloc(pecd->stats, len);
+            if (ptr != NULL)
+                pecd->stats = (PHYSFS_Stat *) ptr;
+        } /* if */
+        if ((newcap > pecd->capacity) && ((ptr) || (pecd->stats == NULL)))
+            ptr = allocator.Realloc(pecd->list, sizeof (char *) * newcap);
+        if (ptr == NULL)
+        {
+            pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+            return PHYSFS_ENUM_ERROR;  /* better luck next time. */
+        } /* if */
         pecd->list = (char **) ptr;
+        pecd->capacity = newcap;
+    } /* if */
 
-    if ((ptr == NULL) || (newstr == NULL))
+    newstr = (char *) allocator.Malloc(strlen(str) + 1);
+    if (newstr == NULL)
     {
-        if (newstr)
-            allocator.Free(newstr);
-
         pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
         return PHYSFS_ENUM_ERROR;  /* better luck next time. */
     } /* if */
 
     strcpy(newstr, str);
+    if (pecd->stats != NULL)
+        memcpy(&pecd->stats[pecd->size], stat, sizeof (PHYSFS_Stat));
+    pecd->list[pecd->size++] = newstr;
+    *slot = pecd->size;
+    return PHYSFS_ENUM_OK;
+} /* enumFilesAdd */
 
-    if (pos != pecd->size)
-    {
-        memmove(&pecd->list[pos+1], &pecd->list[pos],
-                 sizeof (char *) * ((pecd->size) - pos));
-    } /* if */
-
-    pecd->list[pos] = newstr;
-    pecd->size++;
 
-    return PHYSFS_ENUM_OK;
+static PHYSFS_EnumerateCallbackResult enumFilesCallback(void *data,
+                                        const char *origdir, const char *str)
+{
+    return enumFilesAdd((EnumFilesCallbackData *) data, str, NULL);
 } /* enumFilesCallback */
 
 
+static int enumFilesCmp(void *_a, size_t one, size_t two)
+{
+    EnumFilesCallbackData *pecd = (EnumFilesCallbackData *) _a;
+    return strcmp(pecd->list[one], pecd->list[two]);
+} /* enumFilesCmp */
+
+
+static void enumFilesSwap(void *_a, size_t one, size_t two)
+{
+    EnumFilesCallbackData *pecd = (EnumFilesCallbackData *) _a;
+    char *tmp = pecd->list[one];
+    pecd->list[one] = pecd->list[two];
+    pecd->list[two] = tmp;
+
+    if (pecd->stats != NULL)
+    {
+        PHYSFS_Stat tmpstat;
+        memcpy(&tmpstat, &pecd->stats[one], sizeof (PHYSFS_Stat));
+        memcpy(&pecd->stats[one], &pecd->stats[two], sizeof (PHYSFS_Stat));
+        memcpy(&pecd->stats[two], &tmpstat, sizeof (PHYSFS_Stat));
+    } /* if */
+} /* enumFilesSwap */
+
+
 char **PHYSFS_enumerateFiles(const char *path)
 {
-    EnumStringListCallbackData ecd;
+    EnumFilesCallbackData ecd;
     memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
+    ecd.capacity = 16;
+    ecd.list = (char **) allocator.Malloc(sizeof (char *) * ecd.capacity);
     BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
     if (!PHYSFS_enumerate(path, enumFilesCallback, &ecd))
     {
@@ -2449,21 +3938,50 @@ char **PHYSFS_enumerateFiles(const char *path)
         for (i = 0; i < ecd.size; i++)
             allocator.Free(ecd.list[i]);
         allocator.Free(ecd.list);
+        if (ecd.table)
+            allocator.Free(ecd.table);
         BAIL_IF(errcode == PHYSFS_ERR_APP_CALLBACK, ecd.errcode, NULL);
         return NULL;
     } /* if */
 
+    if (ecd.table)
+        allocator.Free(ecd.table);
+    __PHYSFS_sort(&ecd, ecd.size, enumFilesCmp, enumFilesSwap);
     ecd.list[ecd.size] = NULL;
     return ecd.list;
 } /* PHYSFS_enumerateFiles */
 
 
+/*
+ * PHYSFS_stat() on a complete mount point asks the archive about its root,
+ *  so enumerating with stats does the same. (fname) is (i)'s mount point
+ *  without the trailing '/'. (stat) is left alone if this fails.
+ */
+static void statMountPointRoot(DirHandle *i, const char *fname,
+                               PHYSFS_Stat *stat)
+{
+    const size_t len = strlen(fname) + 1;
+    char *allocated_fname = (char *) __PHYSFS_smallAlloc(i->rootlen + 1 + len);
+    if (allocated_fname != NULL)
+    {
+        char *arcfname = allocated_fname + i->rootlen + 1;
+        PHYSFS_Stat statbuf;
+        memcpy(arcfname, fname, len);
+        if ((verifyPath(i, &arcfname, 0)) &&
+            (i->funcs->stat(i->opaque, arcfname, &statbuf)))
+            memcpy(stat, &statbuf, sizeof (statbuf));
+        __PHYSFS_smallFree(allocated_fname);
+    } /* if */
+} /* statMountPointRoot */
+
+
 /*
  * Broke out to seperate function so we can use stack allocation gratuitously.
  */
 static PHYSFS_EnumerateCallbackResult enumerateFromMountPoint(DirHandle *i,
                                     const char *arcfname,
                                     PHYSFS_EnumerateCallback callback,
+                                    PHYSFS_EnumerateStatCallback statcallback,
                                     const char *_fname, void *data)
 {
     PHYSFS_EnumerateCallbackResult retval;
@@ -2475,149 +3993,492 @@ static PHYSFS_EnumerateCallbackResult enumerateFromMountPoint(DirHandle *i,
 
     BAIL_IF(!mountPoint, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
 
-    strcpy(mountPoint, i->mountPoint);
-    ptr = mountPoint + ((len) ? len + 1 : 0);
-    end = strchr(ptr, '/');
-    assert(end);  /* should always find a terminating '/'. */
-    *end = '\0';
-    retval = callback(data, _fname, ptr);
-    __PHYSFS_smallFree(mountPoint);
+    strcpy(mountPoint, i->mountPoint);
+    ptr = mountPoint + ((len) ? len + 1 : 0);
+    end = strchr(ptr, '/');
+    assert(end);  /* should always find a terminating '/'. */
+    *end = '\0';
+    if (statcallback == NULL)
+        retval = callback(data, _fname, ptr);
+    else
+    {
+        /* same thing PHYSFS_stat() reports for a piece of a mount point. */
+        PHYSFS_Stat statbuf;
+        statbuf.filesize = -1;
+        statbuf.modtime = -1;
+        statbuf.createtime = -1;
+        statbuf.accesstime = -1;
+        statbuf.filetype = PHYSFS_FILETYPE_DIRECTORY;
+        statbuf.readonly = 1;
+        if (end[1] == '\0')  /* this piece is the archive itself. */
+            statMountPointRoot(i, mountPoint, &statbuf);
+        retval = statcallback(data, _fname, ptr, &statbuf);
+    } /* else */
+    __PHYSFS_smallFree(mountPoint);
+
+    BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+    return retval;
+} /* enumerateFromMountPoint */
+
+
+typedef struct SymlinkFilterData
+{
+    PHYSFS_EnumerateCallback callback;
+    PHYSFS_EnumerateStatCallback statCallback;
+    void *callbackData;
+    DirHandle *dirhandle;
+    const char *arcfname;
+    PHYSFS_ErrorCode errcode;
+} SymlinkFilterData;
+
+/*
+ * Stats each item the archiver enumerates, to drop symlinks when they aren't
+ *  permitted and/or to hand the stat to a PHYSFS_enumerateWithStat() callback.
+ */
+static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
+                                    const char *origdir, const char *fname)
+{
+    SymlinkFilterData *data = (SymlinkFilterData *) _data;
+    const DirHandle *dh = data->dirhandle;
+    const char *arcfname = data->arcfname;
+    PHYSFS_Stat statbuf;
+    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
+    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(slen);
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+
+    if (path == NULL)
+    {
+        data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
+
+    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
+
+    statbuf.filesize = -1;
+    statbuf.modtime = -1;
+    statbuf.createtime = -1;
+    statbuf.accesstime = -1;
+    statbuf.filetype = PHYSFS_FILETYPE_OTHER;
+    statbuf.readonly = 1;
+
+    if (!dh->funcs->stat(dh->opaque, path, &statbuf))
+    {
+        data->errcode = currentErrorCode();
+        retval = PHYSFS_ENUM_ERROR;
+    } /* if */
+    else
+    {
+        /* Pass it on to the application if it's not a forbidden symlink. */
+        if ((allowSymLinks) || (statbuf.filetype != PHYSFS_FILETYPE_SYMLINK))
+        {
+            if (data->statCallback != NULL)
+            {
+                retval = data->statCallback(data->callbackData, origdir,
+                                            fname, &statbuf);
+            } /* if */
+            else
+            {
+                retval = data->callback(data->callbackData, origdir, fname);
+            } /* else */
+
+            if (retval == PHYSFS_ENUM_ERROR)
+                data->errcode = PHYSFS_ERR_APP_CALLBACK;
+        } /* if */
+    } /* else */
+
+    __PHYSFS_smallFree(path);
+
+    return retval;
+} /* enumCallbackFilterSymLinks */
+
+
+/*
+ * Enumerate (arcfname) in one archive. (arcfname) must be sanitized, with
+ *  room for (i)'s root in front of it. Exactly one of (cb) and (statcb) is
+ *  non-NULL. (filterdata) is scratch space, with its callbacks filled in.
+ *
+ * MAKE SURE you hold (i)'s lock before calling this!
+ */
+static PHYSFS_EnumerateCallbackResult enumerateDirHandle(DirHandle *i,
+                                    char *arcfname,
+                                    PHYSFS_EnumerateCallback cb,
+                                    PHYSFS_EnumerateStatCallback statcb,
+                                    const char *_fn, void *data,
+                                    SymlinkFilterData *filterdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+
+    if (partOfMountPoint(i, arcfname))
+        retval = enumerateFromMountPoint(i, arcfname, cb, statcb, _fn, data);
+
+    else if (verifyPath(i, &arcfname, 0))
+    {
+        PHYSFS_Stat statbuf;
+        if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+            { /* no such dir in this archive, skip it. */ }
+
+        else if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
+            { /* not a directory in this archive, skip it. */ }
+
+        else if ((statcb != NULL) ||
+                 ((!allowSymLinks) && (i->funcs->info.supportsSymlinks)))
+        {
+            filterdata->dirhandle = i;
+            filterdata->arcfname = arcfname;
+            filterdata->errcode = PHYSFS_ERR_OK;
+            retval = i->funcs->enumerate(i->opaque, arcfname,
+                                         enumCallbackFilterSymLinks,
+                                         _fn, filterdata);
+            if (retval == PHYSFS_ENUM_ERROR)
+            {
+                if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
+                    PHYSFS_setErrorCode(filterdata->errcode);
+            } /* if */
+        } /* else if */
+        else
+        {
+            retval = i->funcs->enumerate(i->opaque, arcfname, cb, _fn, data);
+        } /* else */
+    } /* else if */
+
+    return retval;
+} /* enumerateDirHandle */
+
+
+/* exactly one of (cb) and (statcb) is non-NULL. */
+static int doEnumerate(const char *_fn, PHYSFS_EnumerateCallback cb,
+                       PHYSFS_EnumerateStatCallback statcb, void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    size_t len;
+    char *allocated_fname;
+    char *fname;
+
+    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    len = strlen(_fn) + longest_root + 2;
+    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
+    fname = allocated_fname + longest_root + 1;
+    if (!sanitizePlatformIndependentPath(_fn, fname))
+        retval = PHYSFS_ENUM_STOP;
+    else
+    {
+        DirHandle *i;
+        SymlinkFilterData filterdata;
+
+        memset(&filterdata, '\0', sizeof (filterdata));
+        filterdata.callback = cb;
+        filterdata.statCallback = statcb;
+        filterdata.callbackData = data;
+
+        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        {
+            /* lookups don't wait for the stateLock, only for this. */
+            __PHYSFS_platformGrabMutex(i->lock);
+            retval = enumerateDirHandle(i, fname, cb, statcb, _fn, data,
+                                        &filterdata);
+            __PHYSFS_platformReleaseMutex(i->lock);
+        } /* for */
+
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    __PHYSFS_smallFree(allocated_fname);
+
+    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
+} /* doEnumerate */
+
+
+int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
+{
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    return doEnumerate(_fn, cb, NULL, data);
+} /* PHYSFS_enumerate */
+
+
+int PHYSFS_enumerateWithStat(const char *_fn, PHYSFS_EnumerateStatCallback cb,
+                             void *data)
+{
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    return doEnumerate(_fn, NULL, cb, data);
+} /* PHYSFS_enumerateWithStat */
+
+
+/*
+ * PHYSFS_walk() takes one search path snapshot for the whole trip (see
+ *  "Search path snapshots"), and lists each directory by asking every
+ *  archive in it, one archive lock at a time, keeping the first archive's
+ *  answer for each name. The application's callback runs with no locks
+ *  held, so it's free to call back into PhysicsFS.
+ */
+typedef struct WalkData
+{
+    SearchPathSnapshot *snapshot;
+    PHYSFS_WalkCallback callback;
+    void *callbackData;
+} WalkData;
+
 
-    BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
-    return retval;
-} /* enumerateFromMountPoint */
+static PHYSFS_EnumerateCallbackResult walkStatCallback(void *data,
+                                    const char *origdir, const char *fname,
+                                    const PHYSFS_Stat *stat)
+{
+    return enumFilesAdd((EnumFilesCallbackData *) data, fname, stat);
+} /* walkStatCallback */
 
 
-typedef struct SymlinkFilterData
+static void freeWalkList(EnumFilesCallbackData *ecd)
 {
-    PHYSFS_EnumerateCallback callback;
-    void *callbackData;
-    DirHandle *dirhandle;
-    const char *arcfname;
-    PHYSFS_ErrorCode errcode;
-} SymlinkFilterData;
+    PHYSFS_uint32 i;
+    for (i = 0; i < ecd->size; i++)
+        allocator.Free(ecd->list[i]);
+    if (ecd->list)
+        allocator.Free(ecd->list);
+    if (ecd->stats)
+        allocator.Free(ecd->stats);
+    if (ecd->table)
+        allocator.Free(ecd->table);
+} /* freeWalkList */
 
-static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
-                                    const char *origdir, const char *fname)
+
+/* Fill in (ecd) with the sorted contents of (path), which is sanitized. */
+static int walkListDir(SearchPathSnapshot *snapshot, const char *path,
+                       EnumFilesCallbackData *ecd)
 {
-    SymlinkFilterData *data = (SymlinkFilterData *) _data;
-    const DirHandle *dh = data->dirhandle;
-    const char *arcfname = data->arcfname;
-    PHYSFS_Stat statbuf;
-    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
-    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
-    char *path = (char *) __PHYSFS_smallAlloc(slen);
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    PHYSFS_EnumerateCallbackResult rc = PHYSFS_ENUM_OK;
+    const size_t pathlen = strlen(path) + 1;
+    SymlinkFilterData filterdata;
+    size_t i;
 
-    if (path == NULL)
+    memset(ecd, '\0', sizeof (*ecd));
+    ecd->capacity = 16;
+    ecd->list = (char **) allocator.Malloc(sizeof (char *) * ecd->capacity);
+    ecd->stats = (PHYSFS_Stat *) allocator.Malloc(sizeof (PHYSFS_Stat) *
+                                                  ecd->capacity);
+    if ((ecd->list == NULL) || (ecd->stats == NULL))
     {
-        data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        return PHYSFS_ENUM_ERROR;
+        freeWalkList(ecd);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
     } /* if */
 
-    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
+    memset(&filterdata, '\0', sizeof (filterdata));
+    filterdata.statCallback = walkStatCallback;
+    filterdata.callbackData = ecd;
 
-    if (!dh->funcs->stat(dh->opaque, path, &statbuf))
-    {
-        data->errcode = currentErrorCode();
-        retval = PHYSFS_ENUM_ERROR;
-    } /* if */
-    else
+    for (i = 0; (rc == PHYSFS_ENUM_OK) && (i < snapshot->count); i++)
     {
-        /* Pass it on to the application if it's not a symlink. */
-        if (statbuf.filetype != PHYSFS_FILETYPE_SYMLINK)
+        DirHandle *h = snapshot->items[i].handle;
+        char *allocated_fname;
+
+        __PHYSFS_platformGrabMutex(h->lock);
+        allocated_fname = (char *) __PHYSFS_smallAlloc(h->rootlen + 1 + pathlen);
+        if (allocated_fname == NULL)
         {
-            retval = data->callback(data->callbackData, origdir, fname);
-            if (retval == PHYSFS_ENUM_ERROR)
-                data->errcode = PHYSFS_ERR_APP_CALLBACK;
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+            rc = PHYSFS_ENUM_ERROR;
         } /* if */
-    } /* else */
+        else
+        {
+            char *fname = allocated_fname + h->rootlen + 1;
+            memcpy(fname, path, pathlen);
+            rc = enumerateDirHandle(h, fname, NULL, walkStatCallback, path,
+                                    ecd, &filterdata);
+            __PHYSFS_smallFree(allocated_fname);
+        } /* else */
+        __PHYSFS_platformReleaseMutex(h->lock);
+    } /* for */
+
+    if (rc == PHYSFS_ENUM_ERROR)
+    {
+        const PHYSFS_ErrorCode errcode = currentErrorCode();
+        const PHYSFS_ErrorCode ecderrcode = ecd->errcode;
+        freeWalkList(ecd);
+        BAIL_IF(errcode == PHYSFS_ERR_APP_CALLBACK, ecderrcode, 0);
+        return 0;
+    } /* if */
+
+    __PHYSFS_sort(ecd, ecd->size, enumFilesCmp, enumFilesSwap);
+    return 1;
+} /* walkListDir */
 
-    __PHYSFS_smallFree(path);
 
+static char *walkChildPath(const char *path, const char *fname)
+{
+    const size_t len = strlen(path) + strlen(fname) + 2;
+    char *retval = (char *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    snprintf(retval, len, "%s%s%s", path, *path ? "/" : "", fname);
     return retval;
-} /* enumCallbackFilterSymLinks */
+} /* walkChildPath */
 
 
-int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
+static PHYSFS_EnumerateCallbackResult walkDepthFirst(WalkData *wd,
+                                                     const char *path)
 {
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
-    size_t len;
-    char *allocated_fname;
-    char *fname;
+    EnumFilesCallbackData ecd;
+    PHYSFS_uint32 i;
 
-    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if (!walkListDir(wd->snapshot, path, &ecd))
+        return PHYSFS_ENUM_ERROR;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    for (i = 0; (retval == PHYSFS_ENUM_OK) && (i < ecd.size); i++)
+    {
+        const PHYSFS_Stat *stat = &ecd.stats[i];
+        char *child = walkChildPath(path, ecd.list[i]);
+        if (child == NULL)
+            retval = PHYSFS_ENUM_ERROR;
+        else
+        {
+            retval = wd->callback(wd->callbackData, child, stat);
+            if (retval == PHYSFS_ENUM_ERROR)
+                PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+            else if ((retval == PHYSFS_ENUM_OK) &&
+                     (stat->filetype == PHYSFS_FILETYPE_DIRECTORY))
+                retval = walkDepthFirst(wd, child);
+            allocator.Free(child);
+        } /* else */
+    } /* for */
 
-    len = strlen(_fn) + longest_root + 2;
-    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
-    if (!sanitizePlatformIndependentPath(_fn, fname))
-        retval = PHYSFS_ENUM_STOP;
-    else
+    freeWalkList(&ecd);
+    return retval;
+} /* walkDepthFirst */
+
+
+static PHYSFS_EnumerateCallbackResult walkBreadthFirst(WalkData *wd,
+                                                       const char *root)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    size_t capacity = 16;
+    size_t head = 0;
+    size_t tail = 0;
+    char **queue = (char **) allocator.Malloc(sizeof (char *) * capacity);
+    EnumFilesCallbackData ecd;
+    PHYSFS_uint32 i;
+
+    BAIL_IF(!queue, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    queue[tail] = (char *) allocator.Malloc(strlen(root) + 1);
+    if (queue[tail] == NULL)
     {
-        DirHandle *i;
-        SymlinkFilterData filterdata;
+        allocator.Free(queue);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    } /* if */
+    strcpy(queue[tail++], root);
 
-        if (!allowSymLinks)
+    while ((retval == PHYSFS_ENUM_OK) && (head < tail))
+    {
+        char *path = queue[head++];
+
+        if (!walkListDir(wd->snapshot, path, &ecd))
         {
-            memset(&filterdata, '\0', sizeof (filterdata));
-            filterdata.callback = cb;
-            filterdata.callbackData = data;
+            allocator.Free(path);
+            retval = PHYSFS_ENUM_ERROR;
+            break;
         } /* if */
 
-        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        for (i = 0; (retval == PHYSFS_ENUM_OK) && (i < ecd.size); i++)
         {
-            char *arcfname = fname;
+            const PHYSFS_Stat *stat = &ecd.stats[i];
+            char *child = walkChildPath(path, ecd.list[i]);
+            if (child == NULL)
+            {
+                retval = PHYSFS_ENUM_ERROR;
+                break;
+            } /* if */
+
+            retval = wd->callback(wd->callbackData, child, stat);
+            if (retval == PHYSFS_ENUM_ERROR)
+                PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
 
-            if (partOfMountPoint(i, arcfname))
-                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
+            if ((retval != PHYSFS_ENUM_OK) ||
+                (stat->filetype != PHYSFS_FILETYPE_DIRECTORY))
+            {
+                allocator.Free(child);
+                continue;
+            } /* if */
 
-            else if (verifyPath(i, &arcfname, 0))
+            if (tail == capacity)  /* reuse the front of the queue first. */
             {
-                PHYSFS_Stat statbuf;
-                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+                if (head > 0)
                 {
-                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
-                        continue;  /* no such dir in this archive, skip it. */
+                    memmove(queue, queue + head, sizeof (char *) * (tail - head));
+                    tail -= head;
+                    head = 0;
                 } /* if */
-
-                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
-                    continue;  /* not a directory in this archive, skip it. */
-
-                else if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
+                else
                 {
-                    filterdata.dirhandle = i;
-                    filterdata.arcfname = arcfname;
-                    filterdata.errcode = PHYSFS_ERR_OK;
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 enumCallbackFilterSymLinks,
-                                                 _fn, &filterdata);
-                    if (retval == PHYSFS_ENUM_ERROR)
+                    void *ptr = allocator.Realloc(queue,
+                                        sizeof (char *) * capacity * 2);
+                    if (ptr == NULL)
                     {
-                        if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
-                            PHYSFS_setErrorCode(filterdata.errcode);
+                        allocator.Free(child);
+                        PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+                        retval = PHYSFS_ENUM_ERROR;
+                        break;
                     } /* if */
-                } /* else if */
-                else
-                {
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 cb, _fn, data);
+                    queue = (char **) ptr;
+                    capacity *= 2;
                 } /* else */
-            } /* else if */
+            } /* if */
+
+            queue[tail++] = child;
         } /* for */
 
+        freeWalkList(&ecd);
+        allocator.Free(path);
+    } /* while */
+
+    while (head < tail)
+        allocator.Free(queue[head++]);
+    allocator.Free(queue);
+
+    return retval;
+} /* walkBreadthFirst */
+
+
+int PHYSFS_walk(const char *_root, PHYSFS_WalkCallback cb, void *data,
+                PHYSFS_uint32 flags)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_ERROR;
+    SearchPathSnapshot *snapshot = NULL;
+    char *root;
+    WalkData wd;
+
+    BAIL_IF(!_root, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(flags & ~PHYSFS_WALK_BREADTH_FIRST, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    root = (char *) __PHYSFS_smallAlloc(strlen(_root) + 1);
+    BAIL_IF(!root, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    if (sanitizePlatformIndependentPath(_root, root))
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        snapshot = acquireSearchPathSnapshot();
+        __PHYSFS_platformReleaseMutex(stateLock);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    if (snapshot != NULL)
+    {
+        wd.snapshot = snapshot;
+        wd.callback = cb;
+        wd.callbackData = data;
+        if (flags & PHYSFS_WALK_BREADTH_FIRST)
+            retval = walkBreadthFirst(&wd, root);
+        else
+            retval = walkDepthFirst(&wd, root);
+        releaseSearchPathSnapshot(snapshot);
+    } /* if */
 
-    __PHYSFS_smallFree(allocated_fname);
+    __PHYSFS_smallFree(root);
 
     return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
-} /* PHYSFS_enumerate */
+} /* PHYSFS_walk */
 
 
 typedef struct
@@ -2718,8 +4579,12 @@ static PHYSFS_File *doOpenWrite(const char *_fname, const int appending)
                     memset(fh, '\0', sizeof (FileHandle));
                     fh->io = io;
                     fh->dirHandle = h;
+                    __PHYSFS_platformGrabMutex(refLock);
+                    h->refcount++;
                     fh->next = openWriteList;
                     openWriteList = fh;
+                    __PHYSFS_platformReleaseMutex(refLock);
+                    searchPathChanged();  /* file might be new. */
                 } /* else */
             } /* if */
         } /* if */
@@ -2744,107 +4609,121 @@ PHYSFS_File *PHYSFS_openAppend(const char *filename)
 } /* PHYSFS_openAppend */
 
 
+static int openReadVisitor(DirHandle *h, char *fname, void *data)
+{
+    PHYSFS_Io **io = (PHYSFS_Io **) data;
+
+    if (!verifyPath(h, &fname, 0))
+        return 0;
+
+    *io = h->funcs->openRead(h->opaque, fname);
+    if (*io == NULL)
+        return 0;
+
+    /* the file keeps the archive alive, even if it's unmounted right now. */
+    __PHYSFS_platformGrabMutex(refLock);
+    h->refcount++;
+    __PHYSFS_platformReleaseMutex(refLock);
+    return 1;
+} /* openReadVisitor */
+
+
 PHYSFS_File *PHYSFS_openRead(const char *_fname)
 {
     FileHandle *fh = NULL;
-    char *allocated_fname;
-    char *fname;
-    size_t len;
+    PHYSFS_Io *io = NULL;
+    DirHandle *h;
+    size_t bufsize;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
-
-    BAIL_IF_MUTEX(!searchPath, PHYSFS_ERR_NOT_FOUND, stateLock, 0);
-
-    len = strlen(_fname) + longest_root + 2;
-    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
+    h = searchPathLookup(_fname, openReadVisitor, &io);
+    BAIL_IF_ERRPASS(!h, NULL);
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    if (fh == NULL)
     {
-        PHYSFS_Io *io = NULL;
-        DirHandle *i;
+        __PHYSFS_platformGrabMutex(h->lock);
+        io->destroy(io);
+        __PHYSFS_platformReleaseMutex(h->lock);
+        releaseDirHandle(h);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
 
-        for (i = searchPath; i != NULL; i = i->next)
-        {
-            char *arcfname = fname;
-            if (verifyPath(i, &arcfname, 0))
-            {
-                io = i->funcs->openRead(i->opaque, arcfname);
-                if (io)
-                    break;
-            } /* if */
-        } /* for */
+    memset(fh, '\0', sizeof (FileHandle));
+    fh->io = io;
+    fh->forReading = 1;
+    fh->dirHandle = h;
 
-        if (io)
-        {
-            fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-            if (fh == NULL)
-            {
-                io->destroy(io);
-                PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
-            } /* if */
-            else
-            {
-                memset(fh, '\0', sizeof (FileHandle));
-                fh->io = io;
-                fh->forReading = 1;
-                fh->dirHandle = i;
-                fh->next = openReadList;
-                openReadList = fh;
-            } /* else */
-        } /* if */
+    __PHYSFS_platformGrabMutex(refLock);
+    fh->next = openReadList;
+    openReadList = fh;
+    fh->adaptive = (PHYSFS_uint8) adaptiveBuffers;
+    bufsize = defaultBufferSize;
+    __PHYSFS_platformReleaseMutex(refLock);
+
+    if ((bufsize > 0) && (!PHYSFS_setBuffer((PHYSFS_File *) fh, bufsize)))
+    {
+        const PHYSFS_ErrorCode errcode = currentErrorCode();
+        PHYSFS_close((PHYSFS_File *) fh);
+        BAIL(errcode, NULL);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    __PHYSFS_smallFree(allocated_fname);
     return ((PHYSFS_File *) fh);
 } /* PHYSFS_openRead */
 
 
 static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
 {
-    FileHandle *prev = NULL;
-    FileHandle *i;
+    DirHandle *dh;
+    PHYSFS_Io *io;
+    PHYSFS_uint8 *tmp;
+    FileHandle **i;
+    int found;
 
-    for (i = *list; i != NULL; i = i->next)
-    {
-        if (i == handle)  /* handle is in this list? */
-        {
-            PHYSFS_Io *io = handle->io;
-            PHYSFS_uint8 *tmp = handle->buffer;
+    __PHYSFS_platformGrabMutex(refLock);
+    for (i = list; (*i != NULL) && (*i != handle); i = &(*i)->next) {}
+    found = (*i != NULL);
+    __PHYSFS_platformReleaseMutex(refLock);
 
-            /* send our buffer to io... */
-            if (!handle->forReading)
-            {
-                if (!PHYSFS_flush((PHYSFS_File *) handle))
-                    return -1;
+    if (!found)  /* handle isn't in this list. */
+        return 0;
 
-                /* ...then have io send it to the disk... */
-                else if (io->flush && !io->flush(io))
-                    return -1;
-            } /* if */
+    dh = handle->dirHandle;
+    io = handle->io;
+    tmp = handle->buffer;
 
-            /* ...then close the underlying file. */
-            io->destroy(io);
+    /* send our buffer to io... */
+    if (!handle->forReading)
+    {
+        if (!PHYSFS_flush((PHYSFS_File *) handle))
+            return -1;
 
-            if (tmp != NULL)  /* free any associated buffer. */
-                allocator.Free(tmp);
+        /* ...then have io send it to the disk... */
+        else if (io->flush && !io->flush(io))
+            return -1;
+    } /* if */
 
-            if (prev == NULL)
-                *list = handle->next;
-            else
-                prev->next = handle->next;
+    /* other threads may have added files in front of us since we looked. */
+    __PHYSFS_platformGrabMutex(refLock);
+    for (i = list; *i != handle; i = &(*i)->next) {}
+    *i = handle->next;
+    __PHYSFS_platformReleaseMutex(refLock);
 
-            allocator.Free(handle);
-            return 1;
-        } /* if */
-        prev = i;
-    } /* for */
+    /* ...then close the underlying file. Its archive might care. */
+    __PHYSFS_platformGrabMutex(dh->lock);
+    io->destroy(io);
+    __PHYSFS_platformReleaseMutex(dh->lock);
 
-    return 0;
+    if (tmp != NULL)  /* free any associated buffer. */
+        allocator.Free(tmp);
+
+    if (handle->mapbuf != NULL)  /* ...and any copy PHYSFS_mapFile made. */
+        allocator.Free(handle->mapbuf);
+
+    allocator.Free(handle);
+    releaseDirHandle(dh);
+    return 1;
 } /* closeHandleInOpenList */
 
 
@@ -2853,18 +4732,16 @@ int PHYSFS_close(PHYSFS_File *_handle)
     FileHandle *handle = (FileHandle *) _handle;
     int rc;
 
-    __PHYSFS_platformGrabMutex(stateLock);
-
     /* -1 == close failure. 0 == not found. 1 == success. */
-    rc = closeHandleInOpenList(&openReadList, handle);
-    BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
+    rc = closeHandleInOpenList(&openReadList, handle);  /* no stateLock! */
     if (!rc)
     {
+        __PHYSFS_platformGrabMutex(stateLock);
         rc = closeHandleInOpenList(&openWriteList, handle);
         BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
+        __PHYSFS_platformReleaseMutex(stateLock);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
     BAIL_IF(!rc, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     return 1;
 } /* PHYSFS_close */
@@ -2889,10 +4766,44 @@ static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *_buffer, size_t len)
             retval += cpy;
         } /* if */
 
+        else if (len >= fh->bufwindow)  /* buffer is empty, and no help. */
+        {
+            /* read straight into the caller's memory, like stdio does. The
+               buffer no longer holds what's right before the file pointer,
+               so empty it, or PHYSFS_seek() would seek back into it. */
+            PHYSFS_Io *io = fh->io;
+            const PHYSFS_sint64 rc = io->read(io, buffer, len);
+            fh->buffill = fh->bufpos = 0;
+            if (rc > 0)
+            {
+                assert(((PHYSFS_uint64) rc) <= len);
+                buffer += (size_t) rc;
+                len -= (size_t) rc;
+                retval += rc;
+            } /* if */
+            else
+            {
+                if (retval == 0)  /* report already-read data, or failure. */
+                    retval = rc;
+                break;
+            } /* else */
+        } /* else if */
+
         else   /* buffer is empty, refill it. */
         {
             PHYSFS_Io *io = fh->io;
-            const PHYSFS_sint64 rc = io->read(io, fh->buffer, fh->bufsize);
+            PHYSFS_sint64 rc;
+
+            /* read through the last refill without seeking? Read more. */
+            if ((fh->adaptive) && (!fh->seeked))
+            {
+                fh->bufwindow *= 2;
+                if (fh->bufwindow > fh->bufsize)
+                    fh->bufwindow = fh->bufsize;
+            } /* if */
+            fh->seeked = 0;
+
+            rc = io->read(io, fh->buffer, fh->bufwindow);
             fh->bufpos = 0;
             if (rc > 0)
                 fh->buffill = (size_t) rc;
@@ -2957,9 +4868,18 @@ static PHYSFS_sint64 doBufferedWrite(PHYSFS_File *handle, const void *buffer,
         return (PHYSFS_sint64) len;
     } /* if */
 
-    /* would overflow buffer. Flush and then write the new objects, too. */
+    /* would overflow buffer. Flush it first. */
     BAIL_IF_ERRPASS(!PHYSFS_flush(handle), -1);
-    return fh->io->write(fh->io, buffer, len);
+
+    /* the buffer just saves another flush later, unless it's too small. */
+    if (len < fh->bufsize)
+    {
+        memcpy(fh->buffer, buffer, len);
+        fh->buffill = len;
+        return (PHYSFS_sint64) len;
+    } /* if */
+
+    return fh->io->write(fh->io, buffer, len);  /* write it directly. */
 } /* doBufferedWrite */
 
 
@@ -3051,6 +4971,16 @@ int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
         } /* if */
     } /* if */
 
+    /* random access wastes big refills; read less after each one of these. */
+    if ((fh->adaptive) && (fh->buffer))
+    {
+        fh->bufwindow /= 2;
+        if (fh->bufwindow < ADAPTIVE_BUFFER_MIN)
+            fh->bufwindow = fh->bufsize < ADAPTIVE_BUFFER_MIN ?
+                            fh->bufsize : ADAPTIVE_BUFFER_MIN;
+        fh->seeked = 1;
+    } /* if */
+
     /* we have to fall back to a 'raw' seek. */
     fh->buffill = fh->bufpos = 0;
     return fh->io->seek(fh->io, pos);
@@ -3107,6 +5037,12 @@ int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 _bufsize)
 
     fh->bufsize = bufsize;
     fh->buffill = fh->bufpos = 0;
+
+    /* adaptive buffers start small, and grow if reads are sequential. */
+    fh->bufwindow = bufsize;
+    if ((fh->adaptive) && (bufsize > ADAPTIVE_BUFFER_MIN))
+        fh->bufwindow = ADAPTIVE_BUFFER_MIN;
+    fh->seeked = 1;  /* no history yet; the first refill doesn't count. */
     return 1;
 } /* PHYSFS_setBuffer */
 
@@ -3129,12 +5065,31 @@ int PHYSFS_flush(PHYSFS_File *handle)
 } /* PHYSFS_flush */
 
 
+static int statVisitor(DirHandle *h, char *fname, void *data)
+{
+    PHYSFS_Stat *stat = (PHYSFS_Stat *) data;
+
+    if (partOfMountPoint(h, fname))
+    {
+        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        stat->readonly = 1;
+        return 1;
+    } /* if */
+
+    else if (!verifyPath(h, &fname, 0))
+        return 0;
+
+    else if (h->funcs->stat(h->opaque, fname, stat))
+        return 1;
+
+    /* it's there, but something went wrong; don't look any further. */
+    return (currentErrorCode() == PHYSFS_ERR_NOT_FOUND) ? 0 : -1;
+} /* statVisitor */
+
+
 int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
 {
-    int retval = 0;
-    char *allocated_fname;
-    char *fname;
-    size_t len;
+    const char *ptr;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!stat, PHYSFS_ERR_INVALID_ARGUMENT, 0);
@@ -3142,52 +5097,22 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
     /* set some sane defaults... */
     stat->filesize = -1;
     stat->modtime = -1;
-    stat->createtime = -1;
-    stat->accesstime = -1;
-    stat->filetype = PHYSFS_FILETYPE_OTHER;
-    stat->readonly = 1;
-
-    __PHYSFS_platformGrabMutex(stateLock);
-    len = strlen(_fname) + longest_root + 2;
-    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
-
-    if (sanitizePlatformIndependentPath(_fname, fname))
-    {
-        if (*fname == '\0')
-        {
-            stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-            stat->readonly = !writeDir; /* Writeable if we have a writeDir */
-            retval = 1;
-        } /* if */
-        else
-        {
-            DirHandle *i;
-            int exists = 0;
-            for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
-            {
-                char *arcfname = fname;
-                exists = partOfMountPoint(i, arcfname);
-                if (exists)
-                {
-                    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-                    stat->readonly = 1;
-                    retval = 1;
-                } /* if */
-                else if (verifyPath(i, &arcfname, 0))
-                {
-                    retval = i->funcs->stat(i->opaque, arcfname, stat);
-                    if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
-                        exists = 1;
-                } /* else if */
-            } /* for */
-        } /* else */
+    stat->createtime = -1;
+    stat->accesstime = -1;
+    stat->filetype = PHYSFS_FILETYPE_OTHER;
+    stat->readonly = 1;
+
+    for (ptr = _fname; *ptr == '/'; ptr++) {}
+    if (*ptr == '\0')  /* the root of the interpolated tree. */
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        stat->readonly = !writeDir; /* Writeable if we have a writeDir */
+        __PHYSFS_platformReleaseMutex(stateLock);
+        return 1;
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    __PHYSFS_smallFree(allocated_fname);
-    return retval;
+    return (searchPathLookup(_fname, statVisitor, stat) != NULL);
 } /* PHYSFS_stat */
 
 
@@ -3198,6 +5123,46 @@ int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
 } /* __PHYSFS_readAll */
 
 
+static PHYSFS_sint64 localTimeToUnix(int year, int mon, int mday,
+                                     int hour, int min, int sec)
+{
+    struct tm t;
+    memset(&t, '\0', sizeof (t));
+    t.tm_year = year;
+    t.tm_mon = mon;
+    t.tm_mday = mday;
+    t.tm_hour = hour;
+    t.tm_min = min;
+    t.tm_sec = sec;
+    t.tm_isdst = -1;  /* let mktime calculate daylight savings time. */
+    return (PHYSFS_sint64) mktime(&t);
+} /* localTimeToUnix */
+
+
+PHYSFS_sint64 __PHYSFS_localTimeToUnix(__PHYSFS_LocalTimeCache *cache,
+                                       int year, int mon, int mday,
+                                       int hour, int min, int sec)
+{
+    if ((!cache->valid) || (cache->year != year) || (cache->mon != mon) ||
+        (cache->mday != mday) || (cache->hour != hour))
+    {
+        const PHYSFS_sint64 end = localTimeToUnix(year, mon, mday, hour, 59, 59);
+        cache->base = localTimeToUnix(year, mon, mday, hour, 0, 0);
+        cache->year = year;
+        cache->mon = mon;
+        cache->mday = mday;
+        cache->hour = hour;
+
+        /* only remember hours that a DST change doesn't cut into. */
+        cache->valid = ((cache->base != -1) && (end - cache->base == 3599));
+        if (!cache->valid)
+            return localTimeToUnix(year, mon, mday, hour, min, sec);
+    } /* if */
+
+    return cache->base + (((PHYSFS_sint64) min) * 60) + sec;
+} /* __PHYSFS_localTimeToUnix */
+
+
 void *__PHYSFS_initSmallAlloc(void *ptr, const size_t len)
 {
     void *useHeap = ((ptr == NULL) ? ((void *) 1) : ((void *) 0));
@@ -3284,7 +5249,57 @@ static void setDefaultAllocator(void)
 } /* setDefaultAllocator */
 
 
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii)
+/* Archives can claim any entry count they like, so don't let a corrupt
+   header make us allocate a huge table up front; it grows if needed. */
+#define DIRTREE_MIN_BUCKETS 64
+#define DIRTREE_MAX_PRESIZE_BUCKETS (1 << 20)
+
+/* DirTree entries are never freed one at a time, so we carve them (and
+   their names) out of a few big blocks instead of calling the allocator
+   once per entry. Blocks double in size up to a limit. */
+typedef struct DirTreeArenaBlock
+{
+    struct DirTreeArenaBlock *next;
+    size_t used;
+    size_t avail;
+} DirTreeArenaBlock;
+
+#define DIRTREE_ARENA_ALIGN 16
+#define DIRTREE_ARENA_ALIGNED(x) \
+    (((x) + (DIRTREE_ARENA_ALIGN - 1)) & ~((size_t) (DIRTREE_ARENA_ALIGN - 1)))
+#define DIRTREE_ARENA_HEADERLEN DIRTREE_ARENA_ALIGNED(sizeof (DirTreeArenaBlock))
+#define DIRTREE_ARENA_MIN_BLOCK (16 * 1024)
+#define DIRTREE_ARENA_MAX_BLOCK (1024 * 1024)
+
+static void *dirTreeArenaAlloc(__PHYSFS_DirTree *dt, const size_t len)
+{
+    DirTreeArenaBlock *block = (DirTreeArenaBlock *) dt->arena;
+    const size_t alignedlen = DIRTREE_ARENA_ALIGNED(len);
+    void *retval;
+
+    if ((!block) || ((block->avail - block->used) < alignedlen))
+    {
+        size_t blocklen = block ? block->avail * 2 : DIRTREE_ARENA_MIN_BLOCK;
+        if (blocklen > DIRTREE_ARENA_MAX_BLOCK)
+            blocklen = DIRTREE_ARENA_MAX_BLOCK;
+        if (blocklen < alignedlen)
+            blocklen = alignedlen;
+
+        block = (DirTreeArenaBlock *)
+                    allocator.Malloc(DIRTREE_ARENA_HEADERLEN + blocklen);
+        BAIL_IF(!block, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        block->next = (DirTreeArenaBlock *) dt->arena;
+        block->used = 0;
+        block->avail = blocklen;
+        dt->arena = block;
+    } /* if */
+
+    retval = ((PHYSFS_uint8 *) block) + DIRTREE_ARENA_HEADERLEN + block->used;
+    block->used += alignedlen;
+    return retval;
+} /* dirTreeArenaAlloc */
+
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii, const PHYSFS_uint64 entrycount)
 {
     static char rootpath[2] = { '/', '\0' };
     size_t alloclen;
@@ -3295,14 +5310,15 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
     dt->case_sensitive = case_sensitive;
     dt->only_usascii = only_usascii;
 
-    dt->root = (__PHYSFS_DirTreeEntry *) allocator.Malloc(entrylen);
-    BAIL_IF(!dt->root, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    dt->root = (__PHYSFS_DirTreeEntry *) dirTreeArenaAlloc(dt, entrylen);
+    BAIL_IF_ERRPASS(!dt->root, 0);
     memset(dt->root, '\0', entrylen);
     dt->root->name = rootpath;
     dt->root->isdir = 1;
-    dt->hashBuckets = 64;
-    if (!dt->hashBuckets)
-        dt->hashBuckets = 1;
+    dt->hashBuckets = DIRTREE_MIN_BUCKETS;
+    while ((dt->hashBuckets < entrycount) &&
+           (dt->hashBuckets < DIRTREE_MAX_PRESIZE_BUCKETS))
+        dt->hashBuckets <<= 1;
     dt->entrylen = entrylen;
 
     alloclen = dt->hashBuckets * sizeof (__PHYSFS_DirTreeEntry *);
@@ -3314,13 +5330,238 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
 } /* __PHYSFS_DirTreeInit */
 
 
+/* This is the hash of the full path; use hashBucket() to pick a bucket. */
 static PHYSFS_uint32 hashPathName(__PHYSFS_DirTree *dt, const char *name)
 {
-    const PHYSFS_uint32 hashval = dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
-    return hashval % dt->hashBuckets;
+    return dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
 } /* hashPathName */
 
 
+static inline PHYSFS_uint32 hashBucket(const __PHYSFS_DirTree *dt,
+                                       const PHYSFS_uint32 hashval)
+{
+    return hashval & (PHYSFS_uint32) (dt->hashBuckets - 1);
+} /* hashBucket */
+
+
+/* Double the bucket count once the load factor passes 1. */
+static void growHash(__PHYSFS_DirTree *dt)
+{
+    const size_t oldBuckets = dt->hashBuckets;
+    const size_t newBuckets = oldBuckets * 2;
+    __PHYSFS_DirTreeEntry **oldhash = dt->hash;
+    __PHYSFS_DirTreeEntry **newhash;
+    size_t alloclen;
+    size_t i;
+
+    /* hashvals are 32 bits, more buckets than that won't help. */
+    if (oldBuckets >= (((size_t) 1) << 31))
+        return;
+
+    alloclen = newBuckets * sizeof (__PHYSFS_DirTreeEntry *);
+    newhash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
+    if (!newhash)
+        return;  /* not fatal, we just keep the longer chains. */
+    memset(newhash, '\0', alloclen);
+
+    dt->hash = newhash;
+    dt->hashBuckets = newBuckets;
+
+    for (i = 0; i < oldBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry;
+        __PHYSFS_DirTreeEntry *next;
+        for (entry = oldhash[i]; entry; entry = next)
+        {
+            const PHYSFS_uint32 bucket = hashBucket(dt, entry->hashval);
+            next = entry->hashnext;
+            entry->hashnext = newhash[bucket];
+            newhash[bucket] = entry;
+        } /* for */
+    } /* for */
+
+    allocator.Free(oldhash);
+} /* growHash */
+
+
+/*
+ * Compare an entry's name to the path component at the start of (path),
+ *  which ends at the next '/' or the end of the string. Returns a pointer
+ *  just past the component on a match, NULL otherwise.
+ */
+static const char *matchPathComponent(const __PHYSFS_DirTree *dt,
+                                      const char *name, const char *path)
+{
+    if (dt->case_sensitive)
+    {
+        while (*name)
+        {
+            if (*(name++) != *(path++))
+                return NULL;
+        } /* while */
+    } /* if */
+
+    else if (dt->only_usascii)
+    {
+        while (*name)
+        {
+            char ch1 = *(name++);
+            char ch2 = *(path++);
+            if ((ch1 >= 'A') && (ch1 <= 'Z'))
+                ch1 -= ('A' - 'a');
+            if ((ch2 >= 'A') && (ch2 <= 'Z'))
+                ch2 -= ('A' - 'a');
+            if (ch1 != ch2)
+                return NULL;
+        } /* while */
+    } /* else if */
+
+    else  /* same as PHYSFS_utf8stricmp(), but stops at the separator. */
+    {
+        PHYSFS_uint32 folded1[3], folded2[3];
+        int head1 = 0, tail1 = 0, head2 = 0, tail2 = 0;
+        while (1)
+        {
+            PHYSFS_uint32 cp1, cp2;
+            if (head1 != tail1)
+                cp1 = folded1[tail1++];
+            else if (*name == '\0')
+                break;  /* end of name; see if the component ends here too. */
+            else
+            {
+                head1 = PHYSFS_caseFold(__PHYSFS_utf8codepoint(&name), folded1);
+                cp1 = folded1[0];
+                tail1 = 1;
+            } /* else */
+
+            if (head2 != tail2)
+                cp2 = folded2[tail2++];
+            else if ((*path == '/') || (*path == '\0'))
+                return NULL;
+            else
+            {
+                head2 = PHYSFS_caseFold(__PHYSFS_utf8codepoint(&path), folded2);
+                cp2 = folded2[0];
+                tail2 = 1;
+            } /* else */
+
+            if (cp1 != cp2)
+                return NULL;
+        } /* while */
+
+        if (head2 != tail2)
+            return NULL;  /* path has leftover folded codepoints. */
+    } /* else */
+
+    return ((*path == '/') || (*path == '\0')) ? path : NULL;
+} /* matchPathComponent */
+
+
+/*
+ * Entries only store their own name, so match (path) against the chain
+ *  of parents, root-most component first. Returns a pointer just past
+ *  the matched part of (path), NULL if it doesn't match.
+ */
+static const char *matchEntryPath(const __PHYSFS_DirTree *dt,
+                                  const __PHYSFS_DirTreeEntry *entry,
+                                  const char *path)
+{
+    if (entry->parent != dt->root)
+    {
+        path = matchEntryPath(dt, entry->parent, path);
+        if ((path == NULL) || (*path != '/'))
+            return NULL;
+        path++;
+    } /* if */
+
+    return matchPathComponent(dt, entry->name, path);
+} /* matchEntryPath */
+
+
+/*
+ * Look (path) up in the hash, without setting an error if it isn't there.
+ *  For trees with a loader, this doesn't look in dirs that aren't loaded.
+ */
+static __PHYSFS_DirTreeEntry *dirTreeFindHashed(__PHYSFS_DirTree *dt,
+                                                const char *path)
+{
+    PHYSFS_uint32 hashval;
+    PHYSFS_uint32 bucket;
+    __PHYSFS_DirTreeEntry *retval;
+
+    if (*path == '\0')
+        return dt->root;
+
+    /* Lookups in trees without a loader never write to them, so several
+       threads can search them at once; buckets are short enough that
+       reordering them isn't worth the cache traffic. */
+    hashval = hashPathName(dt, path);
+    bucket = hashBucket(dt, hashval);
+    for (retval = dt->hash[bucket]; retval; retval = retval->hashnext)
+    {
+        if (retval->hashval == hashval)
+        {
+            const char *end = matchEntryPath(dt, retval, path);
+            if ((end != NULL) && (*end == '\0'))
+                return retval;
+        } /* if */
+    } /* for */
+
+    return NULL;
+} /* dirTreeFindHashed */
+
+
+/* Have the tree's loader fill in the children of (dir), found at (path). */
+static int dirTreeLoad(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *dir,
+                       const char *path)
+{
+    /* mark it loaded first, so adding its children doesn't come back here. */
+    dir->unloaded = 0;
+    dt->unloadedCount--;
+
+    if (!dt->load(dt->loaddata, dir, path))
+    {
+        dir->unloaded = 1;  /* try again next time it's needed. */
+        dt->unloadedCount++;
+        return 0;
+    } /* if */
+
+    return 1;
+} /* dirTreeLoad */
+
+
+/* Load any unloaded dirs on the way to (path), then look it up again. */
+static __PHYSFS_DirTreeEntry *dirTreeFindLoading(__PHYSFS_DirTree *dt,
+                                                 const char *path)
+{
+    const size_t len = strlen(path) + 1;
+    __PHYSFS_DirTreeEntry *retval = NULL;
+    char *buf = (char *) __PHYSFS_smallAlloc(len);
+    char *sep;
+
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(buf, path, len);
+
+    for (sep = strchr(buf, '/'); sep != NULL; sep = strchr(sep + 1, '/'))
+    {
+        __PHYSFS_DirTreeEntry *dir;
+        *sep = '\0';
+        dir = dirTreeFindHashed(dt, buf);
+        GOTO_IF((!dir) || (!dir->isdir), PHYSFS_ERR_NOT_FOUND, findFailed);
+        if (dir->unloaded)
+            GOTO_IF_ERRPASS(!dirTreeLoad(dt, dir, buf), findFailed);
+        *sep = '/';
+    } /* for */
+
+    retval = dirTreeFindHashed(dt, path);
+    GOTO_IF(!retval, PHYSFS_ERR_NOT_FOUND, findFailed);
+
+findFailed:
+    __PHYSFS_smallFree(buf);
+    return retval;
+} /* dirTreeFindLoading */
+
+
 /* Fill in missing parent directories. */
 static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 {
@@ -3330,7 +5571,7 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
     if (sep)
     {
         *sep = '\0';  /* chop off last piece. */
-        retval = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(dt, name);
+        retval = dirTreeFindHashed(dt, name);
 
         if (retval != NULL)
         {
@@ -3350,25 +5591,32 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 {
-    __PHYSFS_DirTreeEntry *retval = __PHYSFS_DirTreeFind(dt, name);
+    __PHYSFS_DirTreeEntry *retval = dirTreeFindHashed(dt, name);
     if (!retval)
     {
-        const size_t alloclen = strlen(name) + 1 + dt->entrylen;
-        PHYSFS_uint32 hashval;
+        const char *sep = strrchr(name, '/');
+        const char *basename = sep ? sep + 1 : name;
+        const size_t alloclen = strlen(basename) + 1 + dt->entrylen;
+        PHYSFS_uint32 bucket;
         __PHYSFS_DirTreeEntry *parent = addAncestors(dt, name);
         BAIL_IF_ERRPASS(!parent, NULL);
         assert(dt->entrylen >= sizeof (__PHYSFS_DirTreeEntry));
-        retval = (__PHYSFS_DirTreeEntry *) allocator.Malloc(alloclen);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        retval = (__PHYSFS_DirTreeEntry *) dirTreeArenaAlloc(dt, alloclen);
+        BAIL_IF_ERRPASS(!retval, NULL);
         memset(retval, '\0', dt->entrylen);
         retval->name = ((char *) retval) + dt->entrylen;
-        strcpy(retval->name, name);
-        hashval = hashPathName(dt, name);
-        retval->hashnext = dt->hash[hashval];
-        dt->hash[hashval] = retval;
+        strcpy(retval->name, basename);
+        retval->parent = parent;
+        retval->hashval = hashPathName(dt, name);
+        bucket = hashBucket(dt, retval->hashval);
+        retval->hashnext = dt->hash[bucket];
+        dt->hash[bucket] = retval;
         retval->sibling = parent->children;
         retval->isdir = isdir;
         parent->children = retval;
+
+        if (++dt->entryCount > dt->hashBuckets)
+            growHash(dt);
     } /* if */
 
     return retval;
@@ -3378,34 +5626,11 @@ void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 /* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
 {
-    const int cs = dt->case_sensitive;
-    PHYSFS_uint32 hashval;
-    __PHYSFS_DirTreeEntry *prev = NULL;
-    __PHYSFS_DirTreeEntry *retval;
-
-    if (*path == '\0')
-        return dt->root;
-
-    hashval = hashPathName(dt, path);
-    for (retval = dt->hash[hashval]; retval; retval = retval->hashnext)
-    {
-        const int cmp = cs ? strcmp(retval->name, path) : PHYSFS_utf8stricmp(retval->name, path);
-        if (cmp == 0)
-        {
-            if (prev != NULL)  /* move this to the front of the list */
-            {
-                prev->hashnext = retval->hashnext;
-                retval->hashnext = dt->hash[hashval];
-                dt->hash[hashval] = retval;
-            } /* if */
-
-            return retval;
-        } /* if */
-
-        prev = retval;
-    } /* for */
-
-    BAIL(PHYSFS_ERR_NOT_FOUND, NULL);
+    __PHYSFS_DirTreeEntry *retval = dirTreeFindHashed(dt, path);
+    if ((retval == NULL) && (dt->unloadedCount > 0))
+        return dirTreeFindLoading(dt, path);
+    BAIL_IF(!retval, PHYSFS_ERR_NOT_FOUND, NULL);
+    return retval;
 } /* __PHYSFS_DirTreeFind */
 
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
@@ -3414,16 +5639,17 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
 {
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
     __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
-    const __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
+    __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
     BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
 
+    if (entry->unloaded)
+        BAIL_IF_ERRPASS(!dirTreeLoad(tree, entry, dname), PHYSFS_ENUM_ERROR);
+
     entry = entry->children;
 
     while (entry && (retval == PHYSFS_ENUM_OK))
     {
-        const char *name = entry->name;
-        const char *ptr = strrchr(name, '/');
-        retval = cb(callbackdata, origdir, ptr ? ptr + 1 : name);
+        retval = cb(callbackdata, origdir, entry->name);
         BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
         entry = entry->sibling;
     } /* while */
@@ -3432,6 +5658,27 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
 } /* __PHYSFS_DirTreeEnumerate */
 
 
+void __PHYSFS_DirTreeSetLoader(__PHYSFS_DirTree *dt,
+                               __PHYSFS_DirTreeLoadFn load, void *data)
+{
+    dt->load = load;
+    dt->loaddata = data;
+} /* __PHYSFS_DirTreeSetLoader */
+
+
+void __PHYSFS_DirTreeDeferDir(__PHYSFS_DirTree *dt,
+                              __PHYSFS_DirTreeEntry *dir)
+{
+    assert(dt->load != NULL);
+    assert(dir->isdir);
+    if (!dir->unloaded)
+    {
+        dir->unloaded = 1;
+        dt->unloadedCount++;
+    } /* if */
+} /* __PHYSFS_DirTreeDeferDir */
+
+
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
 {
     if (!dt)
@@ -3441,25 +5688,454 @@ void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
     {
         assert(dt->root->sibling == NULL);
         assert(dt->hash || (dt->root->children == NULL));
-        allocator.Free(dt->root);
     } /* if */
 
     if (dt->hash)
+        allocator.Free(dt->hash);
+
+    while (dt->arena)
     {
-        size_t i;
-        for (i = 0; i < dt->hashBuckets; i++)
+        DirTreeArenaBlock *block = (DirTreeArenaBlock *) dt->arena;
+        dt->arena = block->next;
+        allocator.Free(block);
+    } /* while */
+
+    dt->root = NULL;
+    dt->hash = NULL;
+} /* __PHYSFS_DirTreeDeinit */
+
+
+/*
+ * Index cache files are a header, the archive's path (to catch hash
+ *  collisions in the filename), then one record per entry in breadth-first
+ *  order, so parents always come before their children. Each record is a
+ *  PHYSFS_uint32 index of the parent (root is 0, the first record is 1),
+ *  the entry's hashval, its name length with the high bit set for
+ *  directories, the name (not null-terminated), and then the archiver's
+ *  packed data. Everything is in the writer's byte order; readers on other
+ *  machines will see a bad byte order mark and ignore the file.
+ */
+#define INDEXCACHE_VERSION 1
+#define INDEXCACHE_BYTEORDER 0x01020304
+#define INDEXCACHE_RECORDLEN 12
+#define INDEXCACHE_ISDIR 0x80000000
+
+typedef struct IndexCacheHeader
+{
+    char magic[8];               /* "PHYSFSIX" */
+    char tag[8];                 /* archiver's tag, null-padded. */
+    PHYSFS_uint32 byteorder;     /* INDEXCACHE_BYTEORDER. */
+    PHYSFS_uint32 version;       /* INDEXCACHE_VERSION. */
+    PHYSFS_sint64 archivesize;   /* size of the archive when cached. */
+    PHYSFS_sint64 archivemtime;  /* modtime of the archive when cached. */
+    PHYSFS_uint64 entrycount;    /* number of records. */
+    PHYSFS_uint64 datalen;       /* bytes of records. */
+    PHYSFS_uint64 checksum;      /* of path and records. */
+    PHYSFS_uint32 pathlen;       /* bytes of path after this header. */
+    PHYSFS_uint32 packlen;       /* bytes of archiver data per record. */
+    PHYSFS_uint32 flags;         /* case_sensitive, only_usascii. */
+    PHYSFS_uint32 reserved;      /* zero. */
+} IndexCacheHeader;
+
+
+/* Not cryptographic; just has to notice torn or damaged files. */
+static PHYSFS_uint64 indexCacheChecksum(PHYSFS_uint64 sum,
+                                        const PHYSFS_uint8 *buf, size_t len)
+{
+    const PHYSFS_uint64 prime = __PHYSFS_UI64(0x100000001B3);
+    PHYSFS_uint64 val;
+
+    while (len >= sizeof (val))
+    {
+        memcpy(&val, buf, sizeof (val));
+        sum = (sum ^ val) * prime;
+        buf += sizeof (val);
+        len -= sizeof (val);
+    } /* while */
+
+    while (len--)
+        sum = (sum ^ *(buf++)) * prime;
+
+    return sum;
+} /* indexCacheChecksum */
+
+
+/*
+ * Fill in what (io)'s index cache header should say, except the fields that
+ *  depend on the tree, and return the cache file's name, or NULL if (io)
+ *  can't be cached. The archive's absolute path, which names the cache file
+ *  and is stored in it, goes in (*path). Caller must free both.
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static char *indexCacheFile(PHYSFS_Io *io, const char *tag,
+                            IndexCacheHeader *hdr, char **path)
+{
+    const NativeIoInfo *info;
+    PHYSFS_Stat statbuf;
+    size_t len;
+    char *retval;
+
+    /* only real files have a path and a modtime we can trust. */
+    if ((indexCacheDir == NULL) || (io->read != nativeIo_read))
+        return NULL;
+
+    info = (const NativeIoInfo *) io->opaque;
+    if (!__PHYSFS_platformStat(info->path, &statbuf, 1))
+        return NULL;
+    else if (statbuf.filetype != PHYSFS_FILETYPE_REGULAR)
+        return NULL;
+    else if (statbuf.filesize != io->length(io))
+        return NULL;
+
+    /* the same archive mounted through another relative path, or from
+       another working directory, should find the same cache file. */
+    *path = __PHYSFS_platformRealPath(info->path);
+    if (*path == NULL)
+        return NULL;
+
+    memset(hdr, '\0', sizeof (*hdr));
+    memcpy(hdr->magic, "PHYSFSIX", sizeof (hdr->magic));
+    strncpy(hdr->tag, tag, sizeof (hdr->tag));
+    hdr->byteorder = INDEXCACHE_BYTEORDER;
+    hdr->version = INDEXCACHE_VERSION;
+    hdr->archivesize = statbuf.filesize;
+    hdr->archivemtime = statbuf.modtime;
+    hdr->pathlen = (PHYSFS_uint32) strlen(*path);
+
+    len = strlen(indexCacheDir) + strlen(tag) + 32;
+    retval = (char *) allocator.Malloc(len);
+    if (retval == NULL)
+    {
+        allocator.Free(*path);
+        *path = NULL;
+        return NULL;
+    } /* if */
+
+    snprintf(retval, len, "%s%cphysfs-%s-%08x.idx", indexCacheDir,
+             __PHYSFS_platformDirSeparator, tag,
+             (unsigned int) __PHYSFS_hashString(*path));
+    return retval;
+} /* indexCacheFile */
+
+
+static int dirTreeLoadIndexRecords(__PHYSFS_DirTree *dt,
+                                   const IndexCacheHeader *hdr,
+                                   const PHYSFS_uint8 *ptr,
+                                   const PHYSFS_uint8 *end,
+                                   __PHYSFS_DirTreeUnpackFn unpack,
+                                   void *data)
+{
+    const size_t count = (size_t) hdr->entrycount;
+    __PHYSFS_DirTreeEntry **entries;
+    size_t i;
+
+    entries = (__PHYSFS_DirTreeEntry **)
+                allocator.Malloc((count + 1) * sizeof (*entries));
+    if (!entries)
+        return 0;
+
+    entries[0] = dt->root;
+    for (i = 1; i <= count; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry;
+        __PHYSFS_DirTreeEntry *parent;
+        PHYSFS_uint32 parentidx, hashval, namelen, bucket;
+        int isdir;
+
+        if ((size_t) (end - ptr) < INDEXCACHE_RECORDLEN)
+            break;
+        memcpy(&parentidx, ptr, 4);
+        memcpy(&hashval, ptr + 4, 4);
+        memcpy(&namelen, ptr + 8, 4);
+        ptr += INDEXCACHE_RECORDLEN;
+        isdir = ((namelen & INDEXCACHE_ISDIR) != 0);
+        namelen &= ~INDEXCACHE_ISDIR;
+
+        if ((parentidx >= i) || (namelen == 0))
+            break;
+        else if ((size_t) (end - ptr) < ((size_t) namelen) + hdr->packlen)
+            break;
+
+        parent = entries[parentidx];
+        if (!parent->isdir)
+            break;
+
+        entry = (__PHYSFS_DirTreeEntry *)
+                    dirTreeArenaAlloc(dt, dt->entrylen + namelen + 1);
+        if (!entry)
+            break;
+
+        memset(entry, '\0', dt->entrylen);
+        entry->name = ((char *) entry) + dt->entrylen;
+        memcpy(entry->name, ptr, namelen);
+        entry->name[namelen] = '\0';
+        ptr += namelen;
+        entry->parent = parent;
+        entry->hashval = hashval;
+        entry->isdir = isdir;
+        bucket = hashBucket(dt, hashval);
+        entry->hashnext = dt->hash[bucket];
+        dt->hash[bucket] = entry;
+        entry->sibling = parent->children;
+        parent->children = entry;
+        entries[i] = entry;
+
+        if (!unpack(data, entry, ptr))
+            break;
+        ptr += hdr->packlen;
+
+        if (++dt->entryCount > dt->hashBuckets)
+            growHash(dt);
+    } /* for */
+
+    allocator.Free(entries);
+    return ((i > count) && (ptr == end));
+} /* dirTreeLoadIndexRecords */
+
+
+int __PHYSFS_DirTreeLoadIndex(__PHYSFS_DirTree *dt, const size_t entrylen,
+                              const int case_sensitive,
+                              const int only_usascii, PHYSFS_Io *io,
+                              const char *tag, const size_t packlen,
+                              __PHYSFS_DirTreeUnpackFn unpack, void *data)
+{
+    const PHYSFS_ErrorCode err = currentErrorCode();
+    const PHYSFS_uint32 flags = (case_sensitive ? 1 : 0) |
+                                (only_usascii ? 2 : 0);
+    IndexCacheHeader expected;
+    IndexCacheHeader hdr;
+    PHYSFS_Io *cacheio = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_sint64 cachelen;
+    size_t buflen;
+    char *path = NULL;
+    char *fname;
+    int retval = 0;
+
+    memset(dt, '\0', sizeof (*dt));
+
+    fname = indexCacheFile(io, tag, &expected, &path);
+    if (fname == NULL)
+        goto loadIndex_done;
+
+    cacheio = __PHYSFS_createNativeIo(fname, 'r');
+    allocator.Free(fname);
+    if (cacheio == NULL)
+        goto loadIndex_done;
+
+    /* the tree-dependent fields are checked against the file's size. */
+    cachelen = cacheio->length(cacheio);
+    if ((cachelen < (PHYSFS_sint64) sizeof (hdr)) ||
+        (!__PHYSFS_readAll(cacheio, &hdr, sizeof (hdr))))
+        goto loadIndex_done;
+
+    expected.entrycount = hdr.entrycount;
+    expected.datalen = hdr.datalen;
+    expected.checksum = hdr.checksum;
+    expected.packlen = (PHYSFS_uint32) packlen;
+    expected.flags = flags;
+    if (memcmp(&hdr, &expected, sizeof (hdr)) != 0)
+        goto loadIndex_done;
+    else if (hdr.datalen != ((PHYSFS_uint64) cachelen) - sizeof (hdr) - hdr.pathlen)
+        goto loadIndex_done;
+    else if (hdr.entrycount > hdr.datalen / (INDEXCACHE_RECORDLEN + packlen + 1))
+        goto loadIndex_done;
+    else if (!__PHYSFS_ui64FitsAddressSpace(hdr.pathlen + hdr.datalen))
+        goto loadIndex_done;
+
+    buflen = (size_t) (hdr.pathlen + hdr.datalen);
+    buf = (PHYSFS_uint8 *) allocator.Malloc(buflen ? buflen : 1);
+    if ((!buf) || (!__PHYSFS_readAll(cacheio, buf, buflen)))
+        goto loadIndex_done;
+    else if (memcmp(buf, path, hdr.pathlen) != 0)
+        goto loadIndex_done;
+    else if (indexCacheChecksum(0, buf, buflen) != hdr.checksum)
+        goto loadIndex_done;
+
+    if (!__PHYSFS_DirTreeInit(dt, entrylen, case_sensitive, only_usascii,
+                              hdr.entrycount))
+        goto loadIndex_done;
+
+    retval = dirTreeLoadIndexRecords(dt, &hdr, buf + hdr.pathlen,
+                                     buf + buflen, unpack, data);
+
+loadIndex_done:
+    if (!retval)
+    {
+        __PHYSFS_DirTreeDeinit(dt);
+        memset(dt, '\0', sizeof (*dt));
+    } /* if */
+
+    if (buf)
+        allocator.Free(buf);
+    if (path)
+        allocator.Free(path);
+    if (cacheio)
+        cacheio->destroy(cacheio);
+
+    /* a missing or stale cache isn't an error. */
+    PHYSFS_getLastErrorCode();
+    PHYSFS_setErrorCode(err);
+
+    return retval;
+} /* __PHYSFS_DirTreeLoadIndex */
+
+
+/* Lists (dt) in breadth-first order, each directory's children reversed,
+   so rebuilding it by prepending to children lists restores their order. */
+static __PHYSFS_DirTreeEntry **dirTreeIndexOrder(__PHYSFS_DirTree *dt,
+                                                 size_t *datalen,
+                                                 const size_t packlen)
+{
+    const size_t total = dt->entryCount + 1;
+    __PHYSFS_DirTreeEntry **retval;
+    size_t count = 1;
+    size_t i;
+
+    retval = (__PHYSFS_DirTreeEntry **)
+                allocator.Malloc(total * sizeof (*retval));
+    if (!retval)
+        return NULL;
+
+    *datalen = 0;
+    retval[0] = dt->root;
+    for (i = 0; i < count; i++)
+    {
+        const __PHYSFS_DirTreeEntry *child;
+        size_t kids = 0;
+        size_t pos;
+
+        for (child = retval[i]->children; child; child = child->sibling)
+            kids++;
+
+        if (kids > total - count)
         {
-            __PHYSFS_DirTreeEntry *entry;
-            __PHYSFS_DirTreeEntry *next;
-            for (entry = dt->hash[i]; entry; entry = next)
-            {
-                next = entry->hashnext;
-                allocator.Free(entry);
-            } /* for */
+            allocator.Free(retval);  /* shouldn't happen. */
+            return NULL;
+        } /* if */
+
+        pos = count + kids;
+        for (child = retval[i]->children; child; child = child->sibling)
+        {
+            retval[--pos] = (__PHYSFS_DirTreeEntry *) child;
+            *datalen += INDEXCACHE_RECORDLEN + strlen(child->name) + packlen;
         } /* for */
-        allocator.Free(dt->hash);
-    } /* if */
-} /* __PHYSFS_DirTreeDeinit */
+        count += kids;
+    } /* for */
+
+    assert(count == total);
+    return retval;
+} /* dirTreeIndexOrder */
+
+
+void __PHYSFS_DirTreeSaveIndex(__PHYSFS_DirTree *dt, PHYSFS_Io *io,
+                               const char *tag, const size_t packlen,
+                               __PHYSFS_DirTreePackFn pack, void *data)
+{
+    const PHYSFS_ErrorCode err = currentErrorCode();
+    const size_t total = dt->entryCount + 1;
+    __PHYSFS_DirTreeEntry **entries = NULL;
+    PHYSFS_Io *cacheio = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_uint8 *ptr;
+    IndexCacheHeader hdr;
+    size_t datalen = 0;
+    size_t buflen;
+    size_t parentidx;
+    size_t i;
+    size_t tmplen;
+    char *path = NULL;
+    char *tmpname = NULL;
+    char *fname;
+    int okay = 0;
+
+    fname = indexCacheFile(io, tag, &hdr, &path);
+    if (fname == NULL)
+        goto saveIndex_done;
+
+    entries = dirTreeIndexOrder(dt, &datalen, packlen);
+    if (entries == NULL)
+        goto saveIndex_done;
+
+    buflen = hdr.pathlen + datalen;
+    buf = (PHYSFS_uint8 *) allocator.Malloc(buflen ? buflen : 1);
+    if (buf == NULL)
+        goto saveIndex_done;
+
+    memcpy(buf, path, hdr.pathlen);
+    ptr = buf + hdr.pathlen;
+
+    /* each directory's children are a contiguous run in (entries). */
+    i = 1;
+    for (parentidx = 0; parentidx < total; parentidx++)
+    {
+        const __PHYSFS_DirTreeEntry *child;
+        for (child = entries[parentidx]->children; child; child = child->sibling)
+        {
+            const __PHYSFS_DirTreeEntry *entry = entries[i++];
+            const PHYSFS_uint32 namelen = (PHYSFS_uint32) strlen(entry->name);
+            const PHYSFS_uint32 parent32 = (PHYSFS_uint32) parentidx;
+            const PHYSFS_uint32 lenbits = namelen |
+                                    (entry->isdir ? INDEXCACHE_ISDIR : 0);
+            memcpy(ptr, &parent32, 4);
+            memcpy(ptr + 4, &entry->hashval, 4);
+            memcpy(ptr + 8, &lenbits, 4);
+            ptr += INDEXCACHE_RECORDLEN;
+            memcpy(ptr, entry->name, namelen);
+            ptr += namelen;
+            pack(data, entry, ptr);
+            ptr += packlen;
+        } /* for */
+    } /* for */
+
+    assert(ptr == buf + buflen);
+
+    hdr.entrycount = (PHYSFS_uint64) (total - 1);
+    hdr.datalen = (PHYSFS_uint64) datalen;
+    hdr.checksum = indexCacheChecksum(0, buf, buflen);
+    hdr.packlen = (PHYSFS_uint32) packlen;
+    hdr.flags = (dt->case_sensitive ? 1 : 0) | (dt->only_usascii ? 2 : 0);
+
+    /* write it under another name and rename it into place, so readers
+       (maybe in other processes) never see a half-written cache file. The
+       name has the process and thread in it, so no two writers share it. */
+    tmplen = strlen(fname) + 48;
+    tmpname = (char *) allocator.Malloc(tmplen);
+    if (tmpname == NULL)
+        goto saveIndex_done;
+    snprintf(tmpname, tmplen, "%s.%lu.%p.tmp", fname,
+             (unsigned long) __PHYSFS_platformGetProcessID(),
+             __PHYSFS_platformGetThreadID());
+
+    cacheio = __PHYSFS_createNativeIo(tmpname, 'w');
+    if (cacheio == NULL)
+        goto saveIndex_done;
+
+    okay = ( (cacheio->write(cacheio, &hdr, sizeof (hdr)) == sizeof (hdr)) &&
+             (cacheio->write(cacheio, buf, buflen) == (PHYSFS_sint64) buflen) &&
+             (cacheio->flush(cacheio)) );
+
+    cacheio->destroy(cacheio);
+    okay = okay && __PHYSFS_platformRename(tmpname, fname);
+    if (!okay)  /* don't leave a partial file lying around. */
+        __PHYSFS_platformDelete(tmpname);
+
+saveIndex_done:
+    if (tmpname)
+        allocator.Free(tmpname);
+    if (fname)
+        allocator.Free(fname);
+    if (path)
+        allocator.Free(path);
+    if (buf)
+        allocator.Free(buf);
+    if (entries)
+        allocator.Free(entries);
+
+    /* the cache is best-effort, so failing to write it isn't an error. */
+    PHYSFS_getLastErrorCode();
+    PHYSFS_setErrorCode(err);
+} /* __PHYSFS_DirTreeSaveIndex */
 
 /* end of physfs.c ... */
 
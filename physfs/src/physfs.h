@@ -1475,11 +1475,15 @@ PHYSFS_DECL PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle);
  *  from this buffer until it is empty, and then refill it for more reading.
  *  Note that compressed files, like ZIP archives, will decompress while
  *  buffering, so this can be handy for offsetting CPU-intensive operations.
- *  The buffer isn't filled until you do your next read.
+ *  The buffer isn't filled until you do your next read. Reads of at least
+ *  (bufsize) bytes are served from what's left in the buffer, and the rest
+ *  goes straight into your memory, so a small buffer doesn't slow down
+ *  bulk reads.
  *
  * For files opened for writing, data will be buffered to memory until the
- *  buffer is full or the buffer is flushed. Closing a handle implicitly
- *  causes a flush...check your return values!
+ *  buffer is full or the buffer is flushed. Writes of at least (bufsize)
+ *  bytes flush the buffer and then go straight to the file. Closing a handle
+ *  implicitly causes a flush...check your return values!
  *
  * Seeking, etc transparently accounts for buffering.
  *
@@ -3639,7 +3643,10 @@ PHYSFS_DECL const char *PHYSFS_getPrefDir(const char *org, const char *app);
  *  such, your PHYSFS_Archiver can assume that locking is handled for you
  *  so long as the PHYSFS_Io you return from PHYSFS_open* doesn't change any
  *  of your Archiver state, as the PHYSFS_Io won't be as aggressively
- *  protected.
+ *  protected. Note that the locking is per opened archive: calls with the
+ *  same opaque handle never overlap, but two different archives opened by
+ *  your archiver can be searched from two threads at the same time, so any
+ *  static variables you share between them need their own protection.
  *
  * \sa PHYSFS_registerArchiver
  * \sa PHYSFS_deregisterArchiver
@@ -3915,6 +3922,581 @@ PHYSFS_DECL int PHYSFS_setRoot(const char *archive, const char *subdir);
 /* Everything above this line is part of the PhysicsFS 3.1 API. */
 
 
+/**
+ * \fn int PHYSFS_setSearchPathIndex(int enable)
+ * \brief Enable or disable the merged index of the search path.
+ *
+ * Normally, PHYSFS_openRead(), PHYSFS_stat(), PHYSFS_exists() and
+ *  PHYSFS_getRealDir() ask each item in the search path, in order, if it
+ *  has the file you want. With many archives mounted, that's a lot of
+ *  asking, especially for files that don't exist at all.
+ *
+ * With the index enabled, PhysicsFS keeps a single table of every path in
+ *  the mounted archives, mapped to the first archive in the search path
+ *  that provides it. A lookup then costs about the same no matter how many
+ *  archives are mounted. The index is updated as archives are mounted and
+ *  unmounted, and rebuilt when PHYSFS_setRoot() is called.
+ *
+ * Only archives whose contents can't change while mounted are indexed
+ *  (zip, 7z, and most of the other read-only formats). Directories on the
+ *  physical filesystem, and archives that look up names case-insensitively,
+ *  are still searched one at a time, in their proper order, so enabling the
+ *  index never changes which file you get.
+ *
+ * The index costs memory for every path in every indexed archive. If it
+ *  can't be kept up to date (out of memory, etc), PhysicsFS drops it and
+ *  goes back to searching the slow way; PHYSFS_getSearchPathIndex() will
+ *  report this.
+ *
+ * The index is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to build and use the index, zero to drop it.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getSearchPathIndex
+ */
+PHYSFS_DECL int PHYSFS_setSearchPathIndex(int enable);
+
+
+/**
+ * \fn int PHYSFS_getSearchPathIndex(void)
+ * \brief Determine if the search path index is in use.
+ *
+ *   \return nonzero if the index is enabled and up to date, zero otherwise.
+ *
+ * \sa PHYSFS_setSearchPathIndex
+ */
+PHYSFS_DECL int PHYSFS_getSearchPathIndex(void);
+
+
+/**
+ * \fn int PHYSFS_setMissCacheSize(PHYSFS_uint32 entries)
+ * \brief Remember recent lookups of files that don't exist.
+ *
+ * Programs often probe for files that aren't there: optional config files,
+ *  mod overrides, alternate file extensions. Each such probe has to ask
+ *  every item in the search path before PhysicsFS can give up. With the
+ *  miss cache enabled, PHYSFS_openRead(), PHYSFS_stat(), PHYSFS_exists()
+ *  and PHYSFS_getRealDir() remember the last (entries) paths that weren't
+ *  found anywhere, and fail immediately if asked for them again.
+ *
+ * Anything done through PhysicsFS that could make a missing file appear
+ *  (mounting, unmounting, PHYSFS_setWriteDir(), PHYSFS_setRoot(),
+ *  PHYSFS_permitSymbolicLinks(), PHYSFS_mkdir(), opening a file for
+ *  writing) empties the cache. Changes made to physical directories
+ *  behind PhysicsFS's back, however, are not noticed until one of those
+ *  happens. Don't enable this if other programs add files to your
+ *  search path while you're running, or call this function again (which
+ *  always empties the cache) when you know they have.
+ *
+ * The cache is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param entries number of missing paths to remember, zero to disable.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getMissCacheSize
+ */
+PHYSFS_DECL int PHYSFS_setMissCacheSize(PHYSFS_uint32 entries);
+
+
+/**
+ * \fn PHYSFS_uint32 PHYSFS_getMissCacheSize(void)
+ * \brief Determine how many missing paths PhysicsFS will remember.
+ *
+ *   \return the value last given to PHYSFS_setMissCacheSize(), or zero if
+ *           the miss cache is disabled.
+ *
+ * \sa PHYSFS_setMissCacheSize
+ */
+PHYSFS_DECL PHYSFS_uint32 PHYSFS_getMissCacheSize(void);
+
+
+/**
+ * \typedef PHYSFS_EnumerateStatCallback
+ * \brief Possible callback for PHYSFS_enumerateWithStat().
+ *
+ * This is PHYSFS_EnumerateCallback with one more parameter: the metadata
+ *  for (fname), exactly as PHYSFS_stat() would report it for the archive
+ *  that produced this item. It only lives until the callback returns; copy
+ *  out anything you want to keep.
+ *
+ *    \param data User-defined data pointer, passed through from the API
+ *                that eventually called the callback.
+ *    \param origdir A string containing the full path, in platform-independent
+ *                   notation, of the directory containing this file.
+ *    \param fname The filename that is being enumerated, without its path.
+ *    \param stat Metadata for this file.
+ *   \return A value from PHYSFS_EnumerateCallbackResult.
+ *
+ * \sa PHYSFS_enumerateWithStat
+ * \sa PHYSFS_EnumerateCallback
+ */
+typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_EnumerateStatCallback)(
+                                       void *data, const char *origdir,
+                                       const char *fname,
+                                       const PHYSFS_Stat *stat);
+
+/**
+ * \fn int PHYSFS_enumerateWithStat(const char *dir, PHYSFS_EnumerateStatCallback c, void *d)
+ * \brief Enumerate a search path's directory, with metadata for each item.
+ *
+ * This works just like PHYSFS_enumerate(), but the callback gets a
+ *  PHYSFS_Stat for every item, so listing a directory and then asking
+ *  PHYSFS_stat() about each name in it isn't necessary. The metadata comes
+ *  from the archive that is reporting the item, while PhysicsFS is already
+ *  looking at it, instead of from a separate trip through the search path
+ *  for each name.
+ *
+ * Like PHYSFS_enumerate(), you may receive the same filename more than once
+ *  if it exists in several archives. Items come in search path order, so the
+ *  first time you see a name, its metadata is what PHYSFS_stat() would
+ *  return for it.
+ *
+ *    \param dir Directory, in platform-independent notation, to enumerate.
+ *    \param c Callback function to notify about search path elements.
+ *    \param d Application-defined data passed to callback. Can be NULL.
+ *   \return non-zero on success, zero on failure. Error handling is the
+ *           same as PHYSFS_enumerate().
+ *
+ * \sa PHYSFS_EnumerateStatCallback
+ * \sa PHYSFS_enumerate
+ * \sa PHYSFS_stat
+ */
+PHYSFS_DECL int PHYSFS_enumerateWithStat(const char *dir,
+                                         PHYSFS_EnumerateStatCallback c,
+                                         void *d);
+
+
+/**
+ * \enum PHYSFS_WalkFlags
+ * \brief Flags for PHYSFS_walk().
+ *
+ * \sa PHYSFS_walk
+ */
+typedef enum PHYSFS_WalkFlags
+{
+    PHYSFS_WALK_DEPTH_FIRST = 0,  /**< Finish each subdirectory before its siblings. */
+    PHYSFS_WALK_BREADTH_FIRST = (1 << 0)  /**< Report each level before going deeper. */
+} PHYSFS_WalkFlags;
+
+/**
+ * \typedef PHYSFS_WalkCallback
+ * \brief Function signature for callbacks that PHYSFS_walk() uses.
+ *
+ *    \param data User-defined data pointer, passed through from
+ *                PHYSFS_walk().
+ *    \param path Full path of this item, in platform-independent notation,
+ *                relative to the root of the search path (so it can be
+ *                passed straight to PHYSFS_openRead(), etc).
+ *    \param stat Metadata for this item, as PHYSFS_stat() would report it.
+ *   \return A value from PHYSFS_EnumerateCallbackResult. PHYSFS_ENUM_STOP
+ *           ends the whole walk, not just the current directory.
+ *
+ * \sa PHYSFS_walk
+ */
+typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_WalkCallback)(void *data,
+                                       const char *path,
+                                       const PHYSFS_Stat *stat);
+
+/**
+ * \fn int PHYSFS_walk(const char *root, PHYSFS_WalkCallback c, void *d, PHYSFS_uint32 flags)
+ * \brief Visit everything under a search path directory.
+ *
+ * This reports every file, directory and symlink below (root) in the
+ *  interpolated tree, along with its metadata. It does the job of calling
+ *  PHYSFS_enumerate() and PHYSFS_stat() recursively, but works from one
+ *  copy of the search path for the whole walk, instead of setting up a new
+ *  search for every directory and every file.
+ *
+ * Unlike PHYSFS_enumerate(), each path is reported once, even if it exists
+ *  in several archives; the metadata comes from the first archive in the
+ *  search path that has it. Items in each directory are reported in
+ *  alphabetical order. Symlinks are reported (if permitted at all, see
+ *  PHYSFS_permitSymbolicLinks()) but not followed. (root) itself is not
+ *  reported.
+ *
+ * The callback is not called with any internal locks held, so it may use
+ *  the rest of PhysicsFS. Archives that are unmounted during the walk stay
+ *  readable by the walk until it's done; archives that are mounted during
+ *  the walk aren't seen by it.
+ *
+ *    \param root Directory, in platform-independent notation, to walk.
+ *    \param c Callback function to notify about each item.
+ *    \param d Application-defined data passed to callback. Can be NULL.
+ *    \param flags Zero or more PHYSFS_WalkFlags, OR'd together.
+ *   \return non-zero on success, zero on failure. Error handling is the
+ *           same as PHYSFS_enumerate().
+ *
+ * \sa PHYSFS_WalkCallback
+ * \sa PHYSFS_WalkFlags
+ * \sa PHYSFS_enumerateWithStat
+ */
+PHYSFS_DECL int PHYSFS_walk(const char *root, PHYSFS_WalkCallback c,
+                            void *d, PHYSFS_uint32 flags);
+
+
+/**
+ * \fn int PHYSFS_setIndexCacheDir(const char *dir)
+ * \brief Keep parsed archive directories on disk between runs.
+ *
+ * Mounting an archive means reading and parsing its table of contents,
+ *  which takes a while for archives with many thousands of files. With an
+ *  index cache directory set, PhysicsFS saves what it learned from each
+ *  archive it mounts there, and the next time the same archive is mounted,
+ *  even by another process, it loads that instead.
+ *
+ * Cached indexes are keyed by the archive's absolute path, size and
+ *  modification time; if any of those change, the archive is parsed again and the cache
+ *  is rewritten. An archive that's replaced by another of exactly the same
+ *  size within the filesystem's timestamp granularity won't be noticed, so
+ *  don't use this if your archives are rewritten in place. Damaged or
+ *  incomplete cache files are ignored. Only archives mounted from real
+ *  files are cached, not ones mounted from memory or through PHYSFS_Io.
+ *  .zip files (and things PhysicsFS treats like them) and the simple
+ *  formats (GRP, HOG, MVL, PAK, SLB, VDF, WAD, CSM) are cached; 7z and ISO
+ *  images aren't, since caching wouldn't make their mounts faster.
+ *
+ * Files in (dir) are named after a hash of the archive path, so archives
+ *  on different paths don't fight over them. They're written under a
+ *  temporary name and renamed into place, so it's safe for several
+ *  processes to share one directory. Nothing cleans it up, though; old
+ *  cache files for archives you don't mount anymore stay until you delete
+ *  them. You might use your pref dir (see PHYSFS_getPrefDir()) or the
+ *  write dir, but the directory doesn't need to be in the search path.
+ *
+ * The cache is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param dir Existing directory, in platform-dependent notation, for the
+ *              cache files. NULL disables the cache.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getIndexCacheDir
+ */
+PHYSFS_DECL int PHYSFS_setIndexCacheDir(const char *dir);
+
+
+/**
+ * \fn const char *PHYSFS_getIndexCacheDir(void)
+ * \brief Get the directory where parsed archive directories are kept.
+ *
+ *   \return the value last given to PHYSFS_setIndexCacheDir(), or NULL if
+ *           the index cache is disabled. The string is only valid until
+ *           the next call to PHYSFS_setIndexCacheDir().
+ *
+ * \sa PHYSFS_setIndexCacheDir
+ */
+PHYSFS_DECL const char *PHYSFS_getIndexCacheDir(void);
+
+
+/**
+ * \fn int PHYSFS_setArchiveMapping(int enable)
+ * \brief Map archive files into memory instead of reading them.
+ *
+ * With this enabled, archives mounted from real files after the call are
+ *  mapped into the process's address space (mmap() and friends), read-only.
+ *  Reading a file out of such an archive becomes a memory copy instead of a
+ *  system call, and archivers can parse the table of contents in place.
+ *  Archives that are already mounted, directories, and archives mounted
+ *  from memory or through PHYSFS_Io aren't affected. If a file can't be
+ *  mapped, it's read the usual way; that isn't an error.
+ *
+ * The mapping needs as much address space as the archive is large, so think
+ *  twice on 32-bit targets with multi-gigabyte archives. Also, don't use
+ *  this if something might shrink an archive while it's mounted: on most
+ *  platforms, touching a mapped page past the new end of the file crashes
+ *  the process instead of returning an i/o error.
+ *
+ * This is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to map archives mounted from now on, zero to read
+ *                 them through a file handle.
+ *  \return nonzero on success, zero on failure. Enabling fails with
+ *          PHYSFS_ERR_UNSUPPORTED on platforms that can't map files.
+ *
+ * \sa PHYSFS_getArchiveMapping
+ */
+PHYSFS_DECL int PHYSFS_setArchiveMapping(int enable);
+
+
+/**
+ * \fn int PHYSFS_getArchiveMapping(void)
+ * \brief Determine if newly-mounted archives are mapped into memory.
+ *
+ *   \return nonzero if PHYSFS_setArchiveMapping() enabled it, zero if not.
+ *
+ * \sa PHYSFS_setArchiveMapping
+ */
+PHYSFS_DECL int PHYSFS_getArchiveMapping(void);
+
+
+/**
+ * \fn const void *PHYSFS_mapFile(PHYSFS_File *handle, PHYSFS_uint64 *len)
+ * \brief Get a file's whole contents without copying them, if possible.
+ *
+ * Some files are already sitting in memory, contiguous and uncompressed:
+ *  files in an archive mounted with PHYSFS_mountMemory(), or with
+ *  PHYSFS_setArchiveMapping() enabled, that the archive stores without
+ *  compression (uncompressed .zip entries, and everything in .grp, .wad and
+ *  similar formats). For those, this returns a pointer straight into that
+ *  memory. For anything else, it reads the file into a buffer it allocates,
+ *  so it always works, it's just not always free.
+ *
+ * The data is the whole file, wherever the file position is, and this
+ *  doesn't move the file position. It's read-only, even when it happens to
+ *  be a copy. It stays valid until PHYSFS_unmapFile() or PHYSFS_close() is
+ *  called on (handle). Calling this again before then returns the same
+ *  pointer; it doesn't stack.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param len On success, the length of the data in bytes.
+ *  \return pointer to the file's contents, or NULL on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_unmapFile
+ */
+PHYSFS_DECL const void *PHYSFS_mapFile(PHYSFS_File *handle,
+                                       PHYSFS_uint64 *len);
+
+
+/**
+ * \fn int PHYSFS_unmapFile(PHYSFS_File *handle)
+ * \brief Let go of the data PHYSFS_mapFile() returned.
+ *
+ * Frees the copy, if PHYSFS_mapFile() had to make one. The pointer it
+ *  returned must not be used after this. The file stays open.
+ *
+ *   \param handle handle previously passed to PHYSFS_mapFile().
+ *  \return nonzero on success, zero if (handle) wasn't mapped.
+ *
+ * \sa PHYSFS_mapFile
+ */
+PHYSFS_DECL int PHYSFS_unmapFile(PHYSFS_File *handle);
+
+
+/**
+ * \fn int PHYSFS_setDefaultBuffer(PHYSFS_uint64 bufsize)
+ * \brief Give files opened for reading a buffer without asking.
+ *
+ * Every file PHYSFS_openRead() opens after this call gets a buffer of
+ *  (bufsize) bytes, as if you'd called PHYSFS_setBuffer() on it yourself,
+ *  which you can still do to change it. This saves guessing buffer sizes
+ *  file by file, and it makes lots of small reads, like reading a file one
+ *  integer at a time, much cheaper. Files opened for writing or appending
+ *  stay unbuffered, so what you write still reaches the disk right away.
+ *
+ * Files are unbuffered by default, and PHYSFS_deinit() goes back to that.
+ *
+ *   \param bufsize size, in bytes, of the buffer each new file gets. Zero
+ *                  leaves new files unbuffered.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getDefaultBuffer
+ * \sa PHYSFS_setAdaptiveBuffer
+ * \sa PHYSFS_setBuffer
+ */
+PHYSFS_DECL int PHYSFS_setDefaultBuffer(PHYSFS_uint64 bufsize);
+
+
+/**
+ * \fn PHYSFS_uint64 PHYSFS_getDefaultBuffer(void)
+ * \brief Get the buffer size files opened for reading start out with.
+ *
+ *   \return the value last given to PHYSFS_setDefaultBuffer(), or zero if
+ *           new files are unbuffered.
+ *
+ * \sa PHYSFS_setDefaultBuffer
+ */
+PHYSFS_DECL PHYSFS_uint64 PHYSFS_getDefaultBuffer(void);
+
+
+/**
+ * \fn int PHYSFS_setAdaptiveBuffer(int enable)
+ * \brief Let read buffers adapt to how each file is being read.
+ *
+ * A big buffer is great for reading a file from start to end, and a waste
+ *  for jumping around in it: every seek out of the buffer throws away what
+ *  was read ahead. With this enabled, files opened for reading after the
+ *  call treat their buffer size (from PHYSFS_setBuffer() or
+ *  PHYSFS_setDefaultBuffer()) as a limit instead. They start out reading a
+ *  little at a time, read twice as much each time they've read through the
+ *  buffer without seeking, up to the limit, and half as much after each seek
+ *  that leaves the buffer. Reads at least as big as what the buffer reads at
+ *  the moment skip it entirely.
+ *
+ * This is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to adapt buffers of files opened from now on, zero
+ *                 to always fill them completely.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getAdaptiveBuffer
+ * \sa PHYSFS_setDefaultBuffer
+ */
+PHYSFS_DECL int PHYSFS_setAdaptiveBuffer(int enable);
+
+
+/**
+ * \fn int PHYSFS_getAdaptiveBuffer(void)
+ * \brief Determine if newly-opened files adapt their read buffers.
+ *
+ *   \return nonzero if PHYSFS_setAdaptiveBuffer() enabled it, zero if not.
+ *
+ * \sa PHYSFS_setAdaptiveBuffer
+ */
+PHYSFS_DECL int PHYSFS_getAdaptiveBuffer(void);
+
+
+/**
+ * \fn int PHYSFS_setSeekCheckpoints(PHYSFS_uint64 interval)
+ * \brief Make seeking in compressed archive files cheaper.
+ *
+ * A compressed file can't be entered in the middle: seeking in one means
+ *  decompressing everything between where the file is and where you want
+ *  to be, or from the start of the file if you seek backwards. That's slow
+ *  for big files that are read out of order, like a packed file of game
+ *  assets or a video.
+ *
+ * With this set, archives mounted after the call save the decompressor's
+ *  state every (interval) bytes while their files are read. Seeking goes
+ *  to the closest saved point before the target and decompresses at most
+ *  (interval) bytes from there. Checkpoints are saved as the file is read
+ *  or seeked through, so the first trip through a file costs as much as it
+ *  always did; seek to the end of a file once, if you want all of them up
+ *  front. They are shared by every handle open on the same file, and are
+ *  kept until the archive is unmounted.
+ *
+ * Each checkpoint costs about 44 kilobytes, so don't make (interval) too
+ *  small: a megabyte or so is a reasonable start. Currently this only
+ *  affects deflated files in .zip archives (and things PhysicsFS treats
+ *  like them), and not encrypted ones.
+ *
+ * This is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param interval uncompressed bytes between checkpoints. Zero disables
+ *                   them for archives mounted from now on.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getSeekCheckpoints
+ * \sa PHYSFS_seek
+ */
+PHYSFS_DECL int PHYSFS_setSeekCheckpoints(PHYSFS_uint64 interval);
+
+
+/**
+ * \fn PHYSFS_uint64 PHYSFS_getSeekCheckpoints(void)
+ * \brief Get the distance between seek checkpoints in new archives.
+ *
+ *   \return the value last given to PHYSFS_setSeekCheckpoints(), or zero
+ *           if newly-mounted archives don't save checkpoints.
+ *
+ * \sa PHYSFS_setSeekCheckpoints
+ */
+PHYSFS_DECL PHYSFS_uint64 PHYSFS_getSeekCheckpoints(void);
+
+
+/**
+ * \fn int PHYSFS_setInflaterPool(PHYSFS_uint32 count)
+ * \brief Reuse decompressors instead of making one for every file.
+ *
+ * Every compressed file opened from an archive gets a read buffer and a
+ *  decompressor, which together are around 60 kilobytes of allocations,
+ *  and frees them when it's closed. That's a real share of the work of
+ *  loading thousands of small compressed files.
+ *
+ * With this set, archives mounted after the call keep the buffers and
+ *  decompressors of up to (count) closed files, and reset them for the next
+ *  files opened, instead of freeing them and allocating new ones. They're
+ *  freed when the archive is unmounted. A handful is enough unless you keep
+ *  many files open from one archive at once. Currently this only affects
+ *  .zip archives (and things PhysicsFS treats like them).
+ *
+ * This is disabled by default, and is disabled by PHYSFS_deinit().
+ *
+ *   \param count decompressors each newly-mounted archive keeps around.
+ *                Zero disables the pool for archives mounted from now on.
+ *  \return nonzero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getInflaterPool
+ */
+PHYSFS_DECL int PHYSFS_setInflaterPool(PHYSFS_uint32 count);
+
+
+/**
+ * \fn PHYSFS_uint32 PHYSFS_getInflaterPool(void)
+ * \brief Get how many decompressors newly-mounted archives keep around.
+ *
+ *   \return the value last given to PHYSFS_setInflaterPool(), or zero if
+ *           newly-mounted archives don't keep any.
+ *
+ * \sa PHYSFS_setInflaterPool
+ */
+PHYSFS_DECL PHYSFS_uint32 PHYSFS_getInflaterPool(void);
+
+
+/**
+ * \struct PHYSFS_BulkLoad
+ * \brief One file for PHYSFS_loadFiles() to read.
+ *
+ * Fill in (fname) and leave the rest zeroed; PHYSFS_loadFiles() fills in
+ *  the rest. If the file loaded, (buffer) holds all (size) bytes of it and
+ *  (error) is PHYSFS_ERR_OK. Free (buffer) with the Free method of
+ *  PHYSFS_getAllocator() when you're done with it. If the file didn't
+ *  load, (buffer) is NULL and (error) says why.
+ *
+ * \sa PHYSFS_loadFiles
+ */
+typedef struct PHYSFS_BulkLoad
+{
+    const char *fname;  /**< file to read, platform-independent notation. */
+    void *buffer;  /**< the whole file, or NULL if it couldn't be read. */
+    PHYSFS_uint64 size;  /**< bytes in (buffer). */
+    PHYSFS_ErrorCode error;  /**< why the file couldn't be read. */
+} PHYSFS_BulkLoad;
+
+
+/**
+ * \fn int PHYSFS_loadFiles(PHYSFS_BulkLoad *files, PHYSFS_uint32 count, PHYSFS_uint32 threads)
+ * \brief Read many whole files at once, on several threads.
+ *
+ * Loading a level usually means opening hundreds of files and reading each
+ *  of them to the end, which for compressed archives is mostly time spent
+ *  decompressing, one file after another on a single core. This reads all
+ *  of (files) into memory, handing them out to up to (threads) threads (the
+ *  calling thread being one of them), and returns when they're all done.
+ *
+ * Files from different archives, files in .zip archives, and files in
+ *  different blocks of .7z archives are decompressed in parallel. A .7z
+ *  block is decompressed only once for all the files in it; threads that
+ *  want it while that's happening wait for it.
+ *
+ * At most 16 threads are used, however many are asked for, and never more
+ *  than there are files. If (threads) is 0 or 1, or the platform can't
+ *  start threads, the files are all read on the calling thread.
+ *
+ * Don't change the search path while this runs.
+ *
+ *   \param files files to read. See PHYSFS_BulkLoad.
+ *   \param count number of elements in (files).
+ *   \param threads most threads to read files on, up to 16.
+ *  \return nonzero if every file was read, zero if any of them wasn't. On
+ *          failure, PHYSFS_getLastErrorCode() gives the error of the first
+ *          file that failed, and each file's (error) says what happened to
+ *          it.
+ *
+ * \sa PHYSFS_BulkLoad
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL int PHYSFS_loadFiles(PHYSFS_BulkLoad *files, PHYSFS_uint32 count,
+                                 PHYSFS_uint32 threads);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,12 +27,54 @@ typedef struct
     PHYSFS_uint32 dbidx;          /* index into lzma sdk database   */
 } SZIPentry;
 
+/*
+ * Files in a 7zip archive are compressed together in blocks ("folders" in
+ *  the lzma sdk), which can only be decompressed whole. To keep opening
+ *  every file of a solid archive from decompressing its block all over
+ *  again, the last few blocks used are kept around, and files opened from
+ *  them point into the block instead of getting a copy of their own.
+ *
+ * Opening a file only finds or adds its block. The first read from any
+ *  file in the block decompresses it, which happens without the archive
+ *  locked, so different blocks can be decompressed on different threads.
+ *  A block's own lock is held while it's decompressed; a reader that finds
+ *  it SZIP_BLOCK_DECODING waits on that lock instead of decompressing it a
+ *  second time. SZIPinfo's lock guards the cache list, the refcounts and
+ *  the states; code that needs both takes the block's lock first.
+ *
+ * The cache holds at most SZIP_CACHED_BLOCKS blocks, and blocks no file is
+ *  using hold at most SZIP_CACHED_BYTES between them, so one small file
+ *  read out of a huge solid block doesn't keep the whole block around after
+ *  it's closed. A block pushed out of the cache stays alive until the last
+ *  file pointing into it is closed.
+ */
+#define SZIP_CACHED_BLOCKS 4
+#define SZIP_CACHED_BYTES (32 * 1024 * 1024)
+
+#define SZIP_BLOCK_EMPTY 0      /* not decompressed (yet, or it failed). */
+#define SZIP_BLOCK_DECODING 1   /* somebody holds (lock) and is on it. */
+#define SZIP_BLOCK_READY 2      /* (buf) has the whole block. */
+
+typedef struct SZIPblock
+{
+    UInt32 index;                 /* block index in lzma sdk database */
+    Byte *buf;                    /* decompressed block               */
+    size_t size;                  /* bytes in (buf)                   */
+    void *lock;                   /* held while decompressing         */
+    int state;                    /* SZIP_BLOCK_*                     */
+    PHYSFS_uint32 refcount;       /* open files using this block      */
+    int cached;                   /* still in SZIPinfo's cache?       */
+    struct SZIPblock *next;       /* next most recently used block    */
+} SZIPblock;
+
 /* One SZIPinfo is kept for each open 7zip archive. */
 typedef struct
 {
     __PHYSFS_DirTree tree;    /* manages directory tree.           */
     PHYSFS_Io *io;            /* physfs i/o interface for this archive. */
     CSzArEx db;               /* lzma sdk archive database object. */
+    void *lock;               /* guards (blocks) and (io)'s duplicates. */
+    SZIPblock *blocks;        /* cached blocks, most recently used first. */
 } SZIPinfo;
 
 
@@ -185,9 +227,10 @@ static int szipLoadEntries(SZIPinfo *info)
 {
     int retval = 0;
 
-    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0))
+    const PHYSFS_uint32 count = info->db.NumFiles;
+
+    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0, count))
     {
-        const PHYSFS_uint32 count = info->db.NumFiles;
         PHYSFS_uint32 i;
         for (i = 0; i < count; i++)
             BAIL_IF_ERRPASS(!szipLoadEntry(info, i), 0);
@@ -198,11 +241,406 @@ static int szipLoadEntries(SZIPinfo *info)
 } /* szipLoadEntries */
 
 
+/* Duplicate the archive's Io; reads can do this from any thread. */
+static PHYSFS_Io *szipDuplicateIo(SZIPinfo *info)
+{
+    PHYSFS_Io *retval;
+    __PHYSFS_platformGrabMutex(info->lock);
+    retval = info->io->duplicate(info->io);
+    __PHYSFS_platformReleaseMutex(info->lock);
+    return retval;
+} /* szipDuplicateIo */
+
+
+static void szipFreeBlock(SZIPblock *block)
+{
+    SZIP_SzAlloc.Free(&SZIP_SzAlloc, block->buf);
+    __PHYSFS_platformDestroyMutex(block->lock);
+    allocator.Free(block);
+} /* szipFreeBlock */
+
+
+/*
+ * Push blocks out of the cache, least recently used first, until it's
+ *  within SZIP_CACHED_BLOCKS and SZIP_CACHED_BYTES. Unused blocks are freed
+ *  right away, the rest when their last file is closed.
+ * MAKE SURE you hold info->lock before calling this!
+ */
+static void szipTrimCache(SZIPinfo *info)
+{
+    SZIPblock **prev = &info->blocks;
+    size_t unused = 0;
+    int count = 0;
+
+    while (*prev != NULL)
+    {
+        SZIPblock *block = *prev;
+        int evict = (++count > SZIP_CACHED_BLOCKS);
+
+        if ((!evict) && (block->refcount == 0))
+        {
+            unused += block->size;  /* zero unless it's decompressed. */
+            evict = (unused > SZIP_CACHED_BYTES);
+        } /* if */
+
+        if (!evict)
+            prev = &block->next;
+        else
+        {
+            *prev = block->next;
+            block->cached = 0;
+            count--;
+            if (block->refcount == 0)
+            {
+                unused -= block->size;
+                szipFreeBlock(block);
+            } /* if */
+        } /* else */
+    } /* while */
+} /* szipTrimCache */
+
+
+/* Drop a file's reference to (block). */
+static void szipReleaseBlock(SZIPinfo *info, SZIPblock *block)
+{
+    __PHYSFS_platformGrabMutex(info->lock);
+    assert(block->refcount > 0);
+    if (--block->refcount == 0)
+    {
+        if (!block->cached)
+            szipFreeBlock(block);
+        else
+            szipTrimCache(info);  /* it might be over the byte limit now. */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(info->lock);
+} /* szipReleaseBlock */
+
+
+/*
+ * Find block (index) in the cache, and make it the most recently used.
+ * MAKE SURE you hold info->lock before calling this!
+ */
+static SZIPblock *szipFindBlock(SZIPinfo *info, const UInt32 index)
+{
+    SZIPblock **prev = &info->blocks;
+    SZIPblock *block;
+
+    for (block = info->blocks; block != NULL; block = block->next)
+    {
+        if (block->index == index)
+        {
+            *prev = block->next;  /* move it to the front. */
+            block->next = info->blocks;
+            info->blocks = block;
+            return block;
+        } /* if */
+        prev = &block->next;
+    } /* for */
+
+    return NULL;
+} /* szipFindBlock */
+
+
+/*
+ * Add a block for (index) to the cache, to be decompressed later.
+ * MAKE SURE you hold info->lock before calling this!
+ */
+static SZIPblock *szipAddBlock(SZIPinfo *info, const UInt32 index)
+{
+    SZIPblock *block = (SZIPblock *) allocator.Malloc(sizeof (SZIPblock));
+
+    BAIL_IF(!block, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(block, '\0', sizeof (*block));
+    block->index = index;
+    block->state = SZIP_BLOCK_EMPTY;
+    block->lock = __PHYSFS_platformCreateMutex();
+    if (!block->lock)
+    {
+        allocator.Free(block);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    block->cached = 1;
+    block->next = info->blocks;
+    info->blocks = block;
+    szipTrimCache(info);  /* push the least recently used block out. */
+
+    return block;
+} /* szipAddBlock */
+
+
+/*
+ * Make sure (block) is decompressed, decompressing it through file (dbidx)
+ *  if nobody has yet, or waiting for whoever is doing it now.
+ */
+static int szipDecodeBlock(SZIPinfo *info, SZIPblock *block,
+                           const PHYSFS_uint32 dbidx)
+{
+    PHYSFS_ErrorCode err = PHYSFS_ERR_OK;
+    SZIPLookToRead stream;
+    PHYSFS_Io *io;
+    UInt32 index;
+    Byte *buf = NULL;
+    size_t bufsize = 0;
+    size_t offset, size;
+    SRes rc;
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    if (block->state == SZIP_BLOCK_READY)
+    {
+        __PHYSFS_platformReleaseMutex(info->lock);
+        return 1;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    /* if it's DECODING, this waits for whoever is on it. */
+    __PHYSFS_platformGrabMutex(block->lock);
+    __PHYSFS_platformGrabMutex(info->lock);
+    if (block->state == SZIP_BLOCK_READY)
+    {
+        __PHYSFS_platformReleaseMutex(info->lock);
+        __PHYSFS_platformReleaseMutex(block->lock);
+        return 1;
+    } /* if */
+    assert(block->state == SZIP_BLOCK_EMPTY);
+    block->state = SZIP_BLOCK_DECODING;
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    index = block->index;
+    io = szipDuplicateIo(info);
+    if (io == NULL)
+        err = PHYSFS_getLastErrorCode();  /* set it again once we're done. */
+    else
+    {
+        szipInitStream(&stream, io);
+        rc = SzArEx_Extract(&info->db, &stream.lookStream.s, dbidx, &index,
+                            &buf, &bufsize, &offset, &size,
+                            &SZIP_SzAlloc, &SZIP_SzAlloc);
+        io->destroy(io);
+        if (rc != SZ_OK)
+            err = szipErrorCode(rc);
+    } /* else */
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    if (err == PHYSFS_ERR_OK)
+    {
+        assert(index == block->index);
+        block->buf = buf;
+        block->size = bufsize;
+        block->state = SZIP_BLOCK_READY;
+    } /* if */
+    else
+    {
+        SZIP_SzAlloc.Free(&SZIP_SzAlloc, buf);
+        block->state = SZIP_BLOCK_EMPTY;  /* the next reader tries again. */
+    } /* else */
+    __PHYSFS_platformReleaseMutex(info->lock);
+    __PHYSFS_platformReleaseMutex(block->lock);
+
+    BAIL_IF(err != PHYSFS_ERR_OK, err, 0);
+    return 1;
+} /* szipDecodeBlock */
+
+
+/* A file that's read out of a whole decompressed block. */
+typedef struct
+{
+    SZIPinfo *info;               /* archive this file is in          */
+    SZIPblock *block;             /* block this file is in            */
+    PHYSFS_uint32 dbidx;          /* index into lzma sdk database     */
+    const Byte *data;             /* file in (block), NULL until read */
+    PHYSFS_uint64 size;           /* bytes in the file                */
+    PHYSFS_uint64 pos;            /* where the next read starts       */
+} SZIPfile;
+
+
+/* Point (f) at its data, decompressing its block if needed. */
+static int szipFileLoad(SZIPfile *f)
+{
+    SZIPblock *block = f->block;
+    UInt32 index;
+    Byte *buf;
+    size_t bufsize;
+    size_t offset = 0;
+    size_t size = 0;
+    SRes rc;
+
+    BAIL_IF_ERRPASS(!szipDecodeBlock(f->info, block, f->dbidx), 0);
+
+    /* ready blocks don't change anymore, so this needs no lock. It just
+       finds and checks the file; the stream is never touched. */
+    index = block->index;
+    buf = block->buf;
+    bufsize = block->size;
+    rc = SzArEx_Extract(&f->info->db, NULL, f->dbidx, &index, &buf, &bufsize,
+                        &offset, &size, &SZIP_SzAlloc, &SZIP_SzAlloc);
+    BAIL_IF(rc != SZ_OK, szipErrorCode(rc), 0);
+    assert(size == f->size);
+
+    f->data = buf + offset;
+    return 1;
+} /* szipFileLoad */
+
+
+static PHYSFS_sint64 SZIP_file_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    SZIPfile *f = (SZIPfile *) io->opaque;
+
+    if (len > f->size - f->pos)
+        len = f->size - f->pos;
+    if (len == 0)
+        return 0;
+
+    if (f->data == NULL)
+        BAIL_IF_ERRPASS(!szipFileLoad(f), -1);
+
+    memcpy(buf, f->data + f->pos, (size_t) len);
+    f->pos += len;
+    return (PHYSFS_sint64) len;
+} /* SZIP_file_read */
+
+
+static PHYSFS_sint64 SZIP_file_write(PHYSFS_Io *io, const void *b,
+                                     PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, -1);
+} /* SZIP_file_write */
+
+
+static int SZIP_file_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPfile *f = (SZIPfile *) io->opaque;
+    BAIL_IF(offset > f->size, PHYSFS_ERR_PAST_EOF, 0);
+    f->pos = offset;
+    return 1;
+} /* SZIP_file_seek */
+
+
+static PHYSFS_sint64 SZIP_file_tell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPfile *) io->opaque)->pos;
+} /* SZIP_file_tell */
+
+
+static PHYSFS_sint64 SZIP_file_length(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPfile *) io->opaque)->size;
+} /* SZIP_file_length */
+
+
+static PHYSFS_Io *szipOpenFile(SZIPinfo *info, SZIPblock *block,
+                               const PHYSFS_uint32 dbidx, const Byte *data);
+
+static PHYSFS_Io *SZIP_file_duplicate(PHYSFS_Io *io)
+{
+    const SZIPfile *f = (SZIPfile *) io->opaque;
+    PHYSFS_Io *retval;
+
+    __PHYSFS_platformGrabMutex(f->info->lock);
+    f->block->refcount++;
+    __PHYSFS_platformReleaseMutex(f->info->lock);
+
+    retval = szipOpenFile(f->info, f->block, f->dbidx, f->data);
+    if (!retval)
+        szipReleaseBlock(f->info, f->block);
+    return retval;
+} /* SZIP_file_duplicate */
+
+
+static int SZIP_file_flush(PHYSFS_Io *io) { return 1;  /* read-only. */ }
+
+
+static void SZIP_file_destroy(PHYSFS_Io *io)
+{
+    SZIPfile *f = (SZIPfile *) io->opaque;
+    szipReleaseBlock(f->info, f->block);
+    allocator.Free(f);
+    allocator.Free(io);
+} /* SZIP_file_destroy */
+
+
+static const PHYSFS_Io SZIP_fileIo =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_file_read,
+    SZIP_file_write,
+    SZIP_file_seek,
+    SZIP_file_tell,
+    SZIP_file_length,
+    SZIP_file_duplicate,
+    SZIP_file_flush,
+    SZIP_file_destroy
+};
+
+
+/* Make an Io for file (dbidx); it takes over a reference to (block). */
+static PHYSFS_Io *szipOpenFile(SZIPinfo *info, SZIPblock *block,
+                               const PHYSFS_uint32 dbidx, const Byte *data)
+{
+    PHYSFS_Io *retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    SZIPfile *f = (SZIPfile *) allocator.Malloc(sizeof (SZIPfile));
+
+    if ((!retval) || (!f))
+    {
+        if (retval)
+            allocator.Free(retval);
+        if (f)
+            allocator.Free(f);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    f->info = info;
+    f->block = block;
+    f->dbidx = dbidx;
+    f->data = data;
+    f->size = SzArEx_GetFileSize(&info->db, dbidx);
+    f->pos = 0;
+
+    memcpy(retval, &SZIP_fileIo, sizeof (*retval));
+    retval->opaque = f;
+    return retval;
+} /* szipOpenFile */
+
+
+const PHYSFS_uint8 *SZIP_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    SZIPfile *f;
+
+    if (io->read != SZIP_file_read)
+        return NULL;
+
+    /* it's all going to be read anyhow, so decompress it now. */
+    f = (SZIPfile *) io->opaque;
+    if (f->data == NULL)
+    {
+        const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+        const int rc = szipFileLoad(f);
+        PHYSFS_getLastErrorCode();
+        PHYSFS_setErrorCode(err);
+        if (!rc)
+            return NULL;
+    } /* if */
+
+    *len = f->size;
+    return f->data;
+} /* SZIP_ioMemory */
+
+
 static void SZIP_closeArchive(void *opaque)
 {
     SZIPinfo *info = (SZIPinfo *) opaque;
     if (info)
     {
+        while (info->blocks)
+        {
+            SZIPblock *next = info->blocks->next;
+            assert(info->blocks->refcount == 0);  /* no files are open. */
+            szipFreeBlock(info->blocks);
+            info->blocks = next;
+        } /* while */
+
+        if (info->lock)
+            __PHYSFS_platformDestroyMutex(info->lock);
         if (info->io)
             info->io->destroy(info->io);
         SzArEx_Free(&info->db, &SZIP_SzAlloc);
@@ -236,6 +674,9 @@ static void *SZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     SzArEx_Init(&info->db);
 
+    info->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF(!info->lock, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+
     info->io = io;
 
     szipInitStream(&stream, io);
@@ -253,68 +694,397 @@ failed:
 } /* SZIP_openArchive */
 
 
-static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+/*
+ * A file bigger than this isn't worth keeping its whole block around for,
+ *  and shouldn't have to wait for all of the block to decompress before
+ *  its first byte can be read. If its block is compressed with a single
+ *  LZMA, LZMA2 or Copy coder (no filters), it's decompressed as it's read
+ *  instead, through a window the size of the LZMA dictionary. Seeking
+ *  backwards starts over from the start of the block. Smaller files still
+ *  decompress and cache their whole block, so reading every file in a big
+ *  solid block doesn't decompress the start of it over and over.
+ */
+#define SZIP_STREAM_FILE_SIZE (8 * 1024 * 1024)
+
+typedef struct
+{
+    SZIPinfo *info;               /* archive this file is in          */
+    PHYSFS_uint32 dbidx;          /* index into lzma sdk database     */
+    SZIPLookToRead stream;        /* reads the packed block           */
+    UInt32 method;                /* k_LZMA, k_LZMA2 or k_Copy        */
+    CLzma2Dec dec;                /* LZMA only uses (dec.decoder)     */
+    UInt64 packstart;             /* archive offset of packed block   */
+    UInt64 packsize;              /* bytes in packed block            */
+    UInt64 packleft;              /* packed bytes not read yet        */
+    UInt64 blocksize;             /* bytes in decompressed block      */
+    UInt64 blockpos;              /* decompressed bytes produced      */
+    UInt64 filestart;             /* file's offset in the block       */
+    UInt64 filesize;              /* bytes in the file                */
+    UInt64 pos;                   /* where the next read starts       */
+    UInt64 crcpos;                /* bytes (crc) covers, from start   */
+    UInt32 crc;                   /* running CRC of the file          */
+    int failed;                   /* start over before the next read? */
+} SZIPstream;
+
+
+/* Fill (folder) and return non-zero if file (dbidx) can be streamed. */
+static int szipCanStream(SZIPinfo *info, const PHYSFS_uint32 dbidx,
+                         CSzFolder *folder)
 {
-    /* !!! FIXME: the current lzma sdk C API only allows you to decompress
-       !!! FIXME:  the entire file at once, which isn't ideal. Fix this in the
-       !!! FIXME:  SDK and then convert this all to a streaming interface. */
+    const CSzAr *db = &info->db.db;
+    const UInt32 index = info->db.FileToFolder[dbidx];
+    UInt32 method;
+    CSzData sd;
+
+    if (SzArEx_GetFileSize(&info->db, dbidx) <= SZIP_STREAM_FILE_SIZE)
+        return 0;
+
+    sd.Data = db->CodersData + db->FoCodersOffsets[index];
+    sd.Size = db->FoCodersOffsets[index + 1] - db->FoCodersOffsets[index];
+    if ((SzGetNextFolderItem(folder, &sd) != SZ_OK) || (sd.Size != 0))
+        return 0;
+    else if ((folder->NumCoders != 1) || (folder->NumPackStreams != 1))
+        return 0;
+    else if (folder->Coders[0].NumStreams != 1)
+        return 0;
+
+    method = folder->Coders[0].MethodID;
+    return ((method == k_Copy) || (method == k_LZMA) || (method == k_LZMA2));
+} /* szipCanStream */
+
+
+/* Rewind (s) to the start of its block. */
+static int szipStreamRestart(SZIPstream *s)
+{
+    SRes rc = LookInStream_SeekTo(&s->stream.lookStream.s, s->packstart);
+    BAIL_IF(rc != SZ_OK, szipErrorCode(rc), 0);
+
+    if (s->method == k_LZMA2)
+        Lzma2Dec_Init(&s->dec);
+    else if (s->method == k_LZMA)
+        LzmaDec_Init(&s->dec.decoder);
+
+    s->dec.decoder.dicPos = 0;
+    s->packleft = s->packsize;
+    s->blockpos = 0;
+    s->failed = 0;
+    return 1;
+} /* szipStreamRestart */
 
-    SZIPinfo *info = (SZIPinfo *) opaque;
-    SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
-    ISzAlloc *alloc = &SZIP_SzAlloc;
-    SZIPLookToRead stream;
-    PHYSFS_Io *retval = NULL;
-    PHYSFS_Io *io = NULL;
-    UInt32 blockIndex = 0xFFFFFFFF;
-    Byte *outBuffer = NULL;
-    size_t outBufferSize = 0;
-    size_t offset = 0;
-    size_t outSizeProcessed = 0;
-    void *buf = NULL;
-    SRes rc;
 
-    BAIL_IF_ERRPASS(!entry, NULL);
-    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
+/*
+ * Decompress up to (len) more bytes of the block into (buf), or throw them
+ *  away if (buf) is NULL. Returns the number of bytes decompressed, or -1.
+ */
+static PHYSFS_sint64 szipStreamDecode(SZIPstream *s, Byte *buf, size_t len)
+{
+    ILookInStream *in = &s->stream.lookStream.s;
+    CLzmaDec *dec = &s->dec.decoder;
+    PHYSFS_sint64 retval = 0;
 
-    io = info->io->duplicate(info->io);
-    GOTO_IF_ERRPASS(!io, SZIP_openRead_failed);
+    if (len > s->blocksize - s->blockpos)
+        len = (size_t) (s->blocksize - s->blockpos);
 
-    szipInitStream(&stream, io);
+    while (len > 0)
+    {
+        const void *inbuf = NULL;
+        size_t avail = LookToRead_BUF_SIZE;
+        size_t used;
+        size_t produced;
+        SRes rc;
+
+        if (avail > s->packleft)
+            avail = (size_t) s->packleft;
+
+        rc = in->Look(in, &inbuf, &avail);
+        if (rc == SZ_OK)
+        {
+            if (s->method == k_Copy)
+            {
+                produced = used = (avail < len) ? avail : len;
+                if (used == 0)
+                    rc = SZ_ERROR_INPUT_EOF;
+                else if (buf != NULL)
+                    memcpy(buf, inbuf, used);
+            } /* if */
+            else
+            {
+                const SizeT dicpos = (dec->dicPos == dec->dicBufSize) ? 0 : dec->dicPos;
+                SizeT limit = dec->dicBufSize - dicpos;
+                SizeT inlen = avail;
+                ELzmaStatus status;
+
+                if (limit > len)
+                    limit = len;
+
+                dec->dicPos = dicpos;
+                if (s->method == k_LZMA2)
+                    rc = Lzma2Dec_DecodeToDic(&s->dec, dicpos + limit, inbuf, &inlen, LZMA_FINISH_ANY, &status);
+                else
+                    rc = LzmaDec_DecodeToDic(dec, dicpos + limit, inbuf, &inlen, LZMA_FINISH_ANY, &status);
+
+                used = inlen;
+                produced = dec->dicPos - dicpos;
+                if (buf != NULL)
+                    memcpy(buf, dec->dic + dicpos, produced);
+                if ((rc == SZ_OK) && (produced == 0) && (used == 0))
+                    rc = SZ_ERROR_DATA;  /* not getting anywhere. */
+            } /* else */
+
+            in->Skip(in, used);
+            s->packleft -= used;
+        } /* if */
+
+        if (rc != SZ_OK)
+        {
+            s->failed = 1;
+            BAIL(szipErrorCode(rc), -1);
+        } /* if */
+
+        if (buf != NULL)
+            buf += produced;
+        len -= produced;
+        s->blockpos += produced;
+        retval += produced;
+    } /* while */
 
-    rc = SzArEx_Extract(&info->db, &stream.lookStream.s, entry->dbidx,
-                        &blockIndex, &outBuffer, &outBufferSize, &offset,
-                        &outSizeProcessed, alloc, alloc);
-    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), SZIP_openRead_failed);
-    GOTO_IF(outBuffer == NULL, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openRead_failed);
+    return retval;
+} /* szipStreamDecode */
 
-    io->destroy(io);
-    io = NULL;
 
-    buf = allocator.Malloc(outSizeProcessed ? outSizeProcessed : 1);
-    GOTO_IF(buf == NULL, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openRead_failed);
+static PHYSFS_sint64 SZIP_stream_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    const UInt64 target = s->filestart + s->pos;
+    PHYSFS_sint64 rc;
 
-    if (outSizeProcessed > 0)
-        memcpy(buf, outBuffer + offset, outSizeProcessed);
+    if (len > s->filesize - s->pos)
+        len = s->filesize - s->pos;
+    if (len == 0)
+        return 0;
+    else if ((PHYSFS_uint64) ((size_t) len) != len)
+        len = (size_t) -1;
 
-    alloc->Free(alloc, outBuffer);
-    outBuffer = NULL;
+    if ((s->failed) || (target < s->blockpos))
+        BAIL_IF_ERRPASS(!szipStreamRestart(s), -1);
 
-    retval = __PHYSFS_createMemoryIo(buf, outSizeProcessed, allocator.Free);
-    GOTO_IF_ERRPASS(!retval, SZIP_openRead_failed);
+    while (s->blockpos < target)
+    {
+        UInt64 skip = target - s->blockpos;
+        if ((UInt64) ((size_t) skip) != skip)
+            skip = (size_t) -1;
+        BAIL_IF_ERRPASS(szipStreamDecode(s, NULL, (size_t) skip) < 0, -1);
+    } /* while */
 
-    return retval;
+    rc = szipStreamDecode(s, (Byte *) buf, (size_t) len);
+    BAIL_IF_ERRPASS(rc < 0, -1);
 
-SZIP_openRead_failed:
-    if (io != NULL)
-        io->destroy(io);
+    /* check the CRC when the file has been read from start to end. */
+    if (s->crcpos == s->pos)
+    {
+        const CSzBitUi32s *crcs = &s->info->db.CRCs;
+        s->crc = g_CrcUpdate(s->crc, buf, (size_t) rc, g_CrcTable);
+        s->crcpos += rc;
+        if ((s->crcpos == s->filesize) && SzBitWithVals_Check(crcs, s->dbidx))
+        {
+            if (CRC_GET_DIGEST(s->crc) != crcs->Vals[s->dbidx])
+                BAIL(PHYSFS_ERR_CORRUPT, -1);
+        } /* if */
+    } /* if */
 
-    if (buf)
-        allocator.Free(buf);
+    s->pos += rc;
+    return rc;
+} /* SZIP_stream_read */
 
-    if (outBuffer)
-        alloc->Free(alloc, outBuffer);
 
+static PHYSFS_sint64 SZIP_stream_write(PHYSFS_Io *io, const void *b,
+                                       PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, -1);
+} /* SZIP_stream_write */
+
+
+static int SZIP_stream_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    BAIL_IF(offset > s->filesize, PHYSFS_ERR_PAST_EOF, 0);
+    s->pos = offset;  /* the next read gets there. */
+    return 1;
+} /* SZIP_stream_seek */
+
+
+static PHYSFS_sint64 SZIP_stream_tell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->pos;
+} /* SZIP_stream_tell */
+
+
+static PHYSFS_sint64 SZIP_stream_length(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->filesize;
+} /* SZIP_stream_length */
+
+
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const PHYSFS_uint32 dbidx);
+
+static PHYSFS_Io *SZIP_stream_duplicate(PHYSFS_Io *io)
+{
+    const SZIPstream *s = (SZIPstream *) io->opaque;
+    return szipOpenStream(s->info, s->dbidx);
+} /* SZIP_stream_duplicate */
+
+
+static int SZIP_stream_flush(PHYSFS_Io *io) { return 1;  /* read-only. */ }
+
+
+static void SZIP_stream_destroy(PHYSFS_Io *io)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    /* LZMA2 uses the same probabilities; this frees them for both. */
+    LzmaDec_FreeProbs(&s->dec.decoder, &SZIP_SzAlloc);
+    SZIP_SzAlloc.Free(&SZIP_SzAlloc, s->dec.decoder.dic);
+    if (s->stream.io != NULL)
+        s->stream.io->destroy(s->stream.io);
+    allocator.Free(s);
+    allocator.Free(io);
+} /* SZIP_stream_destroy */
+
+
+static const PHYSFS_Io SZIP_streamIo =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_stream_read,
+    SZIP_stream_write,
+    SZIP_stream_seek,
+    SZIP_stream_tell,
+    SZIP_stream_length,
+    SZIP_stream_duplicate,
+    SZIP_stream_flush,
+    SZIP_stream_destroy
+};
+
+
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const PHYSFS_uint32 dbidx)
+{
+    const CSzArEx *db = &info->db;
+    const UInt32 index = db->FileToFolder[dbidx];
+    const UInt64 *packpos = db->db.PackPositions + db->db.FoStartPackStreamIndex[index];
+    const CSzCoderInfo *coder;
+    const Byte *props;
+    CSzFolder folder;
+    PHYSFS_Io *retval = NULL;
+    SZIPstream *s = NULL;
+    SRes rc = SZ_OK;
+
+    BAIL_IF(!szipCanStream(info, dbidx, &folder), PHYSFS_ERR_UNSUPPORTED, NULL);
+    coder = &folder.Coders[0];
+    props = db->db.CodersData + db->db.FoCodersOffsets[index] + coder->PropsOffset;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    s = (SZIPstream *) allocator.Malloc(sizeof (SZIPstream));
+    if (!s)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    memset(s, '\0', sizeof (*s));
+    Lzma2Dec_Construct(&s->dec);
+    memcpy(retval, &SZIP_streamIo, sizeof (*retval));
+    retval->opaque = s;
+
+    s->info = info;
+    s->dbidx = dbidx;
+    s->method = coder->MethodID;
+    s->packstart = db->dataPos + packpos[0];
+    s->packsize = packpos[1] - packpos[0];
+    s->blocksize = SzAr_GetFolderUnpackSize(&db->db, index);
+    s->filestart = db->UnpackPositions[dbidx] - db->UnpackPositions[db->FolderToFile[index]];
+    s->filesize = SzArEx_GetFileSize(db, dbidx);
+    s->crc = CRC_INIT_VAL;
+
+    if (s->method == k_Copy)
+        GOTO_IF(s->packsize != s->blocksize, PHYSFS_ERR_CORRUPT, failed);
+    else if (s->method == k_LZMA2)
+    {
+        GOTO_IF(coder->PropsSize != 1, PHYSFS_ERR_CORRUPT, failed);
+        rc = Lzma2Dec_AllocateProbs(&s->dec, props[0], &SZIP_SzAlloc);
+    } /* else if */
+    else
+    {
+        rc = LzmaDec_AllocateProbs(&s->dec.decoder, props, coder->PropsSize,
+                                   &SZIP_SzAlloc);
+    } /* else */
+    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), failed);
+
+    if (s->method != k_Copy)
+    {
+        /* the window only needs to hold one dictionary's worth. */
+        SizeT dicsize = s->dec.decoder.prop.dicSize;
+        if (dicsize > s->blocksize)
+            dicsize = (SizeT) s->blocksize;
+        s->dec.decoder.dic = (Byte *) SZIP_SzAlloc.Alloc(&SZIP_SzAlloc, dicsize);
+        GOTO_IF(!s->dec.decoder.dic, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+        s->dec.decoder.dicBufSize = dicsize;
+    } /* if */
+
+    s->stream.io = szipDuplicateIo(info);
+    GOTO_IF_ERRPASS(!s->stream.io, failed);
+    szipInitStream(&s->stream, s->stream.io);
+    GOTO_IF_ERRPASS(!szipStreamRestart(s), failed);
+
+    return retval;
+
+failed:
+    retval->destroy(retval);
     return NULL;
+} /* szipOpenStream */
+
+
+static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+{
+    /* !!! FIXME: blocks with filters (BCJ and friends) are still
+       !!! FIXME:  decompressed whole, no matter how big they are. */
+
+    static const Byte empty = 0;
+    SZIPinfo *info = (SZIPinfo *) opaque;
+    SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+    PHYSFS_Io *retval = NULL;
+    SZIPblock *block = NULL;
+    CSzFolder folder;
+    UInt32 index;
+
+    BAIL_IF_ERRPASS(!entry, NULL);
+    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
+
+    /* empty files don't have a block at all. */
+    if (SzArEx_GetFileSize(&info->db, entry->dbidx) == 0)
+        return __PHYSFS_createMemoryIo(&empty, 0, NULL);
+
+    index = info->db.FileToFolder[entry->dbidx];
+    __PHYSFS_platformGrabMutex(info->lock);
+    block = szipFindBlock(info, index);
+    if (block == NULL)
+    {
+        /* big files are decompressed as they're read, unless cached. */
+        if (szipCanStream(info, entry->dbidx, &folder))
+        {
+            __PHYSFS_platformReleaseMutex(info->lock);
+            return szipOpenStream(info, entry->dbidx);
+        } /* if */
+
+        block = szipAddBlock(info, index);
+        BAIL_IF_MUTEX_ERRPASS(!block, info->lock, NULL);
+    } /* if */
+    block->refcount++;
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    /* the block is decompressed by the first read, not here. */
+    retval = szipOpenFile(info, block, entry->dbidx, NULL);
+    if (!retval)
+        szipReleaseBlock(info, block);
+    return retval;
 } /* SZIP_openRead */
 
 
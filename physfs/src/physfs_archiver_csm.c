@@ -83,15 +83,16 @@ static void *CSM_openArchive(PHYSFS_Io *io, const char *name,
     count = PHYSFS_swapULE16(count);
 
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, "csm", 0, 1, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!csmLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !csmLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* CSM_openArchive */
 
@@ -76,15 +76,16 @@ static void *GRP_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &count, sizeof(count)), NULL);
     count = PHYSFS_swapULE32(count);
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, "grp", 0, 1, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!grpLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !grpLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* GRP_openArchive */
 
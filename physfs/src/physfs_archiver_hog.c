@@ -130,15 +130,17 @@ static void *HOG_openArchive(PHYSFS_Io *io, const char *name,
 
     *claimed = 1;
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, "hog", 0, 1, 0);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!(hog1 ? hog1LoadEntries(io, unpkarc) : hog2LoadEntries(io, unpkarc)))
+    if (!UNPK_isIndexed(unpkarc) &&
+        !(hog1 ? hog1LoadEntries(io, unpkarc) : hog2LoadEntries(io, unpkarc)))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* HOG_openArchive */
 
@@ -31,19 +31,25 @@
 
 #if PHYSFS_SUPPORTS_ISO9660
 
-#include <time.h>
-
 /* ISO9660 often stores values in both big and little endian formats: little
    first, followed by big. While technically there might be different values
    in each, we just always use the littleendian ones and swap ourselves. The
    fields aren't aligned anyhow, so you have to serialize them in any case
    to avoid crashes on many CPU archs in any case. */
 
-static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
-                              const char *base, const PHYSFS_uint64 dirstart,
-                              const PHYSFS_uint64 dirend, void *unpkarc);
+static inline PHYSFS_uint16 iso9660MemUI16(const PHYSFS_uint8 *ptr)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) ptr[0]) |
+                            (((PHYSFS_uint16) ptr[1]) << 8));
+} /* iso9660MemUI16 */
 
-static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
+static inline PHYSFS_uint32 iso9660MemUI32(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint32) iso9660MemUI16(ptr)) |
+           (((PHYSFS_uint32) iso9660MemUI16(ptr + 2)) << 16);
+} /* iso9660MemUI32 */
+
+static int iso9660AddEntry(const int joliet, const int isdir,
                            const char *base, PHYSFS_uint8 *fname,
                            const int fnamelen, const PHYSFS_sint64 ts,
                            const PHYSFS_uint64 pos, const PHYSFS_uint64 len,
@@ -114,117 +120,152 @@ static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
         } /* if */
     } /* else */
 
-    entry = UNPK_addEntry(unpkarc, fullpath, isdir, ts, ts, pos, len);
-    if ((entry) && (isdir))
-    {
-        if (!iso9660LoadEntries(io, joliet, fullpath, pos, pos + len, unpkarc))
-            entry = NULL;  /* so we report a failure later. */
-    } /* if */
+    /* subdirs are read the first time something looks inside them. */
+    if (isdir)
+        entry = UNPK_addDeferredDir(unpkarc, fullpath, ts, ts, pos, len);
+    else
+        entry = UNPK_addEntry(unpkarc, fullpath, 0, ts, ts, pos, len);
 
     __PHYSFS_smallFree(fullpath);
     return entry != NULL;
 } /* iso9660AddEntry */
 
+/*
+ * Directories are read this many sectors at a time and parsed from memory.
+ *  Directory records never cross a sector boundary, so every sector read
+ *  holds whole records.
+ */
+#define ISO9660_DIR_READ_SECTORS 32
+
+/* size of a directory record, minus the file identifier. */
+#define ISO9660_DIR_RECORD_SIZE 33
+
 static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
                               const char *base, const PHYSFS_uint64 dirstart,
                               const PHYSFS_uint64 dirend, void *unpkarc)
 {
+    const PHYSFS_uint64 readmax = ISO9660_DIR_READ_SECTORS * 2048;
     PHYSFS_uint64 readpos = dirstart;
+    PHYSFS_uint8 *buf;
+    size_t buflen;
+    int retval = 0;
+    __PHYSFS_LocalTimeCache timecache;
+
+    if (dirend <= dirstart)
+        return 1;  /* empty directory. */
 
-    while (1)
+    buflen = (size_t) (((dirend - dirstart) < readmax) ?
+                            (dirend - dirstart) : readmax);
+    buf = (PHYSFS_uint8 *) allocator.Malloc(buflen);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    memset(&timecache, '\0', sizeof (timecache));
+
+    GOTO_IF_ERRPASS(!io->seek(io, dirstart), loadEntriesFailed);
+
+    while (readpos < dirend)
     {
-        PHYSFS_uint8 recordlen;
-        PHYSFS_uint8 extattrlen;
-        PHYSFS_uint32 extent;
-        PHYSFS_uint32 datalen;
-        PHYSFS_uint8 ignore[4];
-        PHYSFS_uint8 year, month, day, hour, minute, second, offset;
-        PHYSFS_uint8 flags;
-        PHYSFS_uint8 fnamelen;
-        PHYSFS_uint8 fname[256];
-        PHYSFS_sint64 timestamp;
-        struct tm t;
-        int isdir;
-        int multiextent;
-
-        BAIL_IF_ERRPASS(!io->seek(io, readpos), 0);
-
-        /* recordlen = 0 -> no more entries or fill entry */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &recordlen, 1), 0);
-        if (recordlen > 0)
-            readpos += recordlen;  /* ready to seek to next record. */
-        else
-        {
-            PHYSFS_uint64 nextpos;
-
-            /* if we are in the last sector of the directory & it's 0 -> end */
-            if ((dirend - 2048) <= (readpos - 1))
-                break; /* finished */
-
-            /* else skip to the next sector & continue; */
-            nextpos = (((readpos - 1) / 2048) + 1) * 2048;
-
-            /* whoops, can't make forward progress! */
-            BAIL_IF(nextpos == readpos, PHYSFS_ERR_CORRUPT, 0);
-
-            readpos = nextpos;
-            continue;  /* start back at upper loop. */
-        } /* else */
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extattrlen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extent, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* extent be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &datalen, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* datalen be */
-
-        /* record timestamp */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &year, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &month, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &day, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &hour, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &minute, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &second, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &offset, 1), 0);
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &flags, 1), 0);
-        isdir = (flags & (1 << 1)) != 0;
-        multiextent = (flags & (1 << 7)) != 0;
-        BAIL_IF(multiextent, PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME */
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* unit size */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* interleave gap */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &fnamelen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, fname, fnamelen), 0);
-
-        t.tm_sec = second;
-        t.tm_min = minute;
-        t.tm_hour = hour;
-        t.tm_mday = day;
-        t.tm_mon = month - 1;
-        t.tm_year = year;
-        t.tm_wday = 0;
-        t.tm_yday = 0;
-        t.tm_isdst = -1;
-        timestamp = (PHYSFS_sint64) mktime(&t);
-
-        extent += extattrlen;  /* skip extended attribute record. */
-
-        /* infinite loop, corrupt file? */
-        BAIL_IF((extent * 2048) == dirstart, PHYSFS_ERR_CORRUPT, 0);
-
-        if (!iso9660AddEntry(io, joliet, isdir, base, fname, fnamelen,
-                             timestamp, extent * 2048, datalen, unpkarc))
+        const size_t readlen = (size_t) (((dirend - readpos) < buflen) ?
+                                              (dirend - readpos) : buflen);
+        size_t sector;
+
+        GOTO_IF_ERRPASS(!__PHYSFS_readAll(io, buf, readlen), loadEntriesFailed);
+
+        for (sector = 0; sector < readlen; sector += 2048)
         {
-            return 0;
-        } /* if */
+            const size_t sectorend = ((readlen - sector) < 2048) ?
+                                          readlen : sector + 2048;
+            size_t i = sector;
+
+            /* recordlen = 0 -> no more entries in this sector. */
+            while ((i < sectorend) && (buf[i] != 0))
+            {
+                const PHYSFS_uint8 *rec = buf + i;
+                const PHYSFS_uint8 recordlen = rec[0];
+                PHYSFS_uint8 fnamelen;
+                PHYSFS_uint64 extent;
+                PHYSFS_uint32 datalen;
+                PHYSFS_uint8 fname[256];
+                PHYSFS_sint64 timestamp;
+                int isdir;
+
+                GOTO_IF(recordlen < ISO9660_DIR_RECORD_SIZE,
+                        PHYSFS_ERR_CORRUPT, loadEntriesFailed);
+                GOTO_IF(recordlen > (sectorend - i),
+                        PHYSFS_ERR_CORRUPT, loadEntriesFailed);
+
+                fnamelen = rec[32];
+                GOTO_IF(fnamelen > (recordlen - ISO9660_DIR_RECORD_SIZE),
+                        PHYSFS_ERR_CORRUPT, loadEntriesFailed);
+
+                /* !!! FIXME: multiextent files. */
+                GOTO_IF(rec[25] & (1 << 7), PHYSFS_ERR_UNSUPPORTED,
+                        loadEntriesFailed);
+                isdir = (rec[25] & (1 << 1)) != 0;
+
+                i += recordlen;
+
+                /* "." and ".." point back up the tree; skip them here. */
+                if ((fnamelen == 1) && ((rec[33] == 0) || (rec[33] == 1)))
+                    continue;
+
+                /* iso9660AddEntry() scribbles on the name, so copy it. */
+                memcpy(fname, rec + ISO9660_DIR_RECORD_SIZE, fnamelen);
+
+                /* siblings share a few timestamps, so this rarely hits mktime(). */
+                timestamp = __PHYSFS_localTimeToUnix(&timecache, rec[18],
+                                                     rec[19] - 1, rec[20],
+                                                     rec[21], rec[22], rec[23]);
+
+                /* skip extended attribute record. */
+                extent = ((PHYSFS_uint64) iso9660MemUI32(rec + 2)) + rec[1];
+                datalen = iso9660MemUI32(rec + 10);
+
+                /* infinite loop, corrupt file? */
+                GOTO_IF(isdir && ((extent * 2048) == dirstart),
+                        PHYSFS_ERR_CORRUPT, loadEntriesFailed);
+
+                GOTO_IF_ERRPASS(!iso9660AddEntry(joliet, isdir, base,
+                                                 fname, fnamelen, timestamp,
+                                                 extent * 2048, datalen,
+                                                 unpkarc), loadEntriesFailed);
+            } /* while */
+        } /* for */
+
+        readpos += readlen;
     } /* while */
 
-    return 1;
+    retval = 1;
+
+loadEntriesFailed:
+    allocator.Free(buf);
+    return retval;
 } /* iso9660LoadEntries */
 
 
+/* what iso9660LoadDir() needs to know about the volume it's reading. */
+typedef struct
+{
+    int joliet;  /* non-zero if filenames are UCS-2 (a Joliet volume). */
+} ISO9660Volume;
+
+static const ISO9660Volume iso9660PlainVolume = { 0 };
+static const ISO9660Volume iso9660JolietVolume = { 1 };
+
+/* UNPK_DirLoader for subdirs; (data) is the ISO9660Volume. */
+static int iso9660LoadDir(void *unpkarc, PHYSFS_Io *io, const char *path,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len,
+                          const void *data)
+{
+    const ISO9660Volume *volume = (const ISO9660Volume *) data;
+    return iso9660LoadEntries(io, volume->joliet, path, pos, pos + len,
+                              unpkarc);
+} /* iso9660LoadDir */
+
+
+/* bytes of a volume descriptor we look at, up to the root directory's size. */
+#define ISO9660_VOLUME_DESC_SIZE (156 + 18)
+
 static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
                                  PHYSFS_uint64 *_rootlen, int *_joliet,
                                  int *_claimed)
@@ -237,12 +278,10 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
 
     while (!done)
     {
+        PHYSFS_uint8 vd[ISO9660_VOLUME_DESC_SIZE];
         PHYSFS_uint8 type;
-        PHYSFS_uint8 identifier[5];
-        PHYSFS_uint8 version;
         PHYSFS_uint8 flags;
-        PHYSFS_uint8 escapeseqs[32];
-        PHYSFS_uint8 ignore[32];
+        const PHYSFS_uint8 *escapeseqs;
         PHYSFS_uint16 blocksize;
         PHYSFS_uint32 extent;
         PHYSFS_uint32 datalen;
@@ -250,10 +289,10 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
         BAIL_IF_ERRPASS(!io->seek(io, pos), 0);
         pos += 2048;  /* each volume descriptor is 2048 bytes */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &type, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, identifier, 5), 0);
+        /* type and identifier first, so non-isos bail out as unsupported. */
+        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, vd, 6), 0);
 
-        if (memcmp(identifier, "CD001", 5) != 0)  /* maybe not an iso? */
+        if (memcmp(vd + 1, "CD001", 5) != 0)  /* maybe not an iso? */
         {
             BAIL_IF(!*_claimed, PHYSFS_ERR_UNSUPPORTED, 0);
             continue;  /* just skip this one */
@@ -261,39 +300,17 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
 
         *_claimed = 1; /* okay, this is probably an iso. */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &version, 1), 0);  /* version */
-        BAIL_IF(version != 1, PHYSFS_ERR_UNSUPPORTED, 0);
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &flags, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 32), 0);  /* system id */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 32), 0);  /* volume id */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 8), 0);  /* reserved */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0);  /* space le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0);  /* space be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, escapeseqs, 32), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* setsize le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* setsize be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* seq num le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* seq num be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &blocksize, 2), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* blocklen be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtablen le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtablen be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtabpos le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* optpthtabpos le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtabpos be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* optpthtabpos be */
-
-        /* root directory record... */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* len */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* attr len */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extent, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* extent be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &datalen, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* datalen be */
+        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, vd + 6, sizeof (vd) - 6), 0);
+        BAIL_IF(vd[6] != 1, PHYSFS_ERR_UNSUPPORTED, 0);  /* version */
+
+        type = vd[0];
+        flags = vd[7];
+        escapeseqs = vd + 88;
+        blocksize = iso9660MemUI16(vd + 128);
+        extent = iso9660MemUI32(vd + 156 + 2);  /* root directory record */
+        datalen = iso9660MemUI32(vd + 156 + 10);
 
         /* !!! FIXME: deal with this properly. */
-        blocksize = PHYSFS_swapULE32(blocksize);
         BAIL_IF(blocksize && (blocksize != 2048), PHYSFS_ERR_UNSUPPORTED, 0);
 
         switch (type)
@@ -302,8 +319,8 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
             case 2:  /* Supplementary Volume Descriptor */
                 if (found < type)
                 {
-                    *_rootpos = PHYSFS_swapULE32(extent) * 2048;
-                    *_rootlen = PHYSFS_swapULE32(datalen);
+                    *_rootpos = ((PHYSFS_uint64) extent) * 2048;
+                    *_rootlen = datalen;
                     found = type;
 
                     if (found == 2)  /* possible Joliet volume */
@@ -347,9 +364,12 @@ static void *ISO9660_openArchive(PHYSFS_Io *io, const char *filename,
         return NULL;
 
     /* !!! FIXME: check case_sensitive and only_usascii params for this archive. */
-    unpkarc = UNPK_openArchive(io, 1, 0);
+    unpkarc = UNPK_openArchive(io, NULL, 1, 0, 0);  /* loads dirs lazily. */
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
+    UNPK_setDirLoader(unpkarc, iso9660LoadDir,
+                      joliet ? &iso9660JolietVolume : &iso9660PlainVolume,
+                      rootpos);
     if (!iso9660LoadEntries(io, joliet, "", rootpos, rootpos + len, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
@@ -70,15 +70,16 @@ static void *MVL_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &count, sizeof(count)), NULL);
     count = PHYSFS_swapULE32(count);
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, "mvl", 0, 1, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!mvlLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !mvlLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* MVL_openArchive */
 
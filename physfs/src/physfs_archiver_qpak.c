@@ -87,15 +87,16 @@ static void *QPAK_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!io->seek(io, pos), NULL);
 
     /* !!! FIXME: check case_sensitive and only_usascii params for this archive. */
-    unpkarc = UNPK_openArchive(io, 1, 0);
+    unpkarc = UNPK_openArchive(io, "qpak", 1, 0, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!qpakLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !qpakLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* QPAK_openArchive */
 
@@ -95,15 +95,17 @@ static void *SLB_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!io->seek(io, tocPos), NULL);
 
     /* !!! FIXME: check case_sensitive and only_usascii params for this archive. */
-    unpkarc = UNPK_openArchive(io, 1, 0);
+    unpkarc = UNPK_openArchive(io, "slb", 1, 0, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!slbLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !slbLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
+
     *claimed = 1;  /* oh well. */
 
     return unpkarc;
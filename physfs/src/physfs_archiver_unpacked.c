@@ -20,6 +20,10 @@ typedef struct
 {
     __PHYSFS_DirTree tree;
     PHYSFS_Io *io;
+    const char *tag;    /* index cache tag, NULL to not cache. */
+    int indexed;        /* non-zero if the tree came from the index cache. */
+    UNPK_DirLoader dirloader;
+    const void *dirloaderdata;
 } UNPKinfo;
 
 typedef struct
@@ -38,6 +42,15 @@ typedef struct
     PHYSFS_uint32 curPos;
 } UNPKfileinfo;
 
+/* An UNPKentry as it's kept in the index cache. */
+typedef struct
+{
+    PHYSFS_uint64 startPos;
+    PHYSFS_uint64 size;
+    PHYSFS_sint64 ctime;
+    PHYSFS_sint64 mtime;
+} UNPKindexEntry;
+
 
 void UNPK_closeArchive(void *opaque)
 {
@@ -165,6 +178,29 @@ static const PHYSFS_Io UNPK_Io =
 };
 
 
+const PHYSFS_uint8 *UNPK_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    const UNPKfileinfo *finfo;
+    const UNPKentry *entry;
+    const PHYSFS_uint8 *mem;
+    PHYSFS_uint64 memlen;
+
+    if (io->read != UNPK_read)
+        return NULL;
+
+    finfo = (const UNPKfileinfo *) io->opaque;
+    entry = finfo->entry;
+    mem = __PHYSFS_ioMemory(finfo->io, &memlen);
+    if ((mem == NULL) || (entry->startPos > memlen))
+        return NULL;
+    else if (entry->size > memlen - entry->startPos)
+        return NULL;  /* truncated archive; let read() report it. */
+
+    *len = entry->size;
+    return mem + entry->startPos;
+} /* UNPK_ioMemory */
+
+
 static inline UNPKentry *findEntry(UNPKinfo *info, const char *path)
 {
     return (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, path);
@@ -285,18 +321,148 @@ void *UNPK_addEntry(void *opaque, char *name, const int isdir,
 } /* UNPK_addEntry */
 
 
-void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive, const int only_usascii)
+void *UNPK_addDeferredDir(void *opaque, char *name,
+                          const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry;
+
+    assert(info->dirloader != NULL);
+
+    entry = (UNPKentry *) __PHYSFS_DirTreeAdd(&info->tree, name, 1);
+    BAIL_IF_ERRPASS(!entry, NULL);
+
+    /* dirs don't otherwise use these, so remember where the listing is. */
+    entry->startPos = pos;
+    entry->size = len;
+    entry->ctime = ctime;
+    entry->mtime = mtime;
+
+    __PHYSFS_DirTreeDeferDir(&info->tree, &entry->tree);
+    return entry;
+} /* UNPK_addDeferredDir */
+
+
+static int unpkLoadDir(void *opaque, __PHYSFS_DirTreeEntry *dir,
+                       const char *path)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry = (UNPKentry *) dir;
+    const PHYSFS_uint64 pos = entry->startPos;
+    const PHYSFS_uint64 len = entry->size;
+    const __PHYSFS_DirTreeEntry *parent;
+
+    /* a dir listed at the same spot as a dir it's in would have itself
+       for a subdir, forever. Loaded dirs keep (startPos) to check this. */
+    for (parent = dir->parent; parent != NULL; parent = parent->parent)
+    {
+        BAIL_IF(((const UNPKentry *) parent)->startPos == pos,
+                PHYSFS_ERR_CORRUPT, 0);
+    } /* for */
+
+    /* archiver calls on one archive never overlap, so (io) is ours. */
+    entry->size = 0;
+    if (!info->dirloader(info, info->io, path, pos, len, info->dirloaderdata))
+    {
+        entry->size = len;
+        return 0;
+    } /* if */
+
+    return 1;
+} /* unpkLoadDir */
+
+
+void UNPK_setDirLoader(void *opaque, UNPK_DirLoader loader, const void *data,
+                       const PHYSFS_uint64 rootpos)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    ((UNPKentry *) info->tree.root)->startPos = rootpos;
+    info->dirloader = loader;
+    info->dirloaderdata = data;
+    __PHYSFS_DirTreeSetLoader(&info->tree, unpkLoadDir, info);
+} /* UNPK_setDirLoader */
+
+
+static void unpkPackEntry(void *data, const __PHYSFS_DirTreeEntry *_entry,
+                          PHYSFS_uint8 *buf)
+{
+    const UNPKentry *entry = (const UNPKentry *) _entry;
+    UNPKindexEntry packed;
+
+    packed.startPos = entry->startPos;
+    packed.size = entry->size;
+    packed.ctime = entry->ctime;
+    packed.mtime = entry->mtime;
+    memcpy(buf, &packed, sizeof (packed));
+} /* unpkPackEntry */
+
+
+static int unpkUnpackEntry(void *data, __PHYSFS_DirTreeEntry *_entry,
+                           const PHYSFS_uint8 *buf)
+{
+    UNPKentry *entry = (UNPKentry *) _entry;
+    UNPKindexEntry packed;
+
+    memcpy(&packed, buf, sizeof (packed));
+    if (packed.startPos + packed.size < packed.startPos)
+        return 0;  /* bogus. */
+    else if (entry->tree.isdir && ((packed.startPos != 0) || (packed.size != 0)))
+        return 0;  /* dirs don't have data, and deferred ones aren't cached. */
+
+    entry->startPos = packed.startPos;
+    entry->size = packed.size;
+    entry->ctime = packed.ctime;
+    entry->mtime = packed.mtime;
+    return 1;
+} /* unpkUnpackEntry */
+
+
+int UNPK_isIndexed(void *opaque)
+{
+    return ((UNPKinfo *) opaque)->indexed;
+} /* UNPK_isIndexed */
+
+
+void UNPK_saveIndex(void *opaque)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    if ((info->tag != NULL) && (!info->indexed))
+    {
+        assert(info->tree.unloadedCount == 0);
+        __PHYSFS_DirTreeSaveIndex(&info->tree, info->io, info->tag,
+                                  sizeof (UNPKindexEntry), unpkPackEntry, info);
+    } /* if */
+} /* UNPK_saveIndex */
+
+
+void *UNPK_openArchive(PHYSFS_Io *io, const char *tag,
+                       const int case_sensitive, const int only_usascii,
+                       const PHYSFS_uint64 entrycount)
 {
     UNPKinfo *info = (UNPKinfo *) allocator.Malloc(sizeof (UNPKinfo));
     BAIL_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
 
-    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), case_sensitive, only_usascii))
+    info->io = io;
+    info->tag = tag;
+    info->indexed = 0;
+    info->dirloader = NULL;
+    info->dirloaderdata = NULL;
+
+    if ((tag != NULL) &&
+        (__PHYSFS_DirTreeLoadIndex(&info->tree, sizeof (UNPKentry),
+                                   case_sensitive, only_usascii, io, tag,
+                                   sizeof (UNPKindexEntry), unpkUnpackEntry,
+                                   info)))
+    {
+        info->indexed = 1;
+    } /* if */
+    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry),
+                                   case_sensitive, only_usascii, entrycount))
     {
         allocator.Free(info);
         return NULL;
-    } /* if */
-
-    info->io = io;
+    } /* else if */
 
     return info;
 } /* UNPK_openArchive */
@@ -130,15 +130,17 @@ static void *VDF_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!io->seek(io, rootCatOffset), NULL);
 
     /* !!! FIXME: check case_sensitive and only_usascii params for this archive. */
-    unpkarc = UNPK_openArchive(io, 1, 0);
+    unpkarc = UNPK_openArchive(io, "vdf", 1, 0, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!vdfLoadEntries(io, count, vdfDosTimeToEpoch(timestamp), unpkarc))
+    if (!UNPK_isIndexed(unpkarc) &&
+        !vdfLoadEntries(io, count, vdfDosTimeToEpoch(timestamp), unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* VDF_openArchive */
 
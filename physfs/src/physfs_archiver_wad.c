@@ -95,15 +95,16 @@ static void *WAD_openArchive(PHYSFS_Io *io, const char *name,
 
     BAIL_IF_ERRPASS(!io->seek(io, directoryOffset), 0);
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, "wad", 0, 1, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!wadLoadEntries(io, count, unpkarc))
+    if (!UNPK_isIndexed(unpkarc) && !wadLoadEntries(io, count, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc);
     return unpkarc;
 } /* WAD_openArchive */
 
@@ -13,7 +13,6 @@
 #if PHYSFS_SUPPORTS_ZIP
 
 #include <errno.h>
-#include <time.h>
 
 #if (PHYSFS_BYTEORDER == PHYSFS_LIL_ENDIAN)
 #define MINIZ_LITTLE_ENDIAN 1
@@ -73,10 +72,48 @@ typedef struct _ZIPentry
     PHYSFS_uint32 crc;                  /* crc-32                         */
     PHYSFS_uint64 compressed_size;      /* compressed size                */
     PHYSFS_uint64 uncompressed_size;    /* uncompressed size              */
-    PHYSFS_sint64 last_mod_time;        /* last file mod time             */
+    PHYSFS_sint64 last_mod_time;        /* dos_mod_time, once converted   */
     PHYSFS_uint32 dos_mod_time;         /* original MS-DOS style mod time */
+    PHYSFS_uint8 has_mod_time;          /* non-zero if last_mod_time set  */
+    PHYSFS_uint8 loaded;                /* in the central directory?      */
 } ZIPentry;
 
+/*
+ * With seek checkpoints enabled (see PHYSFS_setSeekCheckpoints()), inflating
+ *  a big entry saves a copy of the decompressor every (interval) bytes of
+ *  output, so seeking can carry on from the nearest one instead of inflating
+ *  from the start of the entry again. The copy includes the 32k window, so
+ *  they aren't small. They're shared by every handle open on the entry, and
+ *  kept until the archive is closed.
+ */
+typedef struct
+{
+    PHYSFS_uint64 compressed_position;    /* input consumed at this point.  */
+    PHYSFS_uint64 uncompressed_position;  /* output produced at this point. */
+    inflate_state state;                  /* decompressor, window and all.  */
+} ZIPcheckpoint;
+
+typedef struct _ZIPcheckpoints
+{
+    ZIPentry *entry;                      /* whose checkpoints these are.   */
+    void *lock;                           /* the archive's checkpoint_lock. */
+    PHYSFS_uint64 interval;               /* output between checkpoints.    */
+    size_t count;                         /* number of (slots).             */
+    ZIPcheckpoint **slots;                /* [i] is at/after (i+1)*interval.*/
+    struct _ZIPcheckpoints *next;         /* other entries in this archive. */
+} ZIPcheckpoints;
+
+/*
+ * Reading a compressed entry needs a read buffer and an inflater, which is
+ *  most of 60k of allocations. With PHYSFS_setInflaterPool(), archives keep
+ *  the ones closed files were using, to hand to the next files opened.
+ */
+typedef struct
+{
+    z_stream stream;                      /* inflateReset() before reuse.  */
+    PHYSFS_uint8 *buffer;                 /* ZIP_READBUFSIZE bytes.        */
+} ZIPinflater;
+
 /*
  * One ZIPinfo is kept for each open ZIP archive.
  */
@@ -86,6 +123,14 @@ typedef struct
     PHYSFS_Io *io;            /* the i/o interface for this archive.    */
     int zip64;                /* non-zero if this is a Zip64 archive.   */
     int has_crypto;           /* non-zero if any entry uses encryption. */
+    __PHYSFS_LocalTimeCache timecache;  /* for converting mod times.    */
+    PHYSFS_uint64 checkpoint_interval;  /* zero if not checkpointing.   */
+    void *checkpoint_lock;    /* protects (checkpoints) and their slots.*/
+    ZIPcheckpoints *checkpoints;  /* entries that keep checkpoints.     */
+    void *pool_lock;          /* protects (pool) and (pool_count).      */
+    ZIPinflater *pool;        /* inflaters closed files left behind.    */
+    size_t pool_size;         /* max inflaters (pool) holds; 0 if none. */
+    size_t pool_count;        /* inflaters (pool) holds right now.      */
 } ZIPinfo;
 
 /*
@@ -93,6 +138,7 @@ typedef struct
  */
 typedef struct
 {
+    ZIPinfo *info;                        /* archive this came from.    */
     ZIPentry *entry;                      /* Info on file.              */
     PHYSFS_Io *io;                        /* physical file handle.      */
     PHYSFS_uint32 compressed_position;    /* offset in compressed data. */
@@ -101,6 +147,8 @@ typedef struct
     PHYSFS_uint32 crypto_keys[3];         /* for "traditional" crypto.  */
     PHYSFS_uint32 initial_crypto_keys[3]; /* for "traditional" crypto.  */
     z_stream stream;                      /* zlib stream state.         */
+    ZIPcheckpoints *checkpoints;          /* NULL if not checkpointing. */
+    PHYSFS_uint64 next_checkpoint;        /* save one past this output. */
 } ZIPfileinfo;
 
 
@@ -269,6 +317,67 @@ static int zlib_err(const int rc)
     return rc;
 } /* zlib_err */
 
+
+/*
+ * Give (finfo) a read buffer and a ready inflater, from the archive's pool
+ *  if it has one. On failure, (finfo->buffer) might be allocated, and the
+ *  caller should clean up as if inflateInit2() failed.
+ */
+static int zip_get_inflater(ZIPinfo *info, ZIPfileinfo *finfo)
+{
+    if (info->pool_size > 0)
+    {
+        int found = 0;
+        __PHYSFS_platformGrabMutex(info->pool_lock);
+        if (info->pool_count > 0)
+        {
+            const ZIPinflater *inf = &info->pool[--info->pool_count];
+            memcpy(&finfo->stream, &inf->stream, sizeof (z_stream));
+            finfo->buffer = inf->buffer;
+            found = 1;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(info->pool_lock);
+
+        if (found)
+        {
+            inflateReset(&finfo->stream);
+            finfo->stream.next_in = finfo->stream.next_out = NULL;
+            finfo->stream.avail_in = finfo->stream.avail_out = 0;
+            return 1;
+        } /* if */
+    } /* if */
+
+    finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+    BAIL_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    return (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) == Z_OK);
+} /* zip_get_inflater */
+
+
+/* Give (finfo)'s buffer and inflater back to the pool, or free them. */
+static void zip_put_inflater(ZIPinfo *info, ZIPfileinfo *finfo)
+{
+    if (info->pool_size > 0)
+    {
+        int kept = 0;
+        __PHYSFS_platformGrabMutex(info->pool_lock);
+        if (info->pool_count < info->pool_size)
+        {
+            ZIPinflater *inf = &info->pool[info->pool_count++];
+            memcpy(&inf->stream, &finfo->stream, sizeof (z_stream));
+            inf->buffer = finfo->buffer;
+            kept = 1;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(info->pool_lock);
+
+        if (kept)
+            return;
+    } /* if */
+
+    inflateEnd(&finfo->stream);
+    allocator.Free(finfo->buffer);
+} /* zip_put_inflater */
+
+
 /*
  * Read an unsigned 64-bit int and swap to native byte order.
  */
@@ -304,6 +413,92 @@ static int readui16(PHYSFS_Io *io, PHYSFS_uint16 *val)
 } /* readui16 */
 
 
+/*
+ * Save the decompressor state, if nobody has already saved one for this
+ *  stretch of the entry. (pos) is the output produced so far, which might
+ *  be more than finfo->uncompressed_position in the middle of a ZIP_read().
+ *  Checkpoints are an optimization, so running out of memory just skips it.
+ */
+static void zip_save_checkpoint(ZIPfileinfo *finfo, PHYSFS_uint64 pos)
+{
+    ZIPcheckpoints *cps = finfo->checkpoints;
+    const PHYSFS_uint64 slot = pos / cps->interval;
+
+    if (slot > cps->count)  /* only the tail after the last checkpoint. */
+    {
+        finfo->next_checkpoint = finfo->entry->uncompressed_size;
+        return;
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(cps->lock);
+    if (cps->slots[slot - 1] == NULL)
+    {
+        ZIPcheckpoint *cp = (ZIPcheckpoint *) allocator.Malloc(sizeof (*cp));
+        if (cp != NULL)
+        {
+            cp->compressed_position = finfo->compressed_position -
+                                      finfo->stream.avail_in;
+            cp->uncompressed_position = pos;
+            memcpy(&cp->state, finfo->stream.state, sizeof (inflate_state));
+            cps->slots[slot - 1] = cp;
+        } /* if */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(cps->lock);
+
+    finfo->next_checkpoint = (slot + 1) * cps->interval;
+} /* zip_save_checkpoint */
+
+
+/*
+ * Move the stream to the closest saved checkpoint at or before (offset), if
+ *  that gets us there faster than decoding forward from where we are. Returns
+ *  1 if it moved, 0 if it didn't, -1 if seeking the archive failed.
+ */
+static int zip_restore_checkpoint(ZIPfileinfo *finfo, PHYSFS_uint64 offset)
+{
+    ZIPcheckpoints *cps = finfo->checkpoints;
+    PHYSFS_uint64 slot = offset / cps->interval;
+    const ZIPcheckpoint *cp = NULL;
+    int retval = 0;
+
+    if (slot > cps->count)
+        slot = cps->count;
+
+    __PHYSFS_platformGrabMutex(cps->lock);
+
+    /* a slot's checkpoint is wherever inflate first got past the slot's
+       start, so even the one in (offset)'s own slot can be past it. */
+    for (; slot > 0; slot--)
+    {
+        cp = cps->slots[slot - 1];
+        if ((cp != NULL) && (cp->uncompressed_position <= offset))
+            break;
+        cp = NULL;
+    } /* for */
+
+    if ((cp != NULL) && ((offset < finfo->uncompressed_position) ||
+        (cp->uncompressed_position > finfo->uncompressed_position)))
+    {
+        PHYSFS_Io *io = finfo->io;
+        retval = -1;
+        if (io->seek(io, finfo->entry->offset + cp->compressed_position))
+        {
+            memcpy(finfo->stream.state, &cp->state, sizeof (inflate_state));
+            finfo->stream.next_in = finfo->buffer;
+            finfo->stream.avail_in = 0;
+            finfo->compressed_position = (PHYSFS_uint32) cp->compressed_position;
+            finfo->uncompressed_position = (PHYSFS_uint32) cp->uncompressed_position;
+            finfo->next_checkpoint = (slot + 1) * cps->interval;
+            retval = 1;
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(cps->lock);
+
+    return retval;
+} /* zip_restore_checkpoint */
+
+
 static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) _io->opaque;
@@ -355,6 +550,13 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 
             if (rc != Z_OK)
                 break;
+
+            if (finfo->checkpoints != NULL)
+            {
+                const PHYSFS_uint64 pos = finfo->uncompressed_position + retval;
+                if (pos >= finfo->next_checkpoint)
+                    zip_save_checkpoint(finfo, pos);
+            } /* if */
         } /* while */
     } /* else */
 
@@ -399,22 +601,30 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
          * If seeking backwards, we need to redecode the file
          *  from the start and throw away the compressed bits until we hit
          *  the offset we need. If seeking forward, we still need to
-         *  decode, but we don't rewind first.
+         *  decode, but we don't rewind first. Either way, a checkpoint
+         *  between here and there (or before there, going backwards)
+         *  lets us skip most of that.
          */
-        if (offset < finfo->uncompressed_position)
+        if (finfo->checkpoints != NULL)
         {
-            /* we do a copy so state is sane if inflateInit2() fails. */
-            z_stream str;
-            initializeZStream(&str);
-            if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
+            if (zip_restore_checkpoint(finfo, offset) < 0)
                 return 0;
+        } /* if */
 
+        if (offset < finfo->uncompressed_position)
+        {
             if (!io->seek(io, entry->offset + (encrypted ? 12 : 0)))
                 return 0;
 
-            inflateEnd(&finfo->stream);
-            memcpy(&finfo->stream, &str, sizeof (z_stream));
+            if (entry->compression_method != COMPMETH_NONE)
+            {
+                inflateReset(&finfo->stream);
+                finfo->stream.avail_in = 0;
+            } /* if */
+
             finfo->uncompressed_position = finfo->compressed_position = 0;
+            if (finfo->checkpoints != NULL)
+                finfo->next_checkpoint = finfo->checkpoints->interval;
 
             if (encrypted)
                 memcpy(finfo->crypto_keys, finfo->initial_crypto_keys, 12);
@@ -456,6 +666,7 @@ static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
     GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, failed);
     memset(finfo, '\0', sizeof (*finfo));
 
+    finfo->info = origfinfo->info;
     finfo->entry = origfinfo->entry;
     finfo->io = zip_get_io(origfinfo->io, NULL, finfo->entry);
     GOTO_IF_ERRPASS(!finfo->io, failed);
@@ -463,12 +674,14 @@ static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
     initializeZStream(&finfo->stream);
     if (finfo->entry->compression_method != COMPMETH_NONE)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        GOTO_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-        if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
+        if (!zip_get_inflater(finfo->info, finfo))
             goto failed;
     } /* if */
 
+    finfo->checkpoints = origfinfo->checkpoints;
+    if (finfo->checkpoints != NULL)
+        finfo->next_checkpoint = finfo->checkpoints->interval;
+
     memcpy(retval, io, sizeof (PHYSFS_Io));
     retval->opaque = finfo;
     return retval;
@@ -502,10 +715,7 @@ static void ZIP_destroy(PHYSFS_Io *io)
     finfo->io->destroy(finfo->io);
 
     if (finfo->entry->compression_method != COMPMETH_NONE)
-        inflateEnd(&finfo->stream);
-
-    if (finfo->buffer != NULL)
-        allocator.Free(finfo->buffer);
+        zip_put_inflater(finfo->info, finfo);
 
     allocator.Free(finfo);
     allocator.Free(io);
@@ -526,6 +736,35 @@ static const PHYSFS_Io ZIP_Io =
 };
 
 
+const PHYSFS_uint8 *ZIP_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    const ZIPfileinfo *finfo;
+    const ZIPentry *entry;
+    const PHYSFS_uint8 *mem;
+    PHYSFS_uint64 memlen;
+
+    if (io->read != ZIP_read)
+        return NULL;
+
+    /* only stored, unencrypted data is the same in memory as it's read. */
+    finfo = (const ZIPfileinfo *) io->opaque;
+    entry = finfo->entry;
+    if (entry->compression_method != COMPMETH_NONE)
+        return NULL;
+    else if (zip_entry_is_tradional_crypto(entry))
+        return NULL;
+
+    mem = __PHYSFS_ioMemory(finfo->io, &memlen);
+    if ((mem == NULL) || (entry->offset > memlen))
+        return NULL;
+    else if (entry->uncompressed_size > memlen - entry->offset)
+        return NULL;  /* truncated archive; let read() report it. */
+
+    *len = entry->uncompressed_size;
+    return mem + entry->offset;
+} /* ZIP_ioMemory */
+
+
 
 static PHYSFS_sint64 zip_find_end_of_central_dir(PHYSFS_Io *io, PHYSFS_sint64 *len)
 {
@@ -967,83 +1206,122 @@ static inline int zip_has_symlink_attr(const ZIPentry *entry,
 } /* zip_has_symlink_attr */
 
 
-static PHYSFS_sint64 zip_dos_time_to_physfs_time(PHYSFS_uint32 dostime)
+static PHYSFS_sint64 zip_dos_time_to_physfs_time(ZIPinfo *info,
+                                                 PHYSFS_uint32 dostime)
 {
-    PHYSFS_uint32 dosdate;
-    struct tm unixtime;
-    memset(&unixtime, '\0', sizeof (unixtime));
-
-    dosdate = (PHYSFS_uint32) ((dostime >> 16) & 0xFFFF);
+    const PHYSFS_uint32 dosdate = (PHYSFS_uint32) ((dostime >> 16) & 0xFFFF);
     dostime &= 0xFFFF;
 
-    /* dissect date */
-    unixtime.tm_year = ((dosdate >> 9) & 0x7F) + 80;
-    unixtime.tm_mon  = ((dosdate >> 5) & 0x0F) - 1;
-    unixtime.tm_mday = ((dosdate     ) & 0x1F);
+    return __PHYSFS_localTimeToUnix(&info->timecache,
+                                    (int) ((dosdate >> 9) & 0x7F) + 80,
+                                    (int) ((dosdate >> 5) & 0x0F) - 1,
+                                    (int) ((dosdate     ) & 0x1F),
+                                    (int) ((dostime >> 11) & 0x1F),
+                                    (int) ((dostime >>  5) & 0x3F),
+                                    (int) ((dostime <<  1) & 0x3E));
+} /* zip_dos_time_to_physfs_time */
+
 
-    /* dissect time */
-    unixtime.tm_hour = ((dostime >> 11) & 0x1F);
-    unixtime.tm_min  = ((dostime >>  5) & 0x3F);
-    unixtime.tm_sec  = ((dostime <<  1) & 0x3E);
+/*
+ * Converting times is slow enough to matter when mounting huge archives,
+ *  and few callers ever look at them, so it's done on the first stat.
+ */
+static PHYSFS_sint64 zip_entry_mod_time(ZIPinfo *info, ZIPentry *entry)
+{
+    if (!entry->has_mod_time)
+    {
+        /* ancestor dirs that DirTree filled in don't have a time. */
+        entry->last_mod_time = (entry->loaded) ?
+            zip_dos_time_to_physfs_time(info, entry->dos_mod_time) : 0;
+        entry->has_mod_time = 1;
+    } /* if */
 
-    /* let mktime calculate daylight savings time. */
-    unixtime.tm_isdst = -1;
+    return entry->last_mod_time;
+} /* zip_entry_mod_time */
 
-    return ((PHYSFS_sint64) mktime(&unixtime));
-} /* zip_dos_time_to_physfs_time */
+
+/*
+ * The central directory is read into memory in one shot and parsed from
+ *  there; these pull little-endian values out of that buffer.
+ */
+static inline PHYSFS_uint16 zip_memui16(const PHYSFS_uint8 *ptr)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) ptr[0]) |
+                            (((PHYSFS_uint16) ptr[1]) << 8));
+} /* zip_memui16 */
+
+
+static inline PHYSFS_uint32 zip_memui32(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint32) zip_memui16(ptr)) |
+           (((PHYSFS_uint32) zip_memui16(ptr + 2)) << 16);
+} /* zip_memui32 */
 
 
+static inline PHYSFS_uint64 zip_memui64(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint64) zip_memui32(ptr)) |
+           (((PHYSFS_uint64) zip_memui32(ptr + 4)) << 32);
+} /* zip_memui64 */
+
+
+/* size of a central directory record, minus the variable-length fields. */
+#define ZIP_CENTRAL_DIR_RECORD_SIZE 46
+
+/*
+ * Parse the central directory record at (*_ptr), and move (*_ptr) past it.
+ *  (end) is the end of the central directory buffer.
+ */
 static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
-                                const PHYSFS_uint64 ofs_fixup)
+                                const PHYSFS_uint64 ofs_fixup,
+                                const PHYSFS_uint8 **_ptr,
+                                const PHYSFS_uint8 *end)
 {
-    PHYSFS_Io *io = info->io;
+    const PHYSFS_uint8 *ptr = *_ptr;
+    const PHYSFS_uint8 *extra;
     ZIPentry entry;
     ZIPentry *retval = NULL;
     PHYSFS_uint16 fnamelen, extralen, commentlen;
     PHYSFS_uint32 external_attr;
     PHYSFS_uint32 starting_disk;
     PHYSFS_uint64 offset;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint32 ui32;
-    PHYSFS_sint64 si64;
     char *name = NULL;
     int isdir = 0;
 
+    BAIL_IF(end - ptr < ZIP_CENTRAL_DIR_RECORD_SIZE, PHYSFS_ERR_CORRUPT, NULL);
+
     /* sanity check with central directory signature... */
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    BAIL_IF(ui32 != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(zip_memui32(ptr) != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
 
     memset(&entry, '\0', sizeof (entry));
 
     /* Get the pertinent parts of the record... */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version_needed), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.general_bits), NULL);  /* general bits */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.compression_method), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &entry.dos_mod_time), NULL);
-    entry.last_mod_time = zip_dos_time_to_physfs_time(entry.dos_mod_time);
-    BAIL_IF_ERRPASS(!readui32(io, &entry.crc), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.compressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.uncompressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui16(io, &fnamelen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &extralen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &commentlen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);
-    starting_disk = (PHYSFS_uint32) ui16;
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);  /* internal file attribs */
-    BAIL_IF_ERRPASS(!readui32(io, &external_attr), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    offset = (PHYSFS_uint64) ui32;
+    entry.version = zip_memui16(ptr + 4);
+    entry.version_needed = zip_memui16(ptr + 6);
+    entry.general_bits = zip_memui16(ptr + 8);
+    entry.compression_method = zip_memui16(ptr + 10);
+    entry.dos_mod_time = zip_memui32(ptr + 12);
+    entry.loaded = 1;
+    entry.crc = zip_memui32(ptr + 16);
+    entry.compressed_size = (PHYSFS_uint64) zip_memui32(ptr + 20);
+    entry.uncompressed_size = (PHYSFS_uint64) zip_memui32(ptr + 24);
+    fnamelen = zip_memui16(ptr + 28);
+    extralen = zip_memui16(ptr + 30);
+    commentlen = zip_memui16(ptr + 32);
+    starting_disk = (PHYSFS_uint32) zip_memui16(ptr + 34);
+    /* internal file attribs at ptr + 36 */
+    external_attr = zip_memui32(ptr + 38);
+    offset = (PHYSFS_uint64) zip_memui32(ptr + 42);
+    ptr += ZIP_CENTRAL_DIR_RECORD_SIZE;
+
+    BAIL_IF(end - ptr < ((PHYSFS_sint64) fnamelen) + extralen + commentlen,
+            PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(fnamelen == 0, PHYSFS_ERR_CORRUPT, NULL);
 
     name = (char *) __PHYSFS_smallAlloc(fnamelen + 1);
     BAIL_IF(!name, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    if (!__PHYSFS_readAll(io, name, fnamelen))
-    {
-        __PHYSFS_smallFree(name);
-        return NULL;
-    } /* if */
+    memcpy(name, ptr, fnamelen);
+    ptr += fnamelen;
 
     if (name[fnamelen - 1] == '/')
     {
@@ -1061,7 +1339,7 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 
     /* It's okay to BAIL without freeing retval, because it's stored in the
        __PHYSFS_DirTree and will be freed later anyhow. */
-    BAIL_IF(retval->last_mod_time != 0, PHYSFS_ERR_CORRUPT, NULL); /* dupe? */
+    BAIL_IF(retval->loaded, PHYSFS_ERR_CORRUPT, NULL); /* dupe? */
 
     /* Move the data we already read into place in the official object. */
     memcpy(((PHYSFS_uint8 *) retval) + sizeof (__PHYSFS_DirTreeEntry),
@@ -1078,8 +1356,7 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
                                 ZIP_UNRESOLVED_SYMLINK : ZIP_UNRESOLVED_FILE;
     } /* else */
 
-    si64 = io->tell(io);
-    BAIL_IF_ERRPASS(si64 == -1, NULL);
+    extra = ptr;
 
     /* If the actual sizes didn't fit in 32-bits, look for the Zip64
         extended information extra field... */
@@ -1089,53 +1366,53 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
           (retval->compressed_size == 0xFFFFFFFF) ||
           (retval->uncompressed_size == 0xFFFFFFFF)) )
     {
-        int found = 0;
-        PHYSFS_uint16 sig = 0;
+        const PHYSFS_uint8 *extraend = extra + extralen;
+        const PHYSFS_uint8 *field = NULL;
         PHYSFS_uint16 len = 0;
-        while (extralen > 4)
+        while (extraend - extra > 4)
         {
-            BAIL_IF_ERRPASS(!readui16(io, &sig), NULL);
-            BAIL_IF_ERRPASS(!readui16(io, &len), NULL);
-
-            si64 += 4 + len;
-            extralen -= 4 + len;
-            if (sig != ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
+            const PHYSFS_uint16 sig = zip_memui16(extra);
+            len = zip_memui16(extra + 2);
+            extra += 4;
+            BAIL_IF(extraend - extra < len, PHYSFS_ERR_CORRUPT, NULL);
+            if (sig == ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
             {
-                BAIL_IF_ERRPASS(!io->seek(io, si64), NULL);
-                continue;
+                field = extra;
+                break;
             } /* if */
-
-            found = 1;
-            break;
+            extra += len;
         } /* while */
 
-        BAIL_IF(!found, PHYSFS_ERR_CORRUPT, NULL);
+        BAIL_IF(!field, PHYSFS_ERR_CORRUPT, NULL);
 
         if (retval->uncompressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->uncompressed_size), NULL);
+            retval->uncompressed_size = zip_memui64(field);
+            field += 8;
             len -= 8;
         } /* if */
 
         if (retval->compressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->compressed_size), NULL);
+            retval->compressed_size = zip_memui64(field);
+            field += 8;
             len -= 8;
         } /* if */
 
         if (offset == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &offset), NULL);
+            offset = zip_memui64(field);
+            field += 8;
             len -= 8;
         } /* if */
 
         if (starting_disk == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui32(io, &starting_disk), NULL);
+            starting_disk = zip_memui32(field);
             len -= 4;
         } /* if */
 
@@ -1146,8 +1423,8 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 
     retval->offset = offset + ofs_fixup;
 
-    /* seek to the start of the next entry in the central directory... */
-    BAIL_IF_ERRPASS(!io->seek(io, si64 + extralen + commentlen), NULL);
+    /* move to the start of the next entry in the central directory... */
+    *_ptr = ptr + extralen + commentlen;
 
     return retval;  /* success. */
 } /* zip_load_entry */
@@ -1157,22 +1434,63 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 static int zip_load_entries(ZIPinfo *info,
                             const PHYSFS_uint64 data_ofs,
                             const PHYSFS_uint64 central_ofs,
+                            const PHYSFS_uint64 central_size,
                             const PHYSFS_uint64 entry_count)
 {
     PHYSFS_Io *io = info->io;
     const int zip64 = info->zip64;
+    const PHYSFS_sint64 iolen = io->length(io);
+    PHYSFS_uint8 *buf = NULL;
+    const PHYSFS_uint8 *mem;
+    const PHYSFS_uint8 *ptr;
+    const PHYSFS_uint8 *end;
+    PHYSFS_uint64 memlen;
     PHYSFS_uint64 i;
 
-    BAIL_IF_ERRPASS(!io->seek(io, central_ofs), 0);
+    BAIL_IF_ERRPASS(iolen == -1, 0);
+    BAIL_IF(central_ofs > (PHYSFS_uint64) iolen, PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(central_size > ((PHYSFS_uint64) iolen) - central_ofs,
+            PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(central_size != (PHYSFS_uint64) (size_t) central_size,
+            PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    /* every record needs at least its fixed part, so don't trust a bogus
+       entry count to size anything. */
+    BAIL_IF(entry_count > central_size / ZIP_CENTRAL_DIR_RECORD_SIZE,
+            PHYSFS_ERR_CORRUPT, 0);
+
+    /* if the whole archive is in memory already, parse it right there. */
+    mem = __PHYSFS_ioMemory(io, &memlen);
+    if ((mem != NULL) && (memlen == (PHYSFS_uint64) iolen))
+        ptr = mem + central_ofs;
+    else
+    {
+        BAIL_IF_ERRPASS(!io->seek(io, central_ofs), 0);
+        buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) (central_size + 1));
+        BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        if (!__PHYSFS_readAll(io, buf, (size_t) central_size))
+        {
+            allocator.Free(buf);
+            return 0;
+        } /* if */
+        ptr = buf;
+    } /* else */
 
+    end = ptr + central_size;
     for (i = 0; i < entry_count; i++)
     {
-        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs);
-        BAIL_IF_ERRPASS(!entry, 0);
+        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs, &ptr, end);
+        if (!entry)
+        {
+            if (buf != NULL)
+                allocator.Free(buf);
+            return 0;
+        } /* if */
         if (zip_entry_is_tradional_crypto(entry))
             info->has_crypto = 1;
     } /* for */
 
+    if (buf != NULL)
+        allocator.Free(buf);
     return 1;
 } /* zip_load_entries */
 
@@ -1269,6 +1587,7 @@ static PHYSFS_sint64 zip64_find_end_of_central_dir(PHYSFS_Io *io,
 static int zip64_parse_end_of_central_dir(ZIPinfo *info,
                                           PHYSFS_uint64 *data_start,
                                           PHYSFS_uint64 *dir_ofs,
+                                          PHYSFS_uint64 *dir_size,
                                           PHYSFS_uint64 *entry_count,
                                           PHYSFS_sint64 pos)
 {
@@ -1344,7 +1663,7 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
     BAIL_IF(ui64 != *entry_count, PHYSFS_ERR_CORRUPT, 0);
 
     /* size of the central directory */
-    BAIL_IF_ERRPASS(!readui64(io, &ui64), 0);
+    BAIL_IF_ERRPASS(!readui64(io, dir_size), 0);
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui64(io, dir_ofs), 0);
@@ -1364,6 +1683,7 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
 static int zip_parse_end_of_central_dir(ZIPinfo *info,
                                         PHYSFS_uint64 *data_start,
                                         PHYSFS_uint64 *dir_ofs,
+                                        PHYSFS_uint64 *dir_size,
                                         PHYSFS_uint64 *entry_count)
 {
     PHYSFS_Io *io = info->io;
@@ -1387,7 +1707,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
     /* Seek back to see if "Zip64 end of central directory locator" exists. */
     /* this record is 20 bytes before end-of-central-dir */
     rc = zip64_parse_end_of_central_dir(info, data_start, dir_ofs,
-                                        entry_count, pos - 20);
+                                        dir_size, entry_count, pos - 20);
 
     /* Error or success? Bounce out of here. Keep going if not zip64. */
     if ((rc == 0) || (rc == 1))
@@ -1417,6 +1737,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 
     /* size of the central directory */
     BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    *dir_size = (PHYSFS_uint64) ui32;
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui32(io, &offset32), 0);
@@ -1460,12 +1781,115 @@ static void ZIP_closeArchive(void *opaque)
     if (info->io)
         info->io->destroy(info->io);
 
+    while (info->checkpoints != NULL)
+    {
+        ZIPcheckpoints *next = info->checkpoints->next;
+        size_t i;
+        for (i = 0; i < info->checkpoints->count; i++)
+        {
+            if (info->checkpoints->slots[i] != NULL)
+                allocator.Free(info->checkpoints->slots[i]);
+        } /* for */
+        allocator.Free(info->checkpoints->slots);
+        allocator.Free(info->checkpoints);
+        info->checkpoints = next;
+    } /* while */
+
+    if (info->checkpoint_lock)
+        __PHYSFS_platformDestroyMutex(info->checkpoint_lock);
+
+    while (info->pool_count > 0)
+    {
+        ZIPinflater *inf = &info->pool[--info->pool_count];
+        inflateEnd(&inf->stream);
+        allocator.Free(inf->buffer);
+    } /* while */
+
+    if (info->pool)
+        allocator.Free(info->pool);
+
+    if (info->pool_lock)
+        __PHYSFS_platformDestroyMutex(info->pool_lock);
+
     __PHYSFS_DirTreeDeinit(&info->tree);
 
     allocator.Free(info);
 } /* ZIP_closeArchive */
 
 
+/*
+ * What the index cache keeps for each ZIPentry. Entries are saved right
+ *  after the central directory is loaded, so nothing is resolved yet.
+ */
+typedef struct
+{
+    PHYSFS_uint64 offset;
+    PHYSFS_uint64 compressed_size;
+    PHYSFS_uint64 uncompressed_size;
+    PHYSFS_uint32 crc;
+    PHYSFS_uint32 dos_mod_time;
+    PHYSFS_uint16 version;
+    PHYSFS_uint16 version_needed;
+    PHYSFS_uint16 general_bits;
+    PHYSFS_uint16 compression_method;
+    PHYSFS_uint8 resolved;
+    PHYSFS_uint8 loaded;
+    PHYSFS_uint8 reserved[6];
+} ZIPindexEntry;
+
+static void zip_pack_entry(void *data, const __PHYSFS_DirTreeEntry *_entry,
+                           PHYSFS_uint8 *buf)
+{
+    const ZIPentry *entry = (const ZIPentry *) _entry;
+    ZIPindexEntry packed;
+
+    memset(&packed, '\0', sizeof (packed));
+    packed.offset = entry->offset;
+    packed.compressed_size = entry->compressed_size;
+    packed.uncompressed_size = entry->uncompressed_size;
+    packed.crc = entry->crc;
+    packed.dos_mod_time = entry->dos_mod_time;
+    packed.version = entry->version;
+    packed.version_needed = entry->version_needed;
+    packed.general_bits = entry->general_bits;
+    packed.compression_method = entry->compression_method;
+    packed.resolved = (PHYSFS_uint8) entry->resolved;
+    packed.loaded = entry->loaded;
+    memcpy(buf, &packed, sizeof (packed));
+} /* zip_pack_entry */
+
+static int zip_unpack_entry(void *data, __PHYSFS_DirTreeEntry *_entry,
+                            const PHYSFS_uint8 *buf)
+{
+    ZIPinfo *info = (ZIPinfo *) data;
+    ZIPentry *entry = (ZIPentry *) _entry;
+    ZIPindexEntry packed;
+
+    memcpy(&packed, buf, sizeof (packed));
+    if ( (packed.resolved != ZIP_UNRESOLVED_FILE) &&
+         (packed.resolved != ZIP_UNRESOLVED_SYMLINK) &&
+         (packed.resolved != ZIP_DIRECTORY) )
+        return 0;
+
+    entry->offset = packed.offset;
+    entry->compressed_size = packed.compressed_size;
+    entry->uncompressed_size = packed.uncompressed_size;
+    entry->crc = packed.crc;
+    entry->dos_mod_time = packed.dos_mod_time;
+    entry->version = packed.version;
+    entry->version_needed = packed.version_needed;
+    entry->general_bits = packed.general_bits;
+    entry->compression_method = packed.compression_method;
+    entry->resolved = (ZipResolveType) packed.resolved;
+    entry->loaded = packed.loaded;
+
+    if (zip_entry_is_tradional_crypto(entry))
+        info->has_crypto = 1;
+
+    return 1;
+} /* zip_unpack_entry */
+
+
 static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
                              int forWriting, int *claimed)
 {
@@ -1473,6 +1897,7 @@ static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
     ZIPentry *root = NULL;
     PHYSFS_uint64 dstart = 0;  /* data start */
     PHYSFS_uint64 cdir_ofs;  /* central dir offset */
+    PHYSFS_uint64 cdir_size;  /* central dir size */
     PHYSFS_uint64 count;
 
     assert(io != NULL);  /* shouldn't ever happen. */
@@ -1488,18 +1913,54 @@ static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     info->io = io;
 
-    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &count))
+    /* checkpoints are optional, so just go without if we can't lock them. */
+    info->checkpoint_interval = PHYSFS_getSeekCheckpoints();
+    if (info->checkpoint_interval > 0)
+    {
+        info->checkpoint_lock = __PHYSFS_platformCreateMutex();
+        if (!info->checkpoint_lock)
+            info->checkpoint_interval = 0;
+    } /* if */
+
+    /* ...and so is the inflater pool. */
+    info->pool_size = (size_t) PHYSFS_getInflaterPool();
+    if (info->pool_size > ((size_t) -1) / sizeof (ZIPinflater))
+        info->pool_size = 0;
+    else if (info->pool_size > 0)
+    {
+        const size_t len = info->pool_size * sizeof (ZIPinflater);
+        info->pool_lock = __PHYSFS_platformCreateMutex();
+        if (info->pool_lock)
+            info->pool = (ZIPinflater *) allocator.Malloc(len);
+        if (!info->pool)
+            info->pool_size = 0;
+    } /* if */
+
+    if (__PHYSFS_DirTreeLoadIndex(&info->tree, sizeof (ZIPentry), 1, 0, io,
+                                  "zip", sizeof (ZIPindexEntry),
+                                  zip_unpack_entry, info))
+    {
+        root = (ZIPentry *) info->tree.root;
+        root->resolved = ZIP_DIRECTORY;
+        return info;
+    } /* if */
+
+    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &cdir_size,
+                                      &count))
         goto ZIP_openarchive_failed;
-    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry), 1, 0))
+    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry), 1, 0, count))
         goto ZIP_openarchive_failed;
 
     root = (ZIPentry *) info->tree.root;
     root->resolved = ZIP_DIRECTORY;
 
-    if (!zip_load_entries(info, dstart, cdir_ofs, count))
+    if (!zip_load_entries(info, dstart, cdir_ofs, cdir_size, count))
         goto ZIP_openarchive_failed;
 
     assert(info->tree.root->sibling == NULL);
+
+    __PHYSFS_DirTreeSaveIndex(&info->tree, io, "zip", sizeof (ZIPindexEntry),
+                              zip_pack_entry, info);
     return info;
 
 ZIP_openarchive_failed:
@@ -1536,6 +1997,69 @@ static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry)
 } /* zip_get_io */
 
 
+/*
+ * Find the checkpoints (entry) shares with every other handle open on it,
+ *  creating them the first time through. Returns NULL if the archive isn't
+ *  keeping checkpoints, if (entry) is too small to need any, or if we're out
+ *  of memory; handles without checkpoints just inflate from the start.
+ */
+static ZIPcheckpoints *zip_find_checkpoints(ZIPinfo *info, ZIPentry *entry)
+{
+    const PHYSFS_uint64 interval = info->checkpoint_interval;
+    ZIPcheckpoints *retval;
+    PHYSFS_uint64 count;
+
+    if (interval == 0)
+        return NULL;
+    else if (entry->compression_method == COMPMETH_NONE)
+        return NULL;  /* seeking is already cheap. */
+    else if (zip_entry_is_tradional_crypto(entry))
+        return NULL;  /* we'd have to save the crypto keys, too. */
+
+    count = (entry->uncompressed_size > 0) ?
+                (entry->uncompressed_size - 1) / interval : 0;
+    if ((count == 0) || (count > (((size_t) -1) / sizeof (ZIPcheckpoint *))))
+        return NULL;
+
+    __PHYSFS_platformGrabMutex(info->checkpoint_lock);
+
+    for (retval = info->checkpoints; retval != NULL; retval = retval->next)
+    {
+        if (retval->entry == entry)
+            break;
+    } /* for */
+
+    if (retval == NULL)
+    {
+        const size_t slotslen = ((size_t) count) * sizeof (ZIPcheckpoint *);
+        retval = (ZIPcheckpoints *) allocator.Malloc(sizeof (*retval));
+        if (retval != NULL)
+        {
+            retval->slots = (ZIPcheckpoint **) allocator.Malloc(slotslen);
+            if (retval->slots == NULL)
+            {
+                allocator.Free(retval);
+                retval = NULL;
+            } /* if */
+            else
+            {
+                memset(retval->slots, '\0', slotslen);
+                retval->entry = entry;
+                retval->lock = info->checkpoint_lock;
+                retval->interval = interval;
+                retval->count = (size_t) count;
+                retval->next = info->checkpoints;
+                info->checkpoints = retval;
+            } /* else */
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(info->checkpoint_lock);
+
+    return retval;
+} /* zip_find_checkpoints */
+
+
 static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
 {
     PHYSFS_Io *retval = NULL;
@@ -1578,15 +2102,13 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
     io = zip_get_io(info->io, info, entry);
     GOTO_IF_ERRPASS(!io, ZIP_openRead_failed);
     finfo->io = io;
+    finfo->info = info;
     finfo->entry = ((entry->symlink != NULL) ? entry->symlink : entry);
     initializeZStream(&finfo->stream);
 
     if (finfo->entry->compression_method != COMPMETH_NONE)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        if (!finfo->buffer)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-        else if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
+        if (!zip_get_inflater(info, finfo))
             goto ZIP_openRead_failed;
     } /* if */
 
@@ -1602,6 +2124,13 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
             goto ZIP_openRead_failed;
     } /* if */
 
+    if (password == NULL)
+    {
+        finfo->checkpoints = zip_find_checkpoints(info, finfo->entry);
+        if (finfo->checkpoints != NULL)
+            finfo->next_checkpoint = finfo->checkpoints->interval;
+    } /* if */
+
     memcpy(retval, &ZIP_Io, sizeof (PHYSFS_Io));
     retval->opaque = finfo;
 
@@ -1682,7 +2211,7 @@ static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
         stat->filetype = PHYSFS_FILETYPE_REGULAR;
     } /* else */
 
-    stat->modtime = ((entry) ? entry->last_mod_time : 0);
+    stat->modtime = zip_entry_mod_time(info, entry);
     stat->createtime = stat->modtime;
     stat->accesstime = -1;
     stat->readonly = 1; /* .zip files are always read only */
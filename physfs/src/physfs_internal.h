@@ -65,6 +65,19 @@ extern "C" {
 #define _FILE_OFFSET_BITS 64
 #endif
 
+/* Thread-local storage, if the compiler has it, so per-thread error state
+   doesn't need a lock. Define PHYSFS_NO_THREAD_LOCAL to use a locked list
+   instead (for platforms where TLS is missing or broken). */
+#ifndef PHYSFS_NO_THREAD_LOCAL
+#if defined(_MSC_VER)
+#define PHYSFS_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define PHYSFS_THREAD_LOCAL _Thread_local
+#elif PHYSFS_MINIMUM_GCC_VERSION(3,3) || defined(__clang__)
+#define PHYSFS_THREAD_LOCAL __thread
+#endif
+#endif
+
 /* All public APIs need to be in physfs.h with a PHYSFS_DECL.
    All file-private symbols need to be marked "static".
    Everything shared between PhysicsFS sources needs to be in this
@@ -380,6 +393,36 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode);
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
                                    void (*destruct)(void *));
 
+/*
+ * Same as __PHYSFS_createMemoryIo(), but (destruct) is called with (owner)
+ *  instead of (buf), for when (buf) is part of something bigger that the
+ *  Io should hold on to, like a decoded block several files point into.
+ */
+PHYSFS_Io *__PHYSFS_createOwnedMemoryIo(const void *buf, PHYSFS_uint64 len,
+                                        void (*destruct)(void *),
+                                        void *owner);
+
+/*
+ * If all of (io)'s data is already in memory (a memory Io, a native Io that
+ *  was mapped at mount time, an uncompressed file in an archive that's
+ *  one of those, or a file in a 7zip block, which gets decompressed
+ *  first), return a pointer to it and put its length in (*len), so
+ *  archivers can parse in place instead of reading into a buffer of their
+ *  own. Returns NULL otherwise, which isn't an error and
+ *  doesn't touch the error state. The pointer is valid as long as (io) or
+ *  any of its duplicates are alive. Read-only!
+ */
+const PHYSFS_uint8 *__PHYSFS_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len);
+
+/* archivers that can answer __PHYSFS_ioMemory() for the Ios they make. */
+const PHYSFS_uint8 *UNPK_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len);
+#if PHYSFS_SUPPORTS_ZIP
+const PHYSFS_uint8 *ZIP_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len);
+#endif
+#if PHYSFS_SUPPORTS_7Z
+const PHYSFS_uint8 *SZIP_ioMemory(PHYSFS_Io *io, PHYSFS_uint64 *len);
+#endif
+
 
 /*
  * Read (len) bytes from (io) into (buf). Returns non-zero on success,
@@ -388,10 +431,41 @@ PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t len);
 
 
+/*
+ * Archives store local times as broken-down fields, and mktime() is slow
+ *  (it takes a lock in most C runtimes). Entries in an archive tend to come
+ *  from the same few hours, so this remembers the last hour it converted
+ *  and adds the minutes and seconds arithmetically. Fields are as in
+ *  struct tm (years since 1900, zero-based month). Zero-initialize (cache)
+ *  before first use; it isn't thread safe, so keep one per archive, or per
+ *  load.
+ */
+typedef struct __PHYSFS_LocalTimeCache
+{
+    int valid;
+    int year, mon, mday, hour;
+    PHYSFS_sint64 base;
+} __PHYSFS_LocalTimeCache;
+
+PHYSFS_sint64 __PHYSFS_localTimeToUnix(__PHYSFS_LocalTimeCache *cache,
+                                       int year, int mon, int mday,
+                                       int hour, int min, int sec);
+
+
 /* These are shared between some archivers. */
 
 /* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here. */
-void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive, const int only_usascii);
+/* (entrycount) is a hint for presizing the directory tree; 0 if unknown. */
+/* (tag) names the format in the index cache (see __PHYSFS_DirTreeLoadIndex());
+   if it's not NULL and the cache has this archive, the tree is filled in
+   from it and UNPK_isIndexed() says so, so skip adding entries. Call
+   UNPK_saveIndex() once they're all added; it does nothing for cached or
+   untagged archives. Pass NULL for formats that use UNPK_addDeferredDir(). */
+void *UNPK_openArchive(PHYSFS_Io *io, const char *tag,
+                       const int case_sensitive, const int only_usascii,
+                       const PHYSFS_uint64 entrycount);
+int UNPK_isIndexed(void *opaque);
+void UNPK_saveIndex(void *opaque);
 void UNPK_abandonArchive(void *opaque);
 void UNPK_closeArchive(void *opaque);
 void *UNPK_addEntry(void *opaque, char *name, const int isdir,
@@ -405,6 +479,25 @@ int UNPK_mkdir(void *opaque, const char *name);
 int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
 #define UNPK_enumerate __PHYSFS_DirTreeEnumerate
 
+/*
+ * Formats that list each directory separately can add dirs with
+ *  UNPK_addDeferredDir() and read them later: the first time something
+ *  inside the dir at (path) is needed, (loader) is called to UNPK_addEntry()
+ *  its children from the (len) bytes at (pos) of the archive's (io), with
+ *  the (data) given to UNPK_setDirLoader(). Return zero with the error
+ *  state set on failure. Set the loader before adding any deferred dirs,
+ *  with the (rootpos) of the root dir's own listing: a dir listed at the
+ *  same (pos) as the root or any other dir it's in is rejected as corrupt.
+ *  Archives with deferred dirs can't use the index cache.
+ */
+typedef int (*UNPK_DirLoader)(void *opaque, PHYSFS_Io *io, const char *path,
+                              const PHYSFS_uint64 pos, const PHYSFS_uint64 len,
+                              const void *data);
+void UNPK_setDirLoader(void *opaque, UNPK_DirLoader loader, const void *data,
+                       const PHYSFS_uint64 rootpos);
+void *UNPK_addDeferredDir(void *opaque, char *name,
+                          const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len);
 
 
 /* Optional API many archivers use this to manage their directory tree. */
@@ -412,26 +505,40 @@ int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
 
 typedef struct __PHYSFS_DirTreeEntry
 {
-    char *name;                              /* Full path in archive.        */
+    char *name;                              /* Last path element in archive. */
+    struct __PHYSFS_DirTreeEntry *parent;    /* containing dir, NULL for root. */
     struct __PHYSFS_DirTreeEntry *hashnext;  /* next item in hash bucket.    */
     struct __PHYSFS_DirTreeEntry *children;  /* linked list of kids, if dir. */
     struct __PHYSFS_DirTreeEntry *sibling;   /* next item in same dir.       */
+    PHYSFS_uint32 hashval;                   /* hash of the full path.       */
     int isdir;
+    int unloaded;  /* dir whose children haven't been read in yet. */
 } __PHYSFS_DirTreeEntry;
 
+/* Fills in the children of (dir), found at (path); see __PHYSFS_DirTreeSetLoader(). */
+typedef int (*__PHYSFS_DirTreeLoadFn)(void *data, __PHYSFS_DirTreeEntry *dir,
+                                      const char *path);
+
 typedef struct __PHYSFS_DirTree
 {
     __PHYSFS_DirTreeEntry *root;    /* root of directory tree.             */
     __PHYSFS_DirTreeEntry **hash;  /* all entries hashed for fast lookup. */
-    size_t hashBuckets;            /* number of buckets in hash.          */
+    size_t hashBuckets;            /* number of buckets in hash (pow2).   */
+    size_t entryCount;             /* number of entries in hash.          */
     size_t entrylen;    /* size in bytes of entries (including subclass). */
+    void *arena;        /* blocks that entries and names are carved from. */
     int case_sensitive;  /* non-zero to treat entries as case-sensitive in DirTreeFind */
     int only_usascii;  /* non-zero to treat paths as US ASCII only (one byte per char, only 'A' through 'Z' are considered for case folding). */
+    __PHYSFS_DirTreeLoadFn load;  /* fills in unloaded dirs, NULL if none. */
+    void *loaddata;     /* passed to (load). */
+    size_t unloadedCount;  /* dirs still waiting for (load). */
 } __PHYSFS_DirTree;
 
 
 /* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here. */
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii);
+/* (entrycount) is a hint for presizing the hash; 0 if unknown. The hash
+   grows as needed either way, so the hint only saves rehashing. */
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii, const PHYSFS_uint64 entrycount);
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir);
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path);
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
@@ -439,6 +546,49 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
                               const char *origdir, void *callbackdata);
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt);
 
+/*
+ * Archivers that can read one directory at a time can skip reading the
+ *  rest at open time: give the tree a (load) function, and mark dirs with
+ *  __PHYSFS_DirTreeDeferDir() instead of adding their children. The first
+ *  lookup under one of those dirs, or enumeration of it, calls (load) to
+ *  add its children (which can defer dirs of their own). Lookups in such a
+ *  tree change it, so only do them from archiver calls, which PhysicsFS
+ *  never runs at the same time for one archive. Trees like this aren't
+ *  put in the search path index, which would need every entry up front.
+ */
+void __PHYSFS_DirTreeSetLoader(__PHYSFS_DirTree *dt,
+                               __PHYSFS_DirTreeLoadFn load, void *data);
+void __PHYSFS_DirTreeDeferDir(__PHYSFS_DirTree *dt,
+                              __PHYSFS_DirTreeEntry *dir);
+
+/*
+ * The optional on-disk index cache (see PHYSFS_setIndexCacheDir()) lets an
+ *  archiver rebuild its tree for an unchanged archive without parsing it.
+ *  Call these from openArchive, with the (io) it was given; only archives
+ *  opened straight from a native file are cached. (tag) is a short name
+ *  for the archiver's format; change it if the packed data changes. Every
+ *  entry but the root gets (packlen) bytes of archiver data, written by
+ *  (pack) and read back by (unpack), which returns zero if it's bogus.
+ * __PHYSFS_DirTreeLoadIndex() initializes (dt) like __PHYSFS_DirTreeInit()
+ *  and fills it in from the cache, returning zero (with (dt) cleared) if
+ *  there's no usable cache. __PHYSFS_DirTreeSaveIndex() is best-effort.
+ *  Neither one touches the error state.
+ */
+typedef void (*__PHYSFS_DirTreePackFn)(void *data,
+                                       const __PHYSFS_DirTreeEntry *entry,
+                                       PHYSFS_uint8 *buf);
+typedef int (*__PHYSFS_DirTreeUnpackFn)(void *data,
+                                        __PHYSFS_DirTreeEntry *entry,
+                                        const PHYSFS_uint8 *buf);
+int __PHYSFS_DirTreeLoadIndex(__PHYSFS_DirTree *dt, const size_t entrylen,
+                              const int case_sensitive,
+                              const int only_usascii, PHYSFS_Io *io,
+                              const char *tag, const size_t packlen,
+                              __PHYSFS_DirTreeUnpackFn unpack, void *data);
+void __PHYSFS_DirTreeSaveIndex(__PHYSFS_DirTree *dt, PHYSFS_Io *io,
+                               const char *tag, const size_t packlen,
+                               __PHYSFS_DirTreePackFn pack, void *data);
+
 
 
 /*--------------------------------------------------------------------------*/
@@ -547,6 +697,32 @@ void *__PHYSFS_platformOpenAppend(const char *filename);
  */
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len);
 
+/*
+ * Like __PHYSFS_platformRead(), but read from (offset) bytes into the file
+ *  instead of the file pointer's position, and don't depend on or care
+ *  about where the file pointer is afterwards. Several threads may call
+ *  this on the same handle at once, so duplicates of a read-only native
+ *  PHYSFS_Io can share one handle. Platforms that can't do this define
+ *  PHYSFS_NO_PLATFORM_READAT in physfs_platforms.h, and this is never
+ *  called there.
+ */
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len,
+                                      PHYSFS_uint64 offset);
+
+/*
+ * Map the first (len) bytes of a file opened with
+ *  __PHYSFS_platformOpenRead() into memory, read-only, and return a pointer
+ *  to them. The mapping must stay valid after the handle is closed, until
+ *  __PHYSFS_platformUnmap() is called with the same pointer and length.
+ *  Call PHYSFS_setErrorCode() and return NULL if it can't be done; callers
+ *  fall back to reading. Platforms that can't do this at all define
+ *  PHYSFS_NO_PLATFORM_MMAP in physfs_platforms.h, and these are never
+ *  called there.
+ */
+void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 len);
+void __PHYSFS_platformUnmap(void *ptr, PHYSFS_uint64 len);
+
 /*
  * Write more data to a platform-specific file handle. (opaque) should be
  *  cast to whatever data type your platform uses. Write a maximum of (len)
@@ -681,6 +857,15 @@ char *__PHYSFS_platformCalcPrefDir(const char *org, const char *app);
 void *__PHYSFS_platformGetThreadID(void);
 
 
+/*
+ * Return a number that identifies the current process; no two processes
+ *  running at the same time may have the same one. Together with
+ *  __PHYSFS_platformGetThreadID() this makes names that no other thread
+ *  on the system is using.
+ */
+PHYSFS_uint32 __PHYSFS_platformGetProcessID(void);
+
+
 /*
  * Enumerate a directory of files. This follows the rules for the
  *  PHYSFS_Archiver::enumerate() method, except that the (dirName) that is
@@ -715,6 +900,27 @@ int __PHYSFS_platformMkDir(const char *path);
 int __PHYSFS_platformDelete(const char *path);
 
 
+/*
+ * Rename the file (src) to (dst), both in platform-dependent notation,
+ *  replacing (dst) if it exists. Where the platform allows it, readers of
+ *  (dst) see either the old file or the new one, never a partial one.
+ *
+ * On error, return zero and set the error message. Return non-zero on success.
+ */
+int __PHYSFS_platformRename(const char *src, const char *dst);
+
+
+/*
+ * Get an absolute path for the existing file (path), in platform-dependent
+ *  notation, with "." and ".." resolved, so different spellings of the same
+ *  path come out the same. Resolving symlinks is optional.
+ *
+ * Return a string allocated with allocator.Malloc(), or NULL on error (and
+ *  set the error message).
+ */
+char *__PHYSFS_platformRealPath(const char *path);
+
+
 /*
  * Create a platform-specific mutex. This can be whatever datatype your
  *  platform uses for mutexes, but it is cast to a (void *) for abstractness.
@@ -761,6 +967,23 @@ int __PHYSFS_platformGrabMutex(void *mutex);
  */
 void __PHYSFS_platformReleaseMutex(void *mutex);
 
+/*
+ * Start a new thread running (fn)(data). Return a handle to pass to
+ *  __PHYSFS_platformJoinThread(), or NULL if the thread couldn't be started.
+ *  Callers have to cope with NULL by doing the work themselves, so systems
+ *  without threads can always return it.
+ *
+ * _DO NOT_ set the physfs error code in here; failing to start a thread
+ *  isn't an error for the caller.
+ */
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data);
+
+/*
+ * Wait for a thread started with __PHYSFS_platformCreateThread() to return
+ *  from its function, and clean up any resources associated with it.
+ */
+void __PHYSFS_platformJoinThread(void *thread);
+
 
 /* !!! FIXME: move to public API? */
 PHYSFS_uint32 __PHYSFS_utf8codepoint(const char **_str);
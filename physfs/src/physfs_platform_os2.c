@@ -621,6 +621,26 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    /* PHYSFS_NO_PLATFORM_READAT is defined here, so this isn't called. */
+    BAIL(PHYSFS_ERR_UNSUPPORTED, -1);
+} /* __PHYSFS_platformReadAt */
+
+
+void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 len)
+{
+    /* PHYSFS_NO_PLATFORM_MMAP is defined here, so this isn't called. */
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *ptr, PHYSFS_uint64 len)
+{
+} /* __PHYSFS_platformUnmap */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buf,
                                      PHYSFS_uint64 len)
 {
@@ -702,6 +722,45 @@ done:
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    char *cpsrc = cvtUtf8ToCodepage(src);
+    char *cpdst = NULL;
+    APIRET rc;
+    int retval = 0;
+
+    BAIL_IF_ERRPASS(!cpsrc, 0);
+    cpdst = cvtUtf8ToCodepage(dst);
+    GOTO_IF_ERRPASS(!cpdst, done);
+
+    /* DosMove() won't replace an existing file, so this isn't atomic. */
+    DosDelete(cpdst);  /* ignore errors; (dst) might not exist. */
+    rc = DosMove(cpsrc, cpdst);
+    GOTO_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), done);
+    retval = 1;  /* success */
+
+done:
+    if (cpdst)
+        allocator.Free(cpdst);
+    allocator.Free(cpsrc);
+    return retval;
+} /* __PHYSFS_platformRename */
+
+
+char *__PHYSFS_platformRealPath(const char *path)
+{
+    char *cppath = cvtUtf8ToCodepage(path);
+    char buf[CCHMAXPATH];
+    APIRET rc;
+
+    BAIL_IF_ERRPASS(!cppath, NULL);
+    rc = DosQueryPathInfo(cppath, FIL_QUERYFULLNAME, buf, sizeof (buf));
+    allocator.Free(cppath);
+    BAIL_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), NULL);
+    return cvtCodepageToUtf8(buf);
+} /* __PHYSFS_platformRealPath */
+
+
 /* Convert to a format PhysicsFS can grok... */
 PHYSFS_sint64 os2TimeToUnixTime(const FDATE *date, const FTIME *time)
 {
@@ -780,6 +839,18 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint32 __PHYSFS_platformGetProcessID(void)
+{
+    PTIB ptib;
+    PPIB ppib;
+
+    /* same as __PHYSFS_platformGetThreadID(): this shouldn't ever fail. */
+    const APIRET rc = DosGetInfoBlocks(&ptib, &ppib);
+    BAIL_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), 0);
+    return (PHYSFS_uint32) ppib->pib_ulpid;
+} /* __PHYSFS_platformGetProcessID */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     HMTX hmtx = NULLHANDLE;
@@ -807,6 +878,51 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     DosReleaseMutexSem((HMTX) mutex);
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    TID tid;
+    void (*fn)(void *);
+    void *data;
+} Os2Thread;
+
+
+static void APIENTRY os2ThreadEntry(ULONG arg)
+{
+    Os2Thread *t = (Os2Thread *) arg;
+    t->fn(t->data);
+} /* os2ThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    Os2Thread *t = (Os2Thread *) allocator.Malloc(sizeof (Os2Thread));
+    APIRET rc;
+
+    if (!t)
+        return NULL;
+
+    t->fn = fn;
+    t->data = data;
+    rc = DosCreateThread(&t->tid, os2ThreadEntry, (ULONG) t,
+                         CREATE_READY | STACK_SPARSE, 256 * 1024);
+    if (rc != NO_ERROR)
+    {
+        allocator.Free(t);
+        return NULL;
+    } /* if */
+
+    return ((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    Os2Thread *t = (Os2Thread *) thread;
+    DosWaitThread(&t->tid, DCWW_WAIT);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
 #endif  /* PHYSFS_PLATFORM_OS2 */
 
 /* end of physfs_platform_os2.c ... */
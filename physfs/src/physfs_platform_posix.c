@@ -15,10 +15,12 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <pwd.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 
 #include "physfs_internal.h"
@@ -249,6 +251,43 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const int fd = *((int *) opaque);
+    ssize_t rc = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    do {
+        rc = pread(fd, buffer, (size_t) len, (off_t) offset);
+    } while ((rc == -1) && (errno == EINTR));
+    BAIL_IF(rc == -1, errcodeFromErrno(), -1);
+    assert(rc >= 0);
+    assert(rc <= len);
+    return (PHYSFS_sint64) rc;
+} /* __PHYSFS_platformReadAt */
+
+
+void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 len)
+{
+    const int fd = *((int *) opaque);
+    void *retval;
+
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len), PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    retval = mmap(NULL, (size_t) len, PROT_READ, MAP_PRIVATE, fd, 0);
+    BAIL_IF(retval == MAP_FAILED, errcodeFromErrno(), NULL);
+    return retval;
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *ptr, PHYSFS_uint64 len)
+{
+    munmap(ptr, (size_t) len);
+} /* __PHYSFS_platformUnmap */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -328,6 +367,26 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    BAIL_IF(rename(src, dst) == -1, errcodeFromErrno(), 0);
+    return 1;
+} /* __PHYSFS_platformRename */
+
+
+char *__PHYSFS_platformRealPath(const char *path)
+{
+    char resolved[PATH_MAX];
+    char *retval;
+
+    BAIL_IF(!realpath(path, resolved), errcodeFromErrno(), NULL);
+    retval = (char *) allocator.Malloc(strlen(resolved) + 1);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    strcpy(retval, resolved);
+    return retval;
+} /* __PHYSFS_platformRealPath */
+
+
 int __PHYSFS_platformStat(const char *fname, PHYSFS_Stat *st, const int follow)
 {
     struct stat statbuf;
@@ -381,6 +440,12 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint32 __PHYSFS_platformGetProcessID(void)
+{
+    return (PHYSFS_uint32) getpid();
+} /* __PHYSFS_platformGetProcessID */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     int rc;
@@ -443,6 +508,48 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     } /* if */
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    pthread_t thread;
+    void (*fn)(void *);
+    void *data;
+} PthreadThread;
+
+
+static void *pthreadThreadEntry(void *arg)
+{
+    PthreadThread *t = (PthreadThread *) arg;
+    t->fn(t->data);
+    return NULL;
+} /* pthreadThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    PthreadThread *t = (PthreadThread *) allocator.Malloc(sizeof (PthreadThread));
+    if (!t)
+        return NULL;
+
+    t->fn = fn;
+    t->data = data;
+    if (pthread_create(&t->thread, NULL, pthreadThreadEntry, t) != 0)
+    {
+        allocator.Free(t);
+        return NULL;
+    } /* if */
+
+    return ((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    PthreadThread *t = (PthreadThread *) thread;
+    pthread_join(t->thread, NULL);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
 #endif  /* PHYSFS_PLATFORM_POSIX */
 
 /* end of physfs_platform_posix.c ... */
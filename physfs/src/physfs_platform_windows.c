@@ -631,6 +631,12 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint32 __PHYSFS_platformGetProcessID(void)
+{
+    return (PHYSFS_uint32) GetCurrentProcessId();
+} /* __PHYSFS_platformGetProcessID */
+
+
 PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
                                PHYSFS_EnumerateCallback callback,
                                const char *origdir, void *callbackdata)
@@ -780,6 +786,79 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    HANDLE h = (HANDLE) opaque;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buf;
+    PHYSFS_sint64 totalRead = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    while (len > 0)
+    {
+        const DWORD thislen = (len > 0xFFFFFFFF) ? 0xFFFFFFFF : (DWORD) len;
+        DWORD numRead = 0;
+        OVERLAPPED ov;
+
+        /* this moves the file pointer too, but nothing shared relies on it. */
+        memset(&ov, '\0', sizeof (ov));
+        ov.Offset = (DWORD) (offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD) (offset >> 32);
+        if (!ReadFile(h, ptr, thislen, &numRead, &ov))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+            BAIL(errcodeFromWinApi(), -1);
+        } /* if */
+
+        ptr += numRead;
+        offset += (PHYSFS_uint64) numRead;
+        len -= (PHYSFS_uint64) numRead;
+        totalRead += (PHYSFS_sint64) numRead;
+        if (numRead != thislen)
+            break;
+    } /* while */
+
+    return totalRead;
+} /* __PHYSFS_platformReadAt */
+
+
+void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 len)
+{
+    HANDLE h = (HANDLE) opaque;
+    HANDLE mapping;
+    PHYSFS_ErrorCode err;
+    void *retval;
+
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len), PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+#ifdef PHYSFS_PLATFORM_WINRT
+    mapping = CreateFileMappingFromApp(h, NULL, PAGE_READONLY, 0, NULL);
+#else
+    mapping = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+#endif
+    BAIL_IF(mapping == NULL, errcodeFromWinApi(), NULL);
+
+#ifdef PHYSFS_PLATFORM_WINRT
+    retval = MapViewOfFileFromApp(mapping, FILE_MAP_READ, 0, (SIZE_T) len);
+#else
+    retval = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T) len);
+#endif
+    err = (retval == NULL) ? errcodeFromWinApi() : PHYSFS_ERR_OK;
+    CloseHandle(mapping);  /* the view keeps the mapping alive. */
+    BAIL_IF(retval == NULL, err, NULL);
+    return retval;
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *ptr, PHYSFS_uint64 len)
+{
+    (void) UnmapViewOfFile(ptr);
+} /* __PHYSFS_platformUnmap */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -874,6 +953,51 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    LPWSTR wsrc = NULL;
+    LPWSTR wdst = NULL;
+    BOOL rc = FALSE;
+
+    UTF8_TO_UNICODE_STACK(wsrc, src);
+    UTF8_TO_UNICODE_STACK(wdst, dst);
+    if (wsrc && wdst)
+        rc = MoveFileExW(wsrc, wdst, MOVEFILE_REPLACE_EXISTING);
+    __PHYSFS_smallFree(wdst);
+    __PHYSFS_smallFree(wsrc);
+
+    BAIL_IF(!wsrc || !wdst, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    BAIL_IF(!rc, errcodeFromWinApi(), 0);
+    return 1;
+} /* __PHYSFS_platformRename */
+
+
+char *__PHYSFS_platformRealPath(const char *path)
+{
+    char *retval = NULL;
+    LPWSTR wpath = NULL;
+    WCHAR *wfull = NULL;
+    DWORD len;
+
+    UTF8_TO_UNICODE_STACK(wpath, path);
+    BAIL_IF(!wpath, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    len = GetFullPathNameW(wpath, 0, NULL, NULL);
+    GOTO_IF(len == 0, errcodeFromWinApi(), realPathDone);
+    wfull = (WCHAR *) allocator.Malloc(len * sizeof (WCHAR));
+    GOTO_IF(!wfull, PHYSFS_ERR_OUT_OF_MEMORY, realPathDone);
+    if (GetFullPathNameW(wpath, len, wfull, NULL) == 0)
+        GOTO(errcodeFromWinApi(), realPathDone);
+    retval = unicodeToUtf8Heap(wfull);
+
+realPathDone:
+    if (wfull)
+        allocator.Free(wfull);
+    __PHYSFS_smallFree(wpath);
+    return retval;
+} /* __PHYSFS_platformRealPath */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     LPCRITICAL_SECTION lpcs;
@@ -910,6 +1034,50 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+typedef struct
+{
+    HANDLE thread;
+    void (*fn)(void *);
+    void *data;
+} WinApiThread;
+
+
+static DWORD WINAPI winApiThreadEntry(LPVOID arg)
+{
+    WinApiThread *t = (WinApiThread *) arg;
+    t->fn(t->data);
+    return 0;
+} /* winApiThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    WinApiThread *t = (WinApiThread *) allocator.Malloc(sizeof (WinApiThread));
+    if (!t)
+        return NULL;
+
+    t->fn = fn;
+    t->data = data;
+    t->thread = CreateThread(NULL, 0, winApiThreadEntry, t, 0, NULL);
+    if (t->thread == NULL)
+    {
+        allocator.Free(t);
+        return NULL;
+    } /* if */
+
+    return ((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    WinApiThread *t = (WinApiThread *) thread;
+    WaitForSingleObject(t->thread, INFINITE);
+    CloseHandle(t->thread);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
 static PHYSFS_sint64 FileTimeToPhysfsTime(const FILETIME *ft)
 {
     SYSTEMTIME st_utc;
@@ -461,6 +461,40 @@ static int cmd_tree(char *args)
 } /* cmd_enumerate */
 
 
+static PHYSFS_EnumerateCallbackResult walkCallback(void *data,
+                                    const char *path, const PHYSFS_Stat *stat)
+{
+    int *total = (int *) data;
+    const char *type = "";
+    if (stat->filetype == PHYSFS_FILETYPE_DIRECTORY)
+        type = "/";
+    else if (stat->filetype == PHYSFS_FILETYPE_SYMLINK)
+        type = " [symbolic link]";
+    printf("%s%s\n", path, type);
+    (*total)++;
+    return PHYSFS_ENUM_OK;
+} /* walkCallback */
+
+
+static int cmd_walk(char *args)
+{
+    int total = 0;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    if (!PHYSFS_walk(args, walkCallback, &total, PHYSFS_WALK_DEPTH_FIRST))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("\n total (%d) items.\n", total);
+
+    return 1;
+} /* cmd_walk */
+
+
 static int cmd_getdirsep(char *args)
 {
     printf("Directory separator is [%s].\n", PHYSFS_getDirSeparator());
@@ -585,6 +619,175 @@ static int cmd_permitsyms(char *args)
 } /* cmd_permitsyms */
 
 
+static int cmd_searchpathindex(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_setSearchPathIndex(num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("Search path index is now %s.\n", num ? "enabled" : "disabled");
+    return 1;
+} /* cmd_searchpathindex */
+
+
+static int cmd_misscache(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_setMissCacheSize((PHYSFS_uint32) num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("Miss cache now holds %d entries.\n", num);
+    return 1;
+} /* cmd_misscache */
+
+
+static int cmd_indexcache(char *args)
+{
+    const char *dir = args;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+        dir = args;
+    } /* if */
+
+    if (strcmp(dir, "-") == 0)
+        dir = NULL;
+
+    if (!PHYSFS_setIndexCacheDir(dir))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else if (dir == NULL)
+        printf("Index cache is now disabled.\n");
+    else
+        printf("Index cache is now in [%s].\n", dir);
+    return 1;
+} /* cmd_indexcache */
+
+
+static int cmd_mapping(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_setArchiveMapping(num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("Archive mapping is now %s.\n", num ? "enabled" : "disabled");
+    return 1;
+} /* cmd_mapping */
+
+
+static int cmd_defaultbuffer(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (num < 0)
+        printf("Buffer size must be positive or zero.\n");
+    else if (!PHYSFS_setDefaultBuffer((PHYSFS_uint64) num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else if (num == 0)
+        printf("Files opened for reading are now unbuffered.\n");
+    else
+        printf("Files opened for reading now get a (%d) byte buffer.\n", num);
+    return 1;
+} /* cmd_defaultbuffer */
+
+
+static int cmd_adaptivebuffer(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_setAdaptiveBuffer(num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("Adaptive buffers are now %s.\n", num ? "enabled" : "disabled");
+    return 1;
+} /* cmd_adaptivebuffer */
+
+
+static int cmd_seekcheckpoints(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (num < 0)
+        printf("Checkpoint interval must be positive or zero.\n");
+    else if (!PHYSFS_setSeekCheckpoints((PHYSFS_uint64) num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else if (num == 0)
+        printf("Archives mounted from now on won't save seek checkpoints.\n");
+    else
+        printf("Archives mounted from now on save a seek checkpoint every (%d) bytes.\n", num);
+    return 1;
+} /* cmd_seekcheckpoints */
+
+
+static int cmd_inflaterpool(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (num < 0)
+        printf("Pool size must be positive or zero.\n");
+    else if (!PHYSFS_setInflaterPool((PHYSFS_uint32) num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else if (num == 0)
+        printf("Archives mounted from now on won't pool inflaters.\n");
+    else
+        printf("Archives mounted from now on keep up to (%d) inflaters.\n", num);
+    return 1;
+} /* cmd_inflaterpool */
+
+
 static int cmd_setbuffer(char *args)
 {
     if (*args == '\"')
@@ -998,6 +1201,40 @@ static int cmd_cat(char *args)
     return 1;
 } /* cmd_cat */
 
+
+static int cmd_mapcat(char *args)
+{
+    PHYSFS_File *f;
+    const char *data;
+    PHYSFS_uint64 len;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    f = PHYSFS_openRead(args);
+    if (f == NULL)
+    {
+        printf("failed to open. Reason: [%s].\n", PHYSFS_getLastError());
+        return 1;
+    } /* if */
+
+    data = (const char *) PHYSFS_mapFile(f, &len);
+    if (data == NULL)
+        printf("failed to map. Reason: [%s].\n", PHYSFS_getLastError());
+    else
+    {
+        fwrite(data, 1, (size_t) len, stdout);
+        printf("\n\n");
+        PHYSFS_unmapFile(f);
+    } /* else */
+
+    PHYSFS_close(f);
+    return 1;
+} /* cmd_mapcat */
+
 static int cmd_cat2(char *args)
 {
     PHYSFS_File *f1 = NULL;
@@ -1197,6 +1434,86 @@ static int cmd_crc32(char *args)
 } /* cmd_crc32 */
 
 
+static int cmd_loadfiles(char *args)
+{
+    PHYSFS_BulkLoad *files;
+    PHYSFS_uint64 total = 0;
+    PHYSFS_uint32 count = 0;
+    PHYSFS_uint32 loaded = 0;
+    PHYSFS_uint32 i;
+    char **rc;
+    char **j;
+    char *dir;
+    int num;
+
+    num = atoi(args);
+    dir = strchr(args, ' ') + 1;
+    if (*dir == '\"')
+    {
+        dir++;
+        dir[strlen(dir) - 1] = '\0';
+    } /* if */
+
+    if (num < 0)
+    {
+        printf("Thread count must be positive or zero.\n");
+        return 1;
+    } /* if */
+
+    rc = PHYSFS_enumerateFiles(dir);
+    if (rc == NULL)
+    {
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+        return 1;
+    } /* if */
+
+    for (j = rc; *j != NULL; j++)
+        count++;
+
+    files = (PHYSFS_BulkLoad *) calloc(count, sizeof (PHYSFS_BulkLoad));
+    if (files == NULL)
+    {
+        printf("Failure. reason: out of memory.\n");
+        PHYSFS_freeList(rc);
+        return 1;
+    } /* if */
+
+    for (i = 0; i < count; i++)
+    {
+        char *fname = (char *) malloc(strlen(dir) + strlen(rc[i]) + 2);
+        if (fname != NULL)
+            sprintf(fname, "%s%s%s", dir, *dir ? "/" : "", rc[i]);
+        files[i].fname = fname;
+    } /* for */
+
+    if (!PHYSFS_loadFiles(files, count, (PHYSFS_uint32) num))
+        printf("Some files failed to load.\n");
+
+    for (i = 0; i < count; i++)
+    {
+        if (files[i].buffer == NULL)
+        {
+            printf("  %s: %s.\n", files[i].fname ? files[i].fname : rc[i],
+                   PHYSFS_getErrorByCode(files[i].error));
+        } /* if */
+        else
+        {
+            loaded++;
+            total += files[i].size;
+            PHYSFS_getAllocator()->Free(files[i].buffer);
+        } /* else */
+        free((void *) files[i].fname);
+    } /* for */
+
+    printf("Loaded (%lu) files, (%lu) bytes, on up to (%d) threads.\n",
+           (unsigned long) loaded, (unsigned long) total, num ? num : 1);
+
+    free(files);
+    PHYSFS_freeList(rc);
+    return 1;
+} /* cmd_loadfiles */
+
+
 static int cmd_filelength(char *args)
 {
     PHYSFS_File *f;
@@ -1440,6 +1757,7 @@ static const command_info commands[] =
     { "enumerate",      cmd_enumerate,      1, "<dirToEnumerate>"           },
     { "ls",             cmd_enumerate,      1, "<dirToEnumerate>"           },
     { "tree",           cmd_tree,           1, "<dirToEnumerate>"           },
+    { "walk",           cmd_walk,           1, "<dirToWalk>"                },
     { "getlasterror",   cmd_getlasterror,   0, NULL                         },
     { "getdirsep",      cmd_getdirsep,      0, NULL                         },
     { "getcdromdirs",   cmd_getcdromdirs,   0, NULL                         },
@@ -1459,6 +1777,7 @@ static const command_info commands[] =
     { "issymlink",      cmd_issymlink,      1, "<fileToCheck>"              },
     { "cat",            cmd_cat,            1, "<fileToCat>"                },
     { "cat2",           cmd_cat2,           2, "<fileToCat1> <fileToCat2>"  },
+    { "mapcat",         cmd_mapcat,         1, "<fileToCat>"                },
     { "filelength",     cmd_filelength,     1, "<fileToCheck>"              },
     { "stat",           cmd_stat,           1, "<fileToStat>"               },
     { "append",         cmd_append,         1, "<fileToAppend>"             },
@@ -1467,8 +1786,17 @@ static const command_info commands[] =
     { "setbuffer",      cmd_setbuffer,      1, "<bufferSize>"               },
     { "stressbuffer",   cmd_stressbuffer,   1, "<bufferSize>"               },
     { "crc32",          cmd_crc32,          1, "<fileToHash>"               },
+    { "loadfiles",      cmd_loadfiles,      2, "<threadCount> <dirToLoad>"  },
     { "getmountpoint",  cmd_getmountpoint,  1, "<dir>"                      },
     { "setroot",        cmd_setroot,        2, "<archiveLocation> <root>"   },
+    { "searchpathindex", cmd_searchpathindex, 1, "<1or0>"                   },
+    { "misscache",      cmd_misscache,      1, "<entryCount>"               },
+    { "indexcache",     cmd_indexcache,     1, "<dirToUseOr->"              },
+    { "mapping",        cmd_mapping,        1, "<1or0>"                     },
+    { "defaultbuffer",  cmd_defaultbuffer,  1, "<bufferSize>"               },
+    { "adaptivebuffer", cmd_adaptivebuffer, 1, "<1or0>"                     },
+    { "seekcheckpoints", cmd_seekcheckpoints, 1, "<interval>"               },
+    { "inflaterpool",   cmd_inflaterpool,   1, "<count>"                    },
     { NULL,             NULL,              -1, NULL                         }
 };
 
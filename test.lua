@@ -106,6 +106,25 @@ function _G.testFile()
    assert(not physfs.exists "_test_file")
 end
 
+function _G.testBuffSize()
+   eq({ physfs.buffSize() }, { 0, false })
+   fail(".-buffer size out of range.*", physfs.buffSize, -1)
+   eq(physfs.buffSize(4096, true), 4096)
+   eq({ physfs.buffSize() }, { 4096, true })
+   local fh = assert(physfs.openWrite "_test_buff")
+   for i = 1, 1000 do assert(fh:writeInt("<4u", i)) end
+   assert(fh:close())
+   fh = assert(physfs.openRead "_test_buff")
+   for i = 1, 1000 do eq(fh:read "<4u", i) end
+   assert(fh:seek(400))
+   eq(fh:read "<4u", 101)
+   eq(fh:read "<4u", 102)
+   assert(fh:close())
+   eq(physfs.buffSize(0), 0)
+   eq({ physfs.buffSize() }, { 0, false })
+   assert(physfs.delete "_test_buff")
+end
+
 function _G.testDir()
    assert(physfs.mkdir "_test_dir")
    eq(physfs.stat "_test_dir".type, "dir")
@@ -118,6 +137,195 @@ function _G.testDir()
    assert(physfs.delete "_test_dir")
 end
 
+function _G.testIndex()
+   eq(physfs.useIndex(), false)
+   assert(physfs.mount("test_mod.zip", "idx", true))
+   eq(physfs.useIndex(true), true)
+   eq(physfs.useIndex(), true)
+   eq(physfs.exists "idx/test_mod.lua", true)
+   eq(physfs.exists "idx/nothing.lua", false)
+   eq(physfs.exists "test_mod.zip", true)
+   eq(physfs.realDir "idx/test_mod.lua", "test_mod.zip")
+   eq(physfs.stat "idx".type, "dir")
+   eq(physfs.stat "idx/test_mod.lua".size, 134)
+   local fh = assert(physfs.openRead "idx/test_mod.lua")
+   local content = assert(fh:read())
+   assert(fh:close())
+
+   -- a prepended archive wins, and gives the path back when unmounted
+   fh = assert(physfs.openRead "test_mod.zip")
+   assert(physfs.mountMemory(assert(fh:read()), "idx_mem", "idx"))
+   assert(fh:close())
+   eq(physfs.realDir "idx/test_mod.lua", "idx_mem")
+   assert(physfs.unmount "idx_mem")
+   eq(physfs.realDir "idx/test_mod.lua", "test_mod.zip")
+
+   fh = assert(physfs.openRead "idx/test_mod.lua")
+   eq(assert(fh:read()), content)
+   fail(".-files still open.*", assert, physfs.unmount "test_mod.zip")
+   eq(physfs.realDir "idx/test_mod.lua", "test_mod.zip")
+   assert(fh:close())
+   assert(physfs.unmount "test_mod.zip")
+   eq(physfs.exists "idx/test_mod.lua", false)
+   eq(physfs.useIndex(false), false)
+   eq(physfs.useIndex(), false)
+end
+
+function _G.testIndexCache()
+   eq(physfs.indexCache(), nil)
+   local ok, err = physfs.indexCache "_test_idx"
+   eq(ok, nil)
+   match(err, "indexCache: .*")
+   assert(physfs.mkdir "_test_idx")
+   eq(physfs.indexCache "_test_idx", "_test_idx")
+   eq(physfs.indexCache(), "_test_idx")
+   for _ = 1, 2 do -- the first mount writes the cache, the second reads it
+      assert(physfs.mount("test_mod.zip", "idx"))
+      local fh = assert(physfs.openRead "idx/test_mod.lua")
+      eq(#assert(fh:read()), physfs.stat "idx/test_mod.lua".size)
+      assert(fh:close())
+      assert(physfs.unmount "test_mod.zip")
+   end
+   local files = assert(physfs.files "_test_idx")
+   eq(#files, 1)
+   match(files[1], "physfs%-zip%-%x+%.idx")
+   eq(physfs.indexCache(false), false)
+   eq(physfs.indexCache(), nil)
+   assert(physfs.delete("_test_idx/" .. files[1]))
+   assert(physfs.delete "_test_idx")
+end
+
+function _G.testInflaterPool()
+   eq(physfs.inflaterPool(), 0)
+   fail(".-pool size out of range.*", physfs.inflaterPool, -1)
+   eq(physfs.inflaterPool(2), 2)
+   eq(physfs.inflaterPool(), 2)
+   assert(physfs.mount("./test_mod.zip", "ip"))
+   local data
+   for _ = 1, 3 do
+      local fh = assert(physfs.openRead "ip/test_mod.lua")
+      local fh2 = assert(physfs.openRead "ip/test_mod.lua")
+      local s = assert(fh:read())
+      assert(fh2:seek(50))
+      assert(fh2:seek(10))
+      eq(assert(fh2:read(20)), s:sub(11, 30))
+      if data then eq(s, data) end
+      data = s
+      assert(fh:close())
+      assert(fh2:close())
+   end
+   assert(physfs.unmount "./test_mod.zip")
+   eq(physfs.inflaterPool(0), 0)
+   eq(physfs.inflaterPool(), 0)
+end
+
+function _G.testLoadFiles()
+   assert(physfs.mount("./test_mod.zip", "lf"))
+   local fh = assert(physfs.openRead "lf/test_mod.lua")
+   local data = assert(fh:read())
+   assert(fh:close())
+   local t = assert(physfs.loadFiles({ "lf/test_mod.lua", "test.lua",
+                                       "lf/test_mod.lua" }, 4))
+   eq(#t, 3)
+   eq(t[1], data)
+   eq(t[3], data)
+   eq(#assert(physfs.loadFiles {}), 0)
+   fail(".-thread count out of range.*", physfs.loadFiles, {}, -1)
+   fail(".-string expected, got table.*", physfs.loadFiles, { {} })
+   eq(select(2, physfs.loadFiles { "test.lua", "lf/_no_such_file" }),
+      "loadFiles: lf/_no_such_file: not found")
+   assert(physfs.unmount "./test_mod.zip")
+end
+
+function _G.testMissCache()
+   eq(physfs.missCache(), 0)
+   eq(physfs.missCache(64), 64)
+   eq(physfs.missCache(), 64)
+   eq(physfs.exists "_test_miss.txt", false)
+   eq(physfs.exists "_test_miss.txt", false)
+   eq(physfs.realDir "_test_miss.txt", nil)
+   assert(not physfs.openRead "_test_miss.txt")
+   local fh = assert(physfs.openWrite "_test_miss.txt")
+   assert(fh:write "miss")
+   assert(fh:close())
+   eq(physfs.exists "_test_miss.txt", true)
+   eq(physfs.stat "_test_miss.txt".size, 4)
+   assert(physfs.delete "_test_miss.txt")
+   eq(physfs.exists "_test_miss.txt", false)
+   eq(physfs.missCache(0), 0)
+   eq(physfs.missCache(), 0)
+end
+
+function _G.testMmap()
+   eq(physfs.useMmap(), false)
+   eq(physfs.useMmap(true), true)
+   eq(physfs.useMmap(), true)
+   -- testLoader leaves "test_mod.zip" mounted, so mount it afresh as
+   -- another path to get a mapped copy
+   assert(physfs.mount("./test_mod.zip", "mm"))
+   local fh = assert(physfs.openRead "mm/test_mod.lua")
+   local fh2 = assert(physfs.openRead "mm/test_mod.lua")
+   eq(assert(fh:read(6)), assert(fh2:read(6)))
+   eq(#assert(fh:read()) + 6, physfs.stat "mm/test_mod.lua".size)
+   assert(fh:close())
+   assert(fh2:close())
+   assert(physfs.unmount "./test_mod.zip")
+   eq(physfs.useMmap(false), false)
+   eq(physfs.useMmap(), false)
+end
+
+function _G.testSeekCheckpoints()
+   eq(physfs.seekCheckpoints(), 0)
+   fail(".-checkpoint interval out of range.*", physfs.seekCheckpoints, -1)
+   eq(physfs.seekCheckpoints(16), 16)
+   eq(physfs.seekCheckpoints(), 16)
+   assert(physfs.mount("./test_mod.zip", "sk"))
+   local fh = assert(physfs.openRead "sk/test_mod.lua")
+   local data = assert(fh:read())
+   for _, pos in ipairs { 100, 20, 70, 0, 33, 120, 5 } do
+      assert(fh:seek(pos))
+      eq(assert(fh:read(10)), data:sub(pos + 1, pos + 10))
+   end
+   assert(fh:close())
+   assert(physfs.unmount "./test_mod.zip")
+   eq(physfs.seekCheckpoints(0), 0)
+   eq(physfs.seekCheckpoints(), 0)
+end
+
+function _G.testFilesStat()
+   assert(physfs.mount("test_mod.zip", "fst"))
+   local files = assert(physfs.files("fst", nil, true))
+   eq(files[1], "test_mod.lua")
+   eq(files["test_mod.lua"].type, "file")
+   eq(files["test_mod.lua"].size, physfs.stat "fst/test_mod.lua".size)
+   files = assert(physfs.files("/", {}, true))
+   eq(files.fst.type, "dir")
+   for i, name in ipairs(files) do
+      eq(files[name].type, physfs.stat(name).type)
+      if i > 1 then assert(files[i-1] < name) end
+   end
+   assert(physfs.unmount "test_mod.zip")
+end
+
+function _G.testWalk()
+   local fh = assert(physfs.openRead "test_mod.zip")
+   assert(physfs.mountMemory(assert(fh:read()), "walk_mem", "walk/a"))
+   assert(fh:close())
+   local paths = {}
+   for path, stat in assert(physfs.walk "walk") do
+      paths[#paths+1] = path
+      eq(stat.type, physfs.stat(path).type)
+   end
+   eq(paths, { "walk/a", "walk/a/test_mod.lua" })
+   paths = {}
+   for path in assert(physfs.walk("walk", "breadth")) do
+      paths[#paths+1] = path
+   end
+   eq(paths, { "walk/a", "walk/a/test_mod.lua" })
+   fail(".-invalid option 'sideways'.*", physfs.walk, "walk", "sideways")
+   assert(physfs.unmount "walk_mem")
+end
+
 function _G.testConv()
    eq(physfs.convInt("<1i", 4), 4)
    eq(physfs.convInt("<2i", 4), 4)